@@ -7,31 +7,50 @@
 // written for onbright 8051 microcontroller
 #include "onbrightFlasher.h"
 
+// flasher on top of the i2c library chosen in projectDefs.h
+#include "wireBus.h"
+
 // example: https://github.com/WestfW/Duino-hacks/blob/master/hvTiny28prog/hvTiny28prog.ino
 #include "simpleParser.h"
 
-// chooses which i2c wire compatible library to use (e.g., software based Softwire, hardware based Wire, or SoftwareWire)
-#include "projectDefs.h"
-
 // same intel hex parser used by Tasmota (originally from c2_prog_wifi project)
 #include "ihx.h"
 
+// framed binary upload, much faster than pasting hex lines
+#include "frameLink.h"
+
+// lets serial input continue while earlier records are being written
+#include "recordPipeline.h"
+
+// checksum of what was written, compared against the chip for a quick verify
+#include "imageChecksum.h"
+
+// crc of each block read back, compared against the crc host computed from its image
+#include "crc16.h"
+
+// i2c clock for each phase, stepped down on marginal wiring and back up when it behaves
+#include "clockRate.h"
+
+// records transactions for comparison with traces of the official programmer
+#include "traceRecorder.h"
+
+// flashes several targets on separate buses with one image
+#include "flasherGang.h"
+
+// copy of target flash, so reading back what was just written needs no bus traffic
+#include "flashShadow.h"
+
+// hex records merged per block and written in address order
+#include "writeStaging.h"
+
+// blocks of the image already on target, so a failed upload can resume
+#include "sessionJournal.h"
+
 // SoftWire seems to work perfectly on ESP8285/ESP8286.
 // However, my ESP32 board sometimes has errors for unknown reasons.
 // ESP32 has hardware I2C which seems to work better with Wire
 // (no write errors, though erase times out but still works...).
-#if defined(USE_SOFTWIRE_LIBRARY) && defined(USE_WIRE_LIBRARY)
-  // FIXME: account for SoftwareWire library also
-  #error Please uncomment either USE_SOFTWIRE_LIBRARY or USE_WIRE_LIBRARY but not both.
-#elif defined(USE_SOFTWIRE_LIBRARY)
-  // needed for softwire timeouts
-  #include <AsyncDelay.h>
-  #include <SoftWire.h>
-#elif defined (USE_SOFTWAREWIRE_LIBRARY)
-  #include "SoftwareWire.h"
-#elif defined(USE_WIRE_LIBRARY)
-  #include <Wire.h>
-#endif
+// the library headers are included by wireBus.h
 
 // these need to be uncommented and defined only if your board definitions do not specify the i2c pins
 // or you want to use alternative pins for software i2c for example
@@ -40,14 +59,60 @@
 //#define PIN_WIRE_SDA 32
 //#define PIN_WIRE_SCL 33
 
-// microcontroller flash size
-#define TARGET_FLASH_SIZE 8192
-#define CONFIG_BYTE_SIZE    64
+// microcontroller flash size, from the chip profile in onbrightFlasher.h
+#define TARGET_FLASH_SIZE FLASH_SIZE
+#define CONFIG_BYTE_SIZE  CONFIG_SIZE
+
+// readback and checksums go through this many bytes at a time instead of holding the whole image
+#define STREAM_BUFFER_SIZE FLASH_BURST_MAX
+
+// binary upload lets host send several frames before waiting for replies
+// they have to fit the serial receive buffer while target is being written
+#if defined(ESP8266) || defined(ESP32)
+  #define SERIAL_RX_BUFFER_SIZE 1024
+  #define FRAME_WINDOW 8
+#elif !defined(FRAME_WINDOW)
+  // e.g., AVR only has a 64 byte receive buffer
+  #define FRAME_WINDOW 1
+#endif
+
+// leave binary mode if host goes quiet, so the serial console is usable again
+#define BINARY_IDLE_TIMEOUT_MS 10000
 
-// NOTE USED CURRENTLY
+// flashhex gives up if target does not answer the handshake within this time
+#define AUTOFLASH_HANDSHAKE_TIMEOUT_MS 30000
+
+// bus time erase, readhex and verify may use per loop() pass before serial and the led get a turn
+#define JOB_SLICE_MICROS 2000
+
+// there seems to be about a 120ms delay in official programmer traces between handshake and chip type
+#define HANDSHAKE_SETTLE_MS 120
+
+// acquire (and flashhex) poll for the handshake window this often, for this long by default
+#define ACQUIRE_POLL_US 100
+#define ACQUIRE_DURATION_MS 10000
+
+// acquire polls without a break for this long before serial gets a turn (e.g., for abort)
+#define ACQUIRE_SLICE_MICROS 50000UL
+
+// with a pin to switch target power, it is kept off this long before acquire switches it on
+#define TARGET_POWER_OFF_MS 200
+#define TARGET_POWER_ON_LEVEL HIGH
+
+// flashhex default fuse, sets reset pin as reset functionality rather than GPIO
+#define AUTOFLASH_FUSE_ADDRESS 18
+#define AUTOFLASH_FUSE_VALUE  249
+
+// OUTPUT_TO_CONTROL_RESET_AVAILABLE lets acquire and flashhex power cycle the target (e.g., through a transistor)
+// PUSH_BUTTON_AVAILABLE is not used currently
 //#define OUTPUT_TO_CONTROL_RESET_AVAILABLE
 //#define PUSH_BUTTON_AVAILABLE
 
+// GANG_TARGETS lets the gang command flash a second target on its own bus (Wire1, e.g., ESP32) at the same time
+//#define GANG_TARGETS 2
+//#define GANG_SDA_1 25
+//#define GANG_SCL_1 26
+
 // uncomment for more print() statements
 // however, some extra information is not very helpful to users
 //#define VERBOSE_DEBUG
@@ -66,7 +131,7 @@
   int pushButton = 0;
 #endif
 
-// not used currently
+// drives target power, TARGET_POWER_ON_LEVEL switches it on
 #if defined(OUTPUT_TO_CONTROL_RESET_AVAILABLE)
  // Sonoff bridge (gpio2)
  int outputToControlReset = 2;
@@ -81,16 +146,22 @@
   #error Please specify PIN_WIRE_SDA pin and PIN_WIRE_SCL pin for your board in the #define(s) present in OnbrightFlasher.ino
 #endif
 
-#if defined(USE_SOFTWIRE_LIBRARY)
-  // use the same name "Wire" so that calls in onbrightFlasher.cpp remain the same
+#if defined(USE_BITBANG_BUS)
+  // flasher keeps a copy of the bus, settings made here are shared by both
+  DefaultBus Wire;
+#elif defined(USE_SOFTWIRE_LIBRARY)
+  // use the same name "Wire" so that the rest of the sketch stays the same whichever library is used
   SoftWire Wire(sdaPin, sclPin);
 #elif defined(USE_SOFTWAREWIRE_LIBRARY)
   // FIXME: enable pull ups, but not sure if we should detect clock stretching or not (i.e. last parameter)
   SoftwareWire Wire(sdaPin, sclPin, true, false);
 #endif
 
+// longest line held: ':', length, address, type, FRAME_PAYLOAD_MAX data bytes and checksum as hex, newline and null
+#define LINE_BUFFER_SIZE (1 + 2 * (FRAME_PAYLOAD_MAX + 5) + 2)
+
 // parses received serial strings looking for hex lines or commands
-simpleParser<100> ttycli(Serial);
+simpleParser<LINE_BUFFER_SIZE> ttycli(Serial);
 
 // set to 1 to allow some debugging messages
 byte debug = 0;
@@ -127,11 +198,97 @@ static const char PROGMEM cmds[] =
   "readhex "
 #define CMD_READ_CONFIGS 14
   "readconfigs "
+#define CMD_BURST 15
+  "burst "
+#define CMD_BINARY 16
+  "binary "
+#define CMD_PIPELINE 17
+  "pipeline "
+#define CMD_SKIP_ERASED 18
+  "skipff "
+#define CMD_VERIFY 19
+  "verify "
+#define CMD_BLOCK_CRC 20
+  "blockcrc "
+#define CMD_BLOCK_VERIFY 21
+  "blockverify "
+#define CMD_RAM 22
+  "ram "
+#define CMD_RATE 23
+  "rate "
+#define CMD_BUSY 24
+  "busy "
+#define CMD_STATS 25
+  "stats "
+#define CMD_TRACE 26
+  "trace "
+#define CMD_ABORT 27
+  "abort "
+#define CMD_ACQUIRE 28
+  "acquire "
+#define CMD_GANG 29
+  "gang "
+#define CMD_SHADOW 30
+  "shadow "
+#define CMD_RESUME 31
+  "resume "
   ;
 
 
+// starts at the fastest clock and watches every transfer result
+ClockRateController clockRate;
+
+// off until "trace 1", recording sits below the clock control so clock changes show up in the trace
+TraceRecorder trace;
+
 // 8051 microcontroller flashing protocol
-OnbrightFlasher flasher;
+typedef AdaptiveBus<TracingBus<DefaultBus> > FlasherBus;
+OnbrightFlasher<FlasherBus> flasher(FlasherBus(TracingBus<DefaultBus>(DefaultBus(Wire), trace), clockRate));
+
+#if defined(GANG_TARGETS)
+  #if !defined(USE_WIRE_LIBRARY) || (GANG_TARGETS != 2) || !defined(GANG_SDA_1) || !defined(GANG_SCL_1)
+    #error Gang programming needs the Wire library, GANG_TARGETS 2 and GANG_SDA_1/GANG_SCL_1 pins for Wire1
+  #endif
+
+  // every target has a flasher and bus of its own, the first shares Wire with the flasher above
+  GangPortOf<DefaultBus> gangPort0((DefaultBus(Wire)));
+  GangPortOf<DefaultBus> gangPort1((DefaultBus(Wire1)));
+  OnbrightFlasher<GangBus> gangFlasher0((GangBus(gangPort0)));
+  OnbrightFlasher<GangBus> gangFlasher1((GangBus(gangPort1)));
+  FlasherGang<GangBus> gang;
+#endif
+
+// gang command in progress, and whether the image has been asked for yet
+bool gangActive = false;
+bool gangImageStarted;
+unsigned long gangStartTime;
+
+// binary upload mode replaces the line parser until host sends an end frame
+FrameLink uplink(Serial);
+bool binaryMode = false;
+bool binaryComplete = false;
+unsigned long binaryBytes;
+unsigned long lastFrameTime;
+
+// decoded hex lines and binary frames waiting to be written
+RecordPipeline pipeline;
+
+// everything written successfully since the last erase
+ImageChecksum imageChecksum;
+
+#if FLASH_SHADOW
+  // kept up to date by the flasher, read and readhex use it when it holds the bytes
+  FlashShadow shadow;
+#endif
+
+#if WRITE_STAGING
+  // between the pipeline and the flasher, records are written a block at a time
+  WriteStaging staging;
+  unsigned long lastStagedTime;
+#endif
+
+// blocks programmed and verified for the image host named with "resume"
+SessionJournal journal;
 
 // applies if we use beginTransmission()/endTransmission() style
 // which we do anyway now in order to be compatible with Wire library
@@ -142,12 +299,11 @@ char swRxBuffer[64];
 // led blink task
 int togglePeriod = 1000;
 
-// FIXME: no magic numbers
-// stores content to write or content read from flash
-uint8_t fileArray[FILE_ARRAY_MAX];
+// content read from flash, a piece at a time
+uint8_t streamBuffer[STREAM_BUFFER_SIZE];
 
 //uint32_t size;
-uint8_t configBytes[CONFIG_BYTES_MAX];
+uint8_t configBytes[CONFIG_BYTE_SIZE];
 
 // the stock programmer allowed choosing initial value of either 0x00 or 0xFF
 // so this needs to be supported and accounted for as well - i.e., checksum will be different in either case
@@ -165,12 +321,74 @@ enum
 {
   idle,
   handshake,
+  acquire,
+  settle,
   connected
 };
 
+// when target acknowledged the handshake
+unsigned long handshakeTime;
+
+// tight handshake polling, see acquire_start()
+unsigned long acquirePollMicros = ACQUIRE_POLL_US;
+unsigned long acquireDurationMillis = ACQUIRE_DURATION_MS;
+unsigned long acquireTime;
+bool acquirePowered;
+
 // state machine for handshake
 //unsigned char state = idle;
 
+// flashhex runs every step of flashing on its own, host only streams the image
+enum
+{
+  autoIdle,
+  autoHandshake,
+  autoSignature,
+  autoErase,
+  autoFuse,
+  autoProgram,
+  autoVerify,
+  autoReset,
+  autoDone
+};
+
+// names used in the result line, same order as above
+const char* const autoPhaseNames[] = { "none", "handshake", "signature", "erase", "fuse", "program", "verify", "reset" };
+
+uint8_t autoPhase = autoIdle;
+unsigned long autoStartTime;
+unsigned long autoPhaseStart;
+unsigned long autoPhaseMillis[autoDone];
+unsigned char autoFuseAddress;
+unsigned char autoFuseValue;
+unsigned char autoChipType;
+uint16_t autoBadBlocks;
+
+// long operations run a slice per loop() pass, so serial input and the led are serviced in between
+// and a job can be aborted anywhere
+enum
+{
+  jobNone,
+  jobErase,
+  jobReadHex,
+  jobReadback
+};
+
+// names used when a job is aborted, same order as above
+const char* const jobNames[] = { "none", "erase", "readhex", "verify" };
+
+uint8_t job = jobNone;
+unsigned long jobStartTime;
+// flash address the next slice starts at
+uint16_t jobAddress;
+// blocks to read back and those found to differ
+uint16_t jobBlocks;
+uint16_t jobBadBlocks;
+// block being read back so far
+byte jobResult;
+uint32_t jobChecksum;
+uint16_t jobCrc;
+
 // count and display an index to user just so they know program is still running
 int heartbeatCount = 0;
 
@@ -209,22 +427,23 @@ void checkError(const byte error)
 
 // https://github.com/arendst/Tasmota/blob/master/tasmota/tasmota_xdrv_driver/xdrv_06_snfbridge.ino
 // requires a hex file so on PC side can do: packihx foo.ihx > foo.hex
-uint32_t rf_decode_and_write(uint8_t *record, size_t size)
+// called by ihx_scan() for each record, data is written straight from where it was decoded
+uint8_t rf_decode_and_write(void *context, const ihx_t *h, uint32_t address)
 {
-  uint8_t err = ihx_decode(record, size);
-  uint8_t index;
+  uint8_t err = 0;
+  uint8_t index = 0;
 
-  if (err != IHX_SUCCESS)
-  {
-    // Failed to decode mcu firmware
-    return 13;
-  }
+  (void) context;
 
-  ihx_t *h = (ihx_t *) record;
   if (h->record_type == IHX_RT_DATA)
   {
     int retries = 5;
-    uint16_t address = h->address_high * 0x100 + h->address_low;
+
+    // e.g., an extended linear address record pointing somewhere else than the 8051 code space
+    if (address + h->len > TARGET_FLASH_SIZE)
+    {
+      return 14;
+    }
 
     // keep running sum of bytes written
     while (index < h->len)
@@ -239,8 +458,13 @@ uint32_t rf_decode_and_write(uint8_t *record, size_t size)
       // err = c2_programming_init(C2_DEVID_EFM8BB1);
       // handshake needs to have happened prior to write attempts because it requires power cycle
       // in contrast, EFM8BB1 was able to reset by holding a clock(?) line for a long period of time
-      err = flasher.writeFlashBlock(address, h->data, h->len);
+      err = flasher.writeFlashBlock(address, (unsigned char *) h->data, h->len);
     } while (err > 0 && retries--);
+
+    if (err == 0)
+    {
+      imageChecksum.add(address, h->data, h->len);
+    }
   } else if (h->record_type == IHX_RT_END_OF_FILE) {
     // mcu firmware upgrade done, restarting RF chip
     flasher.resetMCU();
@@ -251,78 +475,376 @@ uint32_t rf_decode_and_write(uint8_t *record, size_t size)
     return 12;
   }
 
+  // keep the watchdog and anything else on the board happy between records
+  yield();
+
   return 0;
 }
 
+// Binary contains a set of commands, decode and program each one
+// records are decoded in place, so data is overwritten, and may be any length with either line ending
+// returns 0, 12 if writing failed, 13 if a record did not decode or 14 for data outside target flash
 uint32_t rf_search_and_write(uint8_t *data, size_t size) {
-  // Binary contains a set of commands, decode and program each one
-  uint8_t buf[64];
-  uint8_t* p_data = data;
-  uint32_t addr = 0;
-  uint32_t rec_end;
-  uint32_t rec_start;
-  uint32_t rec_size;
-  uint32_t err;
-  uint8_t index;
+  ihx_scan_t scan;
+  uint8_t err;
 
   // 8192 * 0xFF in other words checksum of an erased chip (0x1FE000)
   writeChecksum = 2088960;
 
-  while (addr < size) {
-    // Must load flash using memcpy on 4-byte boundary
-    memcpy(buf, p_data, sizeof(buf));
+  ihx_scan_begin(&scan);
 
-    // Find starts and ends of commands
-    for (rec_start = 0; rec_start < 8; rec_start++) {
-      if (':' == buf[rec_start]) { break; }
-    }
+  // whole image is in the buffer, so a last record without a line ending is complete too
+  err = ihx_scan(&scan, data, size, 1, rf_decode_and_write, NULL);
+
+  if (err == IHX_ERROR) {
+    // Failed to decode mcu firmware
+    return 13;
+  }
+
+  return err;
+}
+
+void printBurstMode(const unsigned char mode)
+{
+  switch (mode)
+  {
+    case burstSupported:
+      Serial.println(F("supported"));
+      break;
+    case burstUnsupported:
+      Serial.println(F("unsupported (byte by byte)"));
+      break;
+    default:
+      Serial.println(F("not yet detected"));
+      break;
+  }
+}
+
+// lets user confirm which read and write paths were used on their board
+void printBurstModes(void)
+{
+  Serial.print(F("Burst read: "));
+  printBurstMode(flasher.getBurstReadMode());
+  Serial.print(F("Burst write: "));
+  printBurstMode(flasher.getBurstWriteMode());
+}
+
+// shows how many write transactions erase awareness saved
+void printSkipped(void)
+{
+  Serial.print(F("Skipped "));
+  Serial.print(flasher.getSkippedBytes());
+  Serial.print(F(" erased bytes, "));
+  Serial.print(flasher.getUntouchedBlocks());
+  Serial.println(F(" blocks untouched"));
+}
+
+// one line host can parse, the mask says which blocks need to be written again
+void print_verify_result(const uint16_t badBlocks, const unsigned long startTime)
+{
+  journal.verified(jobBlocks, badBlocks);
+
+  // blocks that differ get written again, their bytes are summed afresh rather than counted twice
+  imageChecksum.forget(badBlocks);
+
+  if (badBlocks == 0)
+  {
+    Serial.print(F("Verify OK (readback) in "));
+  } else {
+    Serial.print(F("Verify FAILED blocks 0x"));
+    Serial.print(badBlocks, HEX);
+    Serial.print(F(" in "));
+  }
+  Serial.print(millis() - startTime);
+  Serial.println(F(" ms"));
+}
+
+void job_start(const uint8_t kind, const unsigned long startTime)
+{
+  job = kind;
+  jobStartTime = startTime;
+  jobAddress = 0;
+}
+
+// sends the erase command, the job then polls until target is done
+void job_erase(void)
+{
+  Serial.println("Erasing chip...");
+  clockRate.setPhase(ratePhaseErase);
+  flasher.beginErase();
+
+  job_start(jobErase, millis());
+}
+
+void job_erase_step(void)
+{
+  byte result;
+
+  if (!flasher.pollErase(result))
+  {
+    return;
+  }
+
+  job = jobNone;
+
+  checkError(result);
+
+  // a Wire timeout during the erase itself is fine, flasher polls until target acknowledges again
+  if (result != 0)
+  {
+    Serial.println("Chip erase FAILED");
+  } else {
+    Serial.println("Chip erase successful");
+    Serial.print(F("Erase busy: "));
+    Serial.print(flasher.getEraseBusyMicros());
+    Serial.println(F(" us"));
+  }
+
+  Serial.print(F("Blocks known erased: "));
+  Serial.println(flasher.getUntouchedBlocks());
+
+  // a new image starts here
+  imageChecksum.reset();
+  journal.erased();
+}
+
+// from the shadow if it holds every byte, otherwise from target (verify always reads target)
+byte read_flash(const unsigned int flashAddress, unsigned char* data, const unsigned int length)
+{
+#if FLASH_SHADOW
+  if (shadow.fetch(flashAddress, data, length))
+  {
+    return 0;
+  }
+#endif
+
+  return flasher.readFlashBlock(flashAddress, data, length);
+}
+
+void job_readhex(void)
+{
+  jobChecksum = 0;
+  job_start(jobReadHex, millis());
+}
+
+void job_readhex_step(void)
+{
+  unsigned long elapsed;
+
+  read_flash(jobAddress, streamBuffer, STREAM_BUFFER_SIZE);
+
+  for (uint8_t index = 0; index < STREAM_BUFFER_SIZE; index++)
+  {
+    jobChecksum += streamBuffer[index];
+  }
+
+  jobAddress += STREAM_BUFFER_SIZE;
+  if (jobAddress < TARGET_FLASH_SIZE)
+  {
+    return;
+  }
+
+  job = jobNone;
+  elapsed = millis() - jobStartTime;
+
+  Serial.print("Checksum: 0x");
+  Serial.println(jobChecksum, HEX);
+
+  // throughput so speedup can be compared between boards
+  Serial.print(F("Read "));
+  Serial.print(TARGET_FLASH_SIZE);
+  Serial.print(F(" bytes in "));
+  Serial.print(elapsed);
+  Serial.print(F(" ms ("));
+  Serial.print(elapsed > 0 ? (TARGET_FLASH_SIZE * 1000UL) / elapsed : 0UL);
+  Serial.println(F(" bytes/s)"));
+  printBurstModes();
+}
+
+// reads the given blocks back and compares each one with the crc host sent for it,
+// or with the sum of what was written when there is no crc
+// jobBadBlocks ends up with a mask of the blocks that differ
+void job_readback(const uint16_t blocks, const unsigned long startTime)
+{
+  jobBlocks = blocks;
+  jobBadBlocks = 0;
+  job_start(jobReadback, startTime);
+}
+
+void job_readback_block(const uint8_t index)
+{
+  Serial.print(F("Block "));
+  Serial.print(index);
+
+  if (imageChecksum.hasBlockCrc(index))
+  {
+    Serial.print(F(" expected crc 0x"));
+    Serial.print(imageChecksum.blockCrc(index), HEX);
+    Serial.print(F(" read 0x"));
+    Serial.print(jobCrc, HEX);
 
-    // Record invalid - RF Remnant data did not start with a start token
-    if (rec_start > 7) {
-      return 8;
+    if (jobCrc != imageChecksum.blockCrc(index))
+    {
+      jobResult = jobResult ? jobResult : 1;
     }
+  } else {
+    Serial.print(F(" expected sum 0x"));
+    Serial.print(imageChecksum.block(index, FLASH_ERASED_VALUE), HEX);
+    Serial.print(F(" read 0x"));
+    Serial.print(jobChecksum, HEX);
 
-    for (rec_end = rec_start; rec_end < sizeof(buf); rec_end++)
+    if (jobChecksum != imageChecksum.block(index, FLASH_ERASED_VALUE))
     {
-      // FIXME: should be made to support Windows style line endings (i.e., \r\n)
-      // otherwise record will be deemed too large
-      // or use dos2unix on PC side
-      if ('\n' == buf[rec_end]) {
-        break;
-      }
+      jobResult = jobResult ? jobResult : 1;
     }
+  }
+
+  if (jobResult > 0)
+  {
+    jobBadBlocks |= (1 << index);
+    Serial.println(F(" differs"));
+  } else {
+    Serial.println(F(" ok"));
+  }
+}
+
+void job_readback_step(void)
+{
+  const uint8_t index = jobAddress / BLOCK_SIZE;
+
+  if (jobAddress >= TARGET_FLASH_SIZE)
+  {
+    job = jobNone;
+    print_verify_result(jobBadBlocks, jobStartTime);
+    return;
+  }
+
+  if ((jobBlocks & (1 << index)) == 0)
+  {
+    jobAddress += BLOCK_SIZE;
+    return;
+  }
+
+  if ((jobAddress % BLOCK_SIZE) == 0)
+  {
+    jobResult = 0;
+    jobChecksum = 0;
+    jobCrc = CRC16_INIT;
+  }
 
-    // Record too large - Failed to decode RF firmware
-    if (rec_end == sizeof(buf)) {
-      return 9;
+  // rest of a block that failed to read still counts, it just is not read
+  if (jobResult == 0)
+  {
+    jobResult = flasher.readFlashBlock(jobAddress, streamBuffer, STREAM_BUFFER_SIZE);
+  }
+
+  jobCrc = crc16_block(jobCrc, streamBuffer, STREAM_BUFFER_SIZE);
+  for (uint8_t position = 0; position < STREAM_BUFFER_SIZE; position++)
+  {
+    jobChecksum += streamBuffer[position];
+  }
+
+  jobAddress += STREAM_BUFFER_SIZE;
+
+  if ((jobAddress % BLOCK_SIZE) == 0)
+  {
+    job_readback_block(index);
+  }
+}
+
+// compare the checksum the chip keeps against what we wrote since the last erase
+// only if they disagree is flash read back, block by block as a job, to find where
+// jobBadBlocks ends up with a mask of the blocks that differ
+void job_verify(void)
+{
+  byte result;
+  uint32_t chipChecksum;
+  unsigned long startTime = millis();
+
+  Serial.print(F("Image bytes: "));
+  Serial.print(imageChecksum.length());
+  Serial.print(F(" checksum: 0x"));
+  Serial.print(imageChecksum.total(FLASH_ERASED_VALUE), HEX);
+  Serial.print(F(" (0x00 fill: 0x"));
+  Serial.print(imageChecksum.total(0x00), HEX);
+  Serial.println(")");
+
+  clockRate.setPhase(ratePhaseRead);
+  result = flasher.readFlashChecksum(chipChecksum);
+  checkError(result);
+
+  if (result == 0)
+  {
+    Serial.print(F("Chip checksum: 0x"));
+    Serial.println(chipChecksum, HEX);
+
+    if ((chipChecksum == imageChecksum.total(FLASH_ERASED_VALUE)) || (chipChecksum == imageChecksum.total(0x00)))
+    {
+      Serial.print(F("Verify OK in "));
+      Serial.print(millis() - startTime);
+      Serial.println(F(" ms"));
+
+      // upload is over, the blocks written in this session are what the image says
+      journal.finished();
+      journal.verified(journal.getProgrammed(), 0);
+
+      jobBadBlocks = 0;
+      return;
     }
+  }
+
+  Serial.println(F("Checksum mismatch, reading back blocks..."));
 
-    rec_size = rec_end - rec_start;
+  job_readback(0xFFFF, startTime);
+}
+
+// does at most JOB_SLICE_MICROS of the running job, though always at least one step
+void state_machine_job(void)
+{
+  const unsigned long sliceStart = micros();
 
-//    AddLog(LOG_LEVEL_DEBUG, PSTR("DBG: %*_H"), rec_size, (uint8_t*)&buf + rec_start);
-//    Serial.print("Parsing record with address: ");
-//    Serial.println(addr);
+  if (job == jobNone)
+  {
+    return;
+  }
 
-//#if defined(ESP8266)
-    // FIXME: no idea what happens to wifi while we are busy here
-    // this seems like a nonideal hack
-    // clear watchdog to avoid reset if using an ESP8265/8266
-    //ESP.wdtFeed();
-    yield();
-//#endif
+  // anything else run between slices may have moved the clock to its own phase
+  clockRate.setPhase((job == jobErase) ? ratePhaseErase : ratePhaseRead);
 
-    err = rf_decode_and_write(buf + rec_start, rec_size);
-    if (err != 0) {
-      return err;
+  do
+  {
+    switch (job)
+    {
+      case jobErase:
+        job_erase_step();
+        break;
+      case jobReadHex:
+        job_readhex_step();
+        break;
+      case jobReadback:
+        job_readback_step();
+        break;
     }
+  } while ((job != jobNone) && (micros() - sliceStart < JOB_SLICE_MICROS));
+}
 
-    addr += rec_size +1;
-    p_data += (rec_end & 0xFFFC);  // Stay on 4-byte boundary
-    delay(0);
+// flasher calls this for every byte of a block that failed to write
+void reportWriteError(const unsigned int flashAddress, const unsigned char flashByte, const byte result)
+{
+  // text would corrupt the reply stream, host learns about it from the NAK instead
+  if (binaryMode)
+  {
+    return;
   }
 
-  // Buffer was perfectly aligned, start and end found without any remaining trailing characters
-  return 0;
+  checkError(result);
+
+#ifdef VERBOSE_DEBUG
+  Serial.print("Write failed at addr 0x");
+  Serial.print(flashAddress, HEX);
+  Serial.print(" for 0x");
+  Serial.println(flashByte, HEX);
+#endif
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -346,68 +868,506 @@ void toggleLED_nb(void)
     }
 }
 
-uint8_t state_machine_command(int clicmd, uint8_t state)
+// bytes between heap and stack (AVR) or free heap (ESP), -1 where we cannot tell
+long free_ram(void)
 {
-  // for ack, nack, etc. results
-  byte result;
+#if defined(ESP8266) || defined(ESP32)
+  return ESP.getFreeHeap();
+#elif defined(__AVR__)
+  extern int __heap_start;
+  extern int *__brkval;
+  int top;
+
+  return (int) &top - (__brkval == 0 ? (int) &__heap_start : (int) __brkval);
+#else
+  return -1;
+#endif
+}
 
-  // FIXME: add comment
-  uint8_t results[64];
+// one line so RAM use can be compared between boards and builds
+void print_ram(void)
+{
+  Serial.print(F("RAM: free="));
+  Serial.print(free_ram());
+  Serial.print(F(" parser="));
+  Serial.print(sizeof(ttycli));
+  Serial.print(F(" pipeline="));
+  Serial.print(sizeof(pipeline));
+  Serial.print(F(" uplink="));
+  Serial.print(sizeof(uplink));
+  Serial.print(F(" checksum="));
+  Serial.print(sizeof(imageChecksum));
+  Serial.print(F(" flasher="));
+  Serial.print(sizeof(flasher));
+#if FLASH_SHADOW
+  Serial.print(F(" shadow="));
+  Serial.print(sizeof(shadow));
+#endif
+#if WRITE_STAGING
+  Serial.print(F(" staging="));
+  Serial.print(sizeof(staging));
+#endif
+  Serial.print(F(" buffers="));
+  Serial.println(sizeof(streamBuffer) + sizeof(configBytes) + sizeof(swTxBuffer) + sizeof(swRxBuffer));
+}
 
-  int16_t addr;
-  // should be 0xA for Onbright
-  uint8_t chipType;
+// clock each phase runs at, e.g. "Clock: handshake=400000 erase=400000 program=200000 read=400000 unit=3"
+void print_clocks(void)
+{
+  Serial.print(F("Clock:"));
+  for (uint8_t phase = ratePhaseHandshake; phase < ratePhaseCount; phase++)
+  {
+    Serial.print(F(" "));
+    Serial.print(ClockRateController::phaseName(phase));
+    Serial.print(F("="));
+    Serial.print(clockRate.phaseClock(phase));
+  }
 
-  switch (clicmd)
+  Serial.print(F(" unit="));
+  Serial.print(clockRate.getUnit());
+  Serial.println(clockRate.getFixedClock() ? F(" fixed") : F(" adaptive"));
+}
+
+// clock changes made since the last call, held back while binary frames are flowing
+void print_clock_decisions(void)
+{
+  rateDecision_t decision;
+
+  while (clockRate.takeDecision(decision))
   {
-    case CMD_IDLE:
-      // FIXME: a messy code organization here
-      // impacts state machine below
-      Serial.println("State changing to idle");
-      state = idle;
-      break;
-    case CMD_HANDSHAKE:
-      Serial.println("State changing to handshake");
-      Serial.println("cycle power to target (start with power off and then turn on)");
-      state = handshake;
-      break;
-    case CMD_VERSION:
-      Serial.print("Date: ");
-      Serial.print(__DATE__);
-      Serial.print(" Time: ");
-      Serial.println(__TIME__);
-      break;
-    case CMD_SIGNATURE:
-      Serial.println("Read chip type...");
-      result = flasher.readChipType(chipType);
-      checkError(result);
+    Serial.print(F("Clock unit "));
+    Serial.print(decision.unit);
+    Serial.print(F(" "));
+    Serial.print(ClockRateController::phaseName(decision.phase));
+    Serial.print(F(": "));
+    Serial.print(decision.fromHz);
+    Serial.print(F(" -> "));
+    Serial.print(decision.toHz);
+    Serial.print(F(" Hz after "));
+    Serial.print(decision.errors);
+    Serial.print(F(" errors in "));
+    Serial.print(decision.transfers);
+    Serial.println(F(" transfers"));
+  }
+}
 
-      if (result > 0)
-      {
-        Serial.println("Chip read type FAILED");
-        Serial.print("Chip type reported was: 0x");
-        Serial.println(chipType, HEX);
-      } else {
-        Serial.print("Chip read: 0x");
-        Serial.println(chipType, HEX);
-      }
-      break;
-    case CMD_ERASE:
-      Serial.println("Erasing chip...");
-      result = flasher.eraseChip();
-      checkError(result);
+// frames replace the line parser until host sends an end frame
+void start_binary(void)
+{
+  // tells host how many frames it may have in flight and how large they may be
+  Serial.print(F("Binary mode window "));
+  Serial.print(FRAME_WINDOW);
+  Serial.print(F(" max "));
+  Serial.println(FRAME_PAYLOAD_MAX);
+
+  uplink.begin();
+  binaryBytes = 0;
+  binaryComplete = false;
+  lastFrameTime = millis();
+  binaryMode = true;
+}
 
-      // FIXME: this is a hack for now, because sometimes Wire timeouts
-      // even though erase worked (confirmed by reading flash byte at 0 as 255 (i.e., 0xFF))
-      if ((result != 0) && (result != 5))
-      {
-        Serial.println("Chip erase FAILED");
+// starts a tight handshake, with a power control pin target is switched off first
+void acquire_start(void)
+{
+  acquireTime = millis();
+
+  // likely another unit, nothing of the previous session applies to it
+  journal.reset();
+
+#if defined(OUTPUT_TO_CONTROL_RESET_AVAILABLE)
+  digitalWrite(outputToControlReset, !TARGET_POWER_ON_LEVEL);
+  acquirePowered = false;
+#else
+  Serial.println("cycle power to target (start with power off and then turn on)");
+  flasher.beginAcquire();
+  acquirePowered = true;
+#endif
+}
+
+// one slice of polling, true once target went through the handshake
+bool acquire_poll(void)
+{
+#if defined(OUTPUT_TO_CONTROL_RESET_AVAILABLE)
+  if (!acquirePowered)
+  {
+    if (millis() - acquireTime < TARGET_POWER_OFF_MS)
+    {
+      return false;
+    }
+
+    // time since power up is measured from here
+    digitalWrite(outputToControlReset, TARGET_POWER_ON_LEVEL);
+    flasher.beginAcquire();
+    acquirePowered = true;
+  }
+#endif
+
+  clockRate.setPhase(ratePhaseHandshake);
+
+  return flasher.acquireHandshake(acquirePollMicros, ACQUIRE_SLICE_MICROS);
+}
+
+// e.g. "Acquire: polls=212 first_ack_us=23040 power_edge_us=21010"
+// times count from the start of polling (or from switching power on), power edge is 0 if it was not seen
+void print_acquire(void)
+{
+  Serial.print(F("Acquire: polls="));
+  Serial.print(flasher.getAcquirePolls());
+  Serial.print(F(" first_ack_us="));
+  Serial.print(flasher.getFirstAckMicros());
+  Serial.print(F(" power_edge_us="));
+  Serial.println(flasher.getPowerEdgeMicros());
+
+  if ((flasher.getFirstAckMicros() > 0) && (flasher.getPowerEdgeMicros() > 0))
+  {
+    Serial.print(F("First ack "));
+    Serial.print(flasher.getFirstAckMicros() - flasher.getPowerEdgeMicros());
+    Serial.println(F(" us after power up"));
+  }
+}
+
+void autoflash_next(const uint8_t phase)
+{
+  autoPhaseMillis[autoPhase] = millis() - autoPhaseStart;
+
+  autoPhase = phase;
+  autoPhaseStart = millis();
+}
+
+// how long target was busy, measured by polling it until it acknowledged again
+// e.g. "Busy: erase_us=21480 write_us=36 polls=12"
+void print_busy(void)
+{
+  Serial.print(F("Busy: erase_us="));
+  Serial.print(flasher.getEraseBusyMicros());
+  Serial.print(F(" write_us="));
+  Serial.print(flasher.getWriteBusyMicros());
+  Serial.print(F(" polls="));
+  Serial.println(flasher.getBusyPolls());
+}
+
+// single line so host needs to match nothing else, e.g.
+// RESULT status=OK failed=none error=0 chip_type=0xA bytes=6016 bad_blocks=0x0 handshake_ms=812 ... write_busy_us=40 total_ms=2950
+void autoflash_finish(const char* status, const byte error)
+{
+  const uint8_t failed = (error == 0) ? autoIdle : autoPhase;
+
+  if (autoPhase < autoDone)
+  {
+    autoPhaseMillis[autoPhase] = millis() - autoPhaseStart;
+  }
+
+  Serial.print(F("RESULT status="));
+  Serial.print(status);
+  Serial.print(F(" failed="));
+  Serial.print(autoPhaseNames[failed]);
+  Serial.print(F(" error="));
+  Serial.print(error);
+  Serial.print(F(" chip_type=0x"));
+  Serial.print(autoChipType, HEX);
+  Serial.print(F(" bytes="));
+  Serial.print(binaryBytes);
+  Serial.print(F(" bad_blocks=0x"));
+  Serial.print(autoBadBlocks, HEX);
+
+  for (uint8_t phase = autoHandshake; phase < autoDone; phase++)
+  {
+    Serial.print(F(" "));
+    Serial.print(autoPhaseNames[phase]);
+    Serial.print(F("_ms="));
+    Serial.print(autoPhaseMillis[phase]);
+  }
+
+  // clocks this unit ended up with
+  for (uint8_t phase = ratePhaseHandshake; phase < ratePhaseCount; phase++)
+  {
+    Serial.print(F(" "));
+    Serial.print(ClockRateController::phaseName(phase));
+    Serial.print(F("_hz="));
+    Serial.print(clockRate.phaseClock(phase));
+  }
+
+  Serial.print(F(" erase_busy_us="));
+  Serial.print(flasher.getEraseBusyMicros());
+  Serial.print(F(" write_busy_us="));
+  Serial.print(flasher.getWriteBusyMicros());
+
+  Serial.print(F(" acquire_polls="));
+  Serial.print(flasher.getAcquirePolls());
+  Serial.print(F(" first_ack_us="));
+  Serial.print(flasher.getFirstAckMicros());
+  Serial.print(F(" power_edge_us="));
+  Serial.print(flasher.getPowerEdgeMicros());
+
+  Serial.print(F(" total_ms="));
+  Serial.println(millis() - autoStartTime);
+
+  autoPhase = autoIdle;
+}
+
+// advances flashhex by at most one step per call so serial and binary frames keep being serviced
+void state_machine_autoflash(void)
+{
+  byte result;
+  unsigned char fuse = 0;
+
+  switch (autoPhase)
+  {
+    case autoIdle:
+      break;
+    case autoHandshake:
+      if (acquire_poll())
+      {
+        clockRate.newUnit();
+        autoflash_next(autoSignature);
+      } else if (millis() - autoPhaseStart > AUTOFLASH_HANDSHAKE_TIMEOUT_MS) {
+        autoflash_finish("FAILED", 5);
+      }
+      break;
+    case autoSignature:
+      if (millis() - autoPhaseStart < HANDSHAKE_SETTLE_MS)
+      {
+        break;
+      }
+
+      // a protected chip nacks the read but still reports its type
+      clockRate.setPhase(ratePhaseNone);
+      result = flasher.readChipType(autoChipType);
+
+      if (autoChipType != CHIP_TYPE_OB38S003)
+      {
+        autoflash_finish("FAILED", result ? result : 4);
+      } else {
+        autoflash_next(autoErase);
+        clockRate.setPhase(ratePhaseErase);
+        flasher.beginErase();
+      }
+      break;
+    case autoErase:
+      // one poll per pass until target is done
+      if (!flasher.pollErase(result))
+      {
+        break;
+      }
+
+      if (result != 0)
+      {
+        autoflash_finish("FAILED", result);
+      } else {
+        imageChecksum.reset();
+        journal.erased();
+        autoflash_next(autoFuse);
+      }
+      break;
+    case autoFuse:
+      clockRate.setPhase(ratePhaseProgram);
+      result = flasher.writeConfigByte(autoFuseAddress, autoFuseValue);
+      if (result == 0)
+      {
+        result = flasher.readConfigByte(autoFuseAddress, fuse);
+      }
+
+      if ((result != 0) || (fuse != autoFuseValue))
+      {
+        autoflash_finish("FAILED", result ? result : 4);
+      } else {
+        autoflash_next(autoProgram);
+        start_binary();
+      }
+      break;
+    case autoProgram:
+      // only reached once binary mode has ended, either by an end frame or by timing out
+      if (binaryComplete)
+      {
+        autoflash_next(autoVerify);
+        job_verify();
+      } else {
+        autoflash_finish("FAILED", 5);
+      }
+      break;
+    case autoVerify:
+      // readback, if the checksum did not match, runs as a job
+      if (job != jobNone)
+      {
+        break;
+      }
+
+      autoBadBlocks = jobBadBlocks;
+
+      if (autoBadBlocks != 0)
+      {
+        autoflash_finish("FAILED", 4);
+      } else {
+        autoflash_next(autoReset);
+      }
+      break;
+    case autoReset:
+      // target never acknowledges a reset
+      clockRate.setPhase(ratePhaseNone);
+      flasher.resetMCU();
+      journal.reset();
+      autoflash_next(autoDone);
+      autoflash_finish("OK", 0);
+      break;
+  }
+}
+
+// one GANG line per target, then a RESULT line host reads the same way as the one from flashhex
+// e.g. RESULT status=FAILED failed=1 error=4 passed=1 targets=2 bytes=6016 total_ms=3120
+void gang_finish(const char* status)
+{
+#if defined(GANG_TARGETS)
+  byte error = 0;
+  bool anyFailed = false;
+
+  gang.print(Serial);
+
+  Serial.print(F("RESULT status="));
+  Serial.print((status != NULL) ? status : ((gang.passed() == gang.size()) ? "OK" : "FAILED"));
+  Serial.print(F(" failed="));
+
+  for (uint8_t index = 0; index < gang.size(); index++)
+  {
+    if (gang.target(index).phase != gangDone)
+    {
+      if (anyFailed)
+      {
+        Serial.print(F(","));
+      } else {
+        error = gang.target(index).error;
+      }
+
+      Serial.print(index);
+      anyFailed = true;
+    }
+  }
+
+  if (!anyFailed)
+  {
+    Serial.print(F("none"));
+  }
+
+  Serial.print(F(" error="));
+  Serial.print(error);
+  Serial.print(F(" passed="));
+  Serial.print(gang.passed());
+  Serial.print(F(" targets="));
+  Serial.print(gang.size());
+  Serial.print(F(" bytes="));
+  Serial.print(binaryBytes);
+  Serial.print(F(" total_ms="));
+  Serial.println(millis() - gangStartTime);
+#endif
+
+  gangActive = false;
+}
+
+// gang, a slice of round robin steps per pass until every target waits for the image, then again to verify
+void state_machine_gang(void)
+{
+#if defined(GANG_TARGETS)
+  const unsigned long startTime = micros();
+
+  if (!gangActive || binaryMode)
+  {
+    return;
+  }
+
+  // only reached once binary mode has ended, either by an end frame or by timing out
+  if (gangImageStarted && gang.ready() && (gang.working() > 0))
+  {
+    if (binaryComplete)
+    {
+      gang.finish(imageChecksum);
+    } else {
+      gang.fail(5);
+    }
+  }
+
+  while (gang.step() && (micros() - startTime < JOB_SLICE_MICROS))
+  {
+  }
+
+  if (gang.done())
+  {
+    gang_finish(NULL);
+  } else if (!gangImageStarted && gang.ready()) {
+    gangImageStarted = true;
+    start_binary();
+  }
+#endif
+}
+
+uint8_t state_machine_command(int clicmd, uint8_t state)
+{
+  // for ack, nack, etc. results
+  byte result;
+
+  // byte read or written by read, write, readconfig and setfuse
+  uint8_t results[1];
+
+  int16_t addr;
+  // should be 0xA for Onbright
+  uint8_t chipType;
+
+  switch (clicmd)
+  {
+    case CMD_IDLE:
+      // FIXME: a messy code organization here
+      // impacts state machine below
+      Serial.println("State changing to idle");
+      state = idle;
+
+      if (autoPhase != autoIdle)
+      {
+        autoflash_finish("ABORTED", 0);
+      }
+
+      if (gangActive)
+      {
+#if defined(GANG_TARGETS)
+        gang.fail(0);
+#endif
+        gang_finish("ABORTED");
+      }
+      break;
+    case CMD_HANDSHAKE:
+      // target may be another unit after the power cycle
+      journal.reset();
+
+      Serial.println("State changing to handshake");
+      Serial.println("cycle power to target (start with power off and then turn on)");
+      state = handshake;
+      break;
+    case CMD_VERSION:
+      Serial.print("Date: ");
+      Serial.print(__DATE__);
+      Serial.print(" Time: ");
+      Serial.println(__TIME__);
+      break;
+    case CMD_SIGNATURE:
+      Serial.println("Read chip type...");
+      clockRate.setPhase(ratePhaseNone);
+      result = flasher.readChipType(chipType);
+      checkError(result);
+
+      if (result > 0)
+      {
+        Serial.println("Chip read type FAILED");
+        Serial.print("Chip type reported was: 0x");
+        Serial.println(chipType, HEX);
       } else {
-        Serial.println("Chip erase successful");
+        Serial.print("Chip read: 0x");
+        Serial.println(chipType, HEX);
       }
       break;
+    case CMD_ERASE:
+      job_erase();
+      break;
     case CMD_GET_FUSE:
       Serial.println("Get configuration byte...");
+      clockRate.setPhase(ratePhaseRead);
       addr = ttycli.number();
       result = flasher.readConfigByte(addr, results[0]);
       checkError(result);
@@ -424,8 +1384,9 @@ uint8_t state_machine_command(int clicmd, uint8_t state)
       break;
     case CMD_READ_FLASH:
       Serial.println("Reading flash...");
+      clockRate.setPhase(ratePhaseRead);
       addr = ttycli.number();
-      result = flasher.readFlashByte(addr, results[0]);
+      result = read_flash(addr, results, 1);
       checkError(result);
 
       if (result > 0)
@@ -440,6 +1401,7 @@ uint8_t state_machine_command(int clicmd, uint8_t state)
       break;
     case CMD_WRITE_FLASH:
       Serial.println("Writing flash...");
+      clockRate.setPhase(ratePhaseProgram);
       addr = ttycli.number();
       results[0] = ttycli.number();
       result = flasher.writeFlashByte(addr, results[0]);
@@ -454,6 +1416,7 @@ uint8_t state_machine_command(int clicmd, uint8_t state)
       break;
     case CMD_SET_FUSE:
       Serial.println("Set configuration byte...");
+      clockRate.setPhase(ratePhaseProgram);
       addr = ttycli.number();
       results[0] = ttycli.number();
       result = flasher.writeConfigByte(addr, results[0]);
@@ -470,28 +1433,319 @@ uint8_t state_machine_command(int clicmd, uint8_t state)
       break;
     case CMD_MCU_RESET:
       Serial.println("MCU reset...");
+      clockRate.setPhase(ratePhaseNone);
       flasher.resetMCU();
+
+      // target is released, session is over
+      journal.reset();
       break;
     case CMD_FLASH_HEX:
-      Serial.println("Flash hex file - unused");
+      // flashhex [fuse address] [fuse value], then host streams the image as binary frames
+      if ((autoPhase != autoIdle) || gangActive)
+      {
+        Serial.println(F("Autoflash already running, [idle] aborts it"));
+        break;
+      }
+
+      addr = ttycli.number();
+      autoFuseAddress = (addr < 0) ? AUTOFLASH_FUSE_ADDRESS : addr;
+      addr = ttycli.number();
+      autoFuseValue = (addr < 0) ? AUTOFLASH_FUSE_VALUE : addr;
+
+      Serial.println(F("Autoflash started"));
+      acquire_start();
+
+      memset(autoPhaseMillis, 0, sizeof(autoPhaseMillis));
+      autoChipType = 0;
+      autoBadBlocks = 0;
+      binaryBytes = 0;
+      autoStartTime = millis();
+      autoPhaseStart = autoStartTime;
+      autoPhase = autoHandshake;
       break;
     case CMD_READ_HEX:
+      clockRate.setPhase(ratePhaseRead);
+      job_readhex();
+      break;
+    case CMD_BURST:
+      // burst 0 forces byte by byte reads and writes, burst 1 (default) uses bursts once detected
+      addr = ttycli.number();
+      flasher.setBurstRead(addr != 0);
+      flasher.setBurstWrite(addr != 0);
+      Serial.print(F("Burst transfers "));
+      Serial.println(addr != 0 ? F("enabled") : F("disabled"));
+      printBurstModes();
+      break;
+    case CMD_BINARY:
+      start_binary();
+      break;
+    case CMD_PIPELINE:
+    {
+      // one parsable line, counters restart afterwards
+      Serial.print(F("Pipeline: records="));
+      Serial.print(pipeline.stats.records);
+      Serial.print(F(" input_busy="));
+      Serial.print(pipeline.stats.inputBusy);
+      Serial.print(F(" input_blocked="));
+      Serial.print(pipeline.stats.inputBlocked);
+      Serial.print(F(" program_busy="));
+      Serial.print(pipeline.stats.programBusy);
+      Serial.print(F(" program_starved="));
+      Serial.print(pipeline.stats.programStarved);
+      Serial.print(F(" occupancy="));
+      for (uint8_t index = 0; index <= PIPELINE_SLOTS; index++)
+      {
+        if (index > 0)
+        {
+          Serial.print(F(","));
+        }
+        Serial.print(pipeline.stats.occupancy[index]);
+      }
+      Serial.println();
+
+      pipeline.resetStats();
+
+#if WRITE_STAGING
+      staging.print(Serial);
+      staging.resetStats();
+#endif
+    }
+      break;
+    case CMD_SKIP_ERASED:
+      // skipff 0 writes every byte, skipff 1 (default) leaves out 0xFF bytes in blocks known to be erased
+      addr = ttycli.number();
+      flasher.setSkipErased(addr != 0);
+      Serial.print(F("Skip erased bytes "));
+      Serial.println(addr != 0 ? F("enabled") : F("disabled"));
+      printSkipped();
+      break;
+    case CMD_VERIFY:
+      Serial.println(F("Verifying..."));
+      job_verify();
+      break;
+    case CMD_BLOCK_CRC:
+    {
+      // blockcrc <block> <crc> gives the crc16 a block should read back with (0xFF fill)
+      // blockcrc alone forgets all of them
+      addr = ttycli.number();
+      uint16_t crc = ttycli.number();
+
+      if ((addr < 0) || (addr >= FLASH_BLOCKS))
+      {
+        imageChecksum.clearBlockCrcs();
+        Serial.println(F("Block crcs cleared"));
+      } else {
+        imageChecksum.setBlockCrc(addr, crc);
+        Serial.print(F("Block crc "));
+        Serial.print(addr);
+        Serial.print(F(": 0x"));
+        Serial.println(crc, HEX);
+      }
+    }
+      break;
+    case CMD_BLOCK_VERIFY:
     {
-      flasher.readFlashBlock(0, fileArray, TARGET_FLASH_SIZE);
+      // blockverify <mask> reads back only those blocks, blockverify alone every block that has a crc
+      unsigned long startTime = millis();
+      long blocks = ttycli.number();
 
-      uint32_t checksum = 0;
-      for (uint16_t index = 0; index < TARGET_FLASH_SIZE; index++)
+      Serial.println(F("Verifying blocks..."));
+      if (blocks < 0)
       {
-        checksum += fileArray[index];
+        blocks = imageChecksum.blockCrcMask();
       }
 
-      Serial.print("Checksum: 0x");
-      Serial.println(checksum, HEX);
+      job_readback(blocks, startTime);
+    }
+      break;
+    case CMD_RAM:
+      print_ram();
+      break;
+    case CMD_RATE:
+    {
+      // rate alone shows the clocks, rate <hz> holds every phase at that clock, rate 0 adapts again
+      long hz = ttycli.number();
+
+      if (hz == 0)
+      {
+        clockRate.setFixedClock(0);
+        clockRate.reset();
+      } else if (hz > 0) {
+        clockRate.setFixedClock(hz);
+      }
+
+      print_clocks();
     }
       break;
+    case CMD_BUSY:
+      print_busy();
+      break;
+    case CMD_SHADOW:
+      // shadow alone shows which blocks it holds, shadow 0 forgets them (e.g., target was changed by other means)
+#if FLASH_SHADOW
+      if (ttycli.number() == 0)
+      {
+        shadow.flashInvalidated();
+        Serial.println(F("Shadow invalidated"));
+      }
+
+      shadow.print(Serial);
+#else
+      Serial.println(F("Shadow is not built in, see FLASH_SHADOW"));
+#endif
+      break;
+    case CMD_RESUME:
+      // resume <image id> carries on with the journal if it is for that image, otherwise starts one for it
+      // resume alone shows the journal, host sends the blocks neither programmed nor verified
+      if (!ttycli.eol())
+      {
+        if (journal.begin(ttycli.unsignedNumber()))
+        {
+          // blocks host sends again are summed afresh for verify
+          imageChecksum.forget(~(journal.getProgrammed() | journal.getVerified()));
+          Serial.println(F("Session resumed"));
+        } else {
+          Serial.println(F("Session started"));
+        }
+      }
+
+      journal.print(Serial);
+      break;
+    case CMD_STATS:
+      // counting starts over, so each dump covers what happened since the previous one
+      flasher.getStats().print(Serial);
+      flasher.getStats().reset();
+      break;
+    case CMD_TRACE:
+    {
+      // trace 1 starts recording from scratch, trace 0 stops, trace alone dumps and empties the buffer
+      long enable = ttycli.number();
+
+      if (enable >= 0)
+      {
+        trace.enable(enable != 0);
+        Serial.println(trace.isEnabled() ? F("Trace on") : F("Trace off"));
+      } else {
+        trace.print(Serial);
+      }
+    }
+      break;
+    case CMD_ACQUIRE:
+    {
+      // acquire [poll interval us] [duration ms], both are kept for next time (interval for flashhex too)
+      long pollMicros = ttycli.number();
+      long durationMillis = ttycli.number();
+
+      if (pollMicros >= 0)
+      {
+        acquirePollMicros = pollMicros;
+      }
+      if (durationMillis > 0)
+      {
+        acquireDurationMillis = durationMillis;
+      }
+
+      Serial.print(F("Acquiring handshake, polling every "));
+      Serial.print(acquirePollMicros);
+      Serial.print(F(" us for "));
+      Serial.print(acquireDurationMillis);
+      Serial.println(F(" ms"));
+
+      acquire_start();
+      state = acquire;
+    }
+      break;
+    case CMD_GANG:
+      // gang [fuse address] [fuse value], flashhex for every target at once
+#if defined(GANG_TARGETS)
+      if (gangActive || (autoPhase != autoIdle))
+      {
+        Serial.println(F("Autoflash already running, [idle] aborts it"));
+        break;
+      }
+
+      addr = ttycli.number();
+      autoFuseAddress = (addr < 0) ? AUTOFLASH_FUSE_ADDRESS : addr;
+      addr = ttycli.number();
+      autoFuseValue = (addr < 0) ? AUTOFLASH_FUSE_VALUE : addr;
+
+      Serial.println(F("Gang started"));
+      Serial.print(F("Targets: "));
+      Serial.println(gang.size());
+      Serial.println(F("cycle power to targets (start with power off and then turn on)"));
+
+      // gang buses run at their own clock, the adaptive control only watches the flasher above
+      imageChecksum.reset();
+      journal.reset();
+#if FLASH_SHADOW
+      // first target shares the bus, but not the flasher
+      shadow.flashInvalidated();
+#endif
+      binaryBytes = 0;
+      gangStartTime = millis();
+      gangImageStarted = false;
+      gangActive = true;
+      gang.start(autoFuseAddress, autoFuseValue, acquirePollMicros);
+#else
+      Serial.println(F("Gang programming is not built in, see GANG_TARGETS"));
+#endif
+      break;
+    case CMD_ABORT:
+      // stops a job, flashhex or a handshake in progress and drops hex lines not written yet
+      if (job != jobNone)
+      {
+        Serial.print(F("Aborted "));
+        Serial.print(jobNames[job]);
+        Serial.print(F(" at 0x"));
+        Serial.println(jobAddress, HEX);
+
+        job = jobNone;
+      }
+
+      // target finishes the erase on its own, we just stop waiting for it
+      flasher.abortErase();
+
+      if (!pipeline.empty())
+      {
+        Serial.print(F("Dropped "));
+        Serial.print(pipeline.count());
+        Serial.println(F(" hex lines"));
+
+        pipeline.reset();
+      }
+
+      // hex lines after the abort start from address 0 again
+      ttycli.ihexReset();
+
+#if WRITE_STAGING
+      if (!staging.empty())
+      {
+        Serial.println(F("Dropped staged bytes"));
+      }
+
+      staging.drop();
+#endif
+
+      if (autoPhase != autoIdle)
+      {
+        autoflash_finish("ABORTED", 0);
+      }
+
+      if (gangActive)
+      {
+#if defined(GANG_TARGETS)
+        gang.fail(0);
+#endif
+        gang_finish("ABORTED");
+      }
+
+      Serial.println("State changing to idle");
+      state = idle;
+      break;
     case CMD_READ_CONFIGS:
     {
       // beyond 64 bytes wraps around to zero address as best I can tell
+      clockRate.setPhase(ratePhaseRead);
       flasher.readConfigBlock(0, configBytes, CONFIG_BYTE_SIZE);
 
       uint16_t checksum = 0;
@@ -534,6 +1788,7 @@ uint8_t state_machine_flasher(uint8_t state)
     case idle:
       break;
     case handshake:
+      clockRate.setPhase(ratePhaseHandshake);
       gotAck = flasher.onbrightHandshake();
 
       // cannot really depend on nack/ack to indicate success in this instance
@@ -552,28 +1807,54 @@ uint8_t state_machine_flasher(uint8_t state)
         heartbeatCount += 1;
       } else {
         Serial.println("Handshake succeeded");
+        clockRate.newUnit();
 
-        // there seems to be about a 120ms delay in official programmer traces
-        delay(120);
+        handshakeTime = millis();
+        state = settle;
+      }
+      break;
+    case acquire:
+      if (acquire_poll())
+      {
+        Serial.println("Handshake succeeded");
+        print_acquire();
+        clockRate.newUnit();
 
-        // we apparently read chip type after handshake
-        result = flasher.readChipType(chipType);
-        checkError(result);
+        handshakeTime = millis();
+        state = settle;
+      } else if (millis() - acquireTime > acquireDurationMillis) {
+        Serial.println(F("Acquire FAILED, target did not answer"));
+        print_acquire();
+        Serial.println(F("Can try command [acquire] again, check wiring and power"));
 
-        if (result > 0)
-        {
-          Serial.println("Chip read type FAILED");
-          Serial.print("Chip type reported was: 0x");
-          Serial.println(chipType, HEX);
-          Serial.println("Can try command [signature] or [idle] then [handshake] to retry");
+        state = idle;
+      }
+      break;
+    case settle:
+      // wait without holding up the loop
+      if (millis() - handshakeTime < HANDSHAKE_SETTLE_MS)
+      {
+        break;
+      }
 
-          state = idle;
-        } else {
-          Serial.print("Chip read: 0x");
-          Serial.println(chipType, HEX);
+      // we apparently read chip type after handshake
+      clockRate.setPhase(ratePhaseNone);
+      result = flasher.readChipType(chipType);
+      checkError(result);
 
-          state = connected;
-        }
+      if (result > 0)
+      {
+        Serial.println("Chip read type FAILED");
+        Serial.print("Chip type reported was: 0x");
+        Serial.println(chipType, HEX);
+        Serial.println("Can try command [signature] or [idle] then [handshake] to retry");
+
+        state = idle;
+      } else {
+        Serial.print("Chip read: 0x");
+        Serial.println(chipType, HEX);
+
+        state = connected;
       }
       break;
     case connected:
@@ -586,6 +1867,287 @@ uint8_t state_machine_flasher(uint8_t state)
   return state;
 }
 
+// a record has been completely written, tell the user or host how it went
+void finish_record(frame_t &record)
+{
+  unsigned int writeCount;
+
+  if (!binaryMode)
+  {
+    writeCount = (pipeline.errors < record.len) ? record.len - pipeline.errors : 0;
+
+    if (pipeline.errors > 0)
+    {
+      Serial.println("Write FAILED");
+      Serial.print("Errors: ");
+      Serial.println(pipeline.errors);
+      Serial.println("[can try sending hex line again]");
+    } else {
+      imageChecksum.add(record.address, record.payload, record.len);
+
+      Serial.println("Write successful");
+      Serial.print("Wrote ");
+      Serial.print(writeCount);
+      Serial.println(" bytes");
+    }
+
+    pipeline.release();
+    return;
+  }
+
+  switch (record.type)
+  {
+    case FRAME_TYPE_DATA:
+      if (pipeline.firstResult > 0)
+      {
+        // host resends this frame and everything after it, same as retrying a hex line
+        uplink.nak(record, FRAME_STATUS_WRITE_FAILED);
+        pipeline.reset();
+        return;
+      }
+
+      binaryBytes += record.len;
+      imageChecksum.add(record.address, record.payload, record.len);
+      uplink.ack(record, FRAME_STATUS_OK);
+      break;
+    case FRAME_TYPE_END:
+      uplink.ack(record, FRAME_STATUS_OK);
+      journal.finished();
+
+      Serial.println();
+      Serial.print(F("Binary upload done, frames "));
+      Serial.print(uplink.frameCount);
+      Serial.print(F(" bytes "));
+      Serial.print(binaryBytes);
+      Serial.print(F(" retries "));
+      Serial.println(uplink.retryCount);
+      printSkipped();
+
+      binaryComplete = true;
+      binaryMode = false;
+      break;
+    default:
+      // unknown frames are skipped so a newer host does not stall
+      uplink.ack(record, FRAME_STATUS_BAD_TYPE);
+      break;
+  }
+
+  pipeline.release();
+}
+
+// to the target, or to every target of a gang
+// bytes that failed are added to errors
+byte write_slice(const unsigned int flashAddress, unsigned char* data, const uint8_t length, unsigned int &errors)
+{
+  byte result;
+
+#if defined(GANG_TARGETS)
+  if (gangActive)
+  {
+    // a target that fails drops out of the gang, frames are only refused once none is left
+    gang.write(flashAddress, data, length);
+
+    return (gang.working() > 0) ? 0 : 4;
+  }
+#endif
+
+  // failed bytes are reported by reportWriteError()
+  result = flasher.writeFlashBlock(flashAddress, data, length);
+
+  errors += flasher.getWriteErrors();
+  journal.written(flashAddress, length, result == 0);
+
+  return result;
+}
+
+#if WRITE_STAGING
+// host sends no more records than this before it waits for an answer
+// so once that many are held their block is written without waiting for the next one
+uint8_t hold_limit(void)
+{
+  return binaryMode ? FRAME_WINDOW : 1;
+}
+
+// the staged block has been written, tell the user or host how it went for every record that fed it
+// a failure NAKs the first of them, host then sends it and everything after it again
+void finish_staged_block(void)
+{
+  // the current record may have run into the next block, only its first part was written
+  const bool spanning = !pipeline.empty() && (pipeline.current().type == FRAME_TYPE_DATA) && (pipeline.offset > 0);
+  stagedBlock_t block;
+
+  staging.finish(pipeline.current().payload, spanning ? pipeline.offset : 0, imageChecksum, block);
+
+  if (block.failed)
+  {
+    if (!binaryMode)
+    {
+      Serial.println("Write FAILED");
+      Serial.print("Errors: ");
+      Serial.println(block.errors);
+      Serial.println("[can try sending hex line again]");
+
+      // rest of it is not written either
+      if (spanning && (block.records == 0))
+      {
+        pipeline.release();
+      }
+    } else {
+      uplink.nak((block.records > 0) ? block.firstSeq : pipeline.current().seq, FRAME_STATUS_WRITE_FAILED);
+      pipeline.reset();
+    }
+  } else if (block.records > 0) {
+    if (!binaryMode)
+    {
+      Serial.println("Write successful");
+      Serial.print("Wrote ");
+      Serial.print(block.bytes);
+      Serial.println(" bytes");
+    } else {
+      binaryBytes += block.bytes;
+      uplink.ack(block.lastSeq, FRAME_STATUS_OK);
+    }
+  }
+}
+
+// writes the lowest run of staged bytes, at most a slice of it
+bool write_staged_slice(void)
+{
+  unsigned int flashAddress;
+  unsigned char* data;
+  uint8_t length;
+  unsigned int errors = 0;
+  byte result;
+
+  if (!staging.take(flashAddress, data, length, PIPELINE_SLICE_BYTES))
+  {
+    return false;
+  }
+
+  clockRate.setPhase(ratePhaseProgram);
+
+  result = write_slice(flashAddress, data, length, errors);
+  staging.written(flashAddress, data, length, result, errors);
+
+  if (staging.empty())
+  {
+    finish_staged_block();
+  }
+
+  return true;
+}
+#endif
+
+// true while written records still have bytes on their way to flash
+bool writes_pending(void)
+{
+#if WRITE_STAGING
+  return !pipeline.empty() || !staging.empty();
+#else
+  return !pipeline.empty();
+#endif
+}
+
+// program stage, writes at most one slice of the oldest record
+// drain writes out staged bytes right away instead of waiting for more records of their block
+// returns true if the bus was used
+bool state_machine_program(const bool drain)
+{
+  uint8_t chunk;
+
+#if WRITE_STAGING
+  // host waits for the records held, or nothing more is coming for now
+  if ((staging.held() >= hold_limit()) || (pipeline.empty() && (drain || (millis() - lastStagedTime > STAGING_IDLE_MS))))
+  {
+    if (write_staged_slice())
+    {
+      return true;
+    }
+  }
+#endif
+
+  if (pipeline.empty())
+  {
+    return false;
+  }
+
+  frame_t &record = pipeline.current();
+
+  clockRate.setPhase(ratePhaseProgram);
+
+  if (record.type != FRAME_TYPE_DATA)
+  {
+#if WRITE_STAGING
+    // end of upload, everything staged goes out first
+    if (write_staged_slice())
+    {
+      return true;
+    }
+#endif
+    finish_record(record);
+    return false;
+  }
+
+#if WRITE_STAGING
+  // a record is held once staged, the block is written when a record for another one comes along
+  chunk = staging.add(record.address + pipeline.offset, &record.payload[pipeline.offset], record.len - pipeline.offset);
+
+  if ((chunk == 0) && (pipeline.offset < record.len))
+  {
+    return write_staged_slice();
+  }
+
+  pipeline.offset += chunk;
+  lastStagedTime = millis();
+
+  if (pipeline.offset >= record.len)
+  {
+    staging.hold(record.seq, record.len);
+    pipeline.release();
+  }
+
+  return false;
+#else
+  byte result;
+
+  chunk = record.len - pipeline.offset;
+  if (chunk > PIPELINE_SLICE_BYTES)
+  {
+    chunk = PIPELINE_SLICE_BYTES;
+  }
+
+  result = write_slice(record.address + pipeline.offset, &record.payload[pipeline.offset], chunk, pipeline.errors);
+
+  if (pipeline.firstResult == 0)
+  {
+    pipeline.firstResult = result;
+  }
+
+  pipeline.offset += chunk;
+
+  if (pipeline.offset >= record.len)
+  {
+    finish_record(record);
+  }
+
+  return true;
+#endif
+}
+
+// input stage for binary mode, returns true if a frame was queued
+bool state_machine_binary(void)
+{
+  if (pipeline.full() || !uplink.poll(pipeline.next()))
+  {
+    return false;
+  }
+
+  pipeline.commit();
+  lastFrameTime = millis();
+
+  return true;
+}
+
 void setup()
 {
 
@@ -594,7 +2156,11 @@ void setup()
   digitalWrite(ledPin, HIGH);
 #endif
 
-#if defined(USE_SOFTWIRE_LIBRARY)
+#if defined(USE_BITBANG_BUS)
+  // milliseconds target may stretch the clock before giving up, same as the library timeouts below
+  Wire.setTimeoutMillis(20);
+  Wire.begin();
+#elif defined(USE_SOFTWIRE_LIBRARY)
   // often esp gpio pins have internal pullups
   // so use them instead of having to add external resistors
   Wire.enablePullups(true);
@@ -623,11 +2189,33 @@ void setup()
   Wire.begin(sdaPin, sclPin);
 #endif
 
-  // esp32 uses different functions to initialize and control watchdog
-#if defined(ESP8266)
-  // esp8265/66 hardware watchdog cannot be disabled
-  // however, software watchdog can be disabled
-  ESP.wdtDisable();
+  flasher.setWriteErrorHandler(reportWriteError);
+
+#if FLASH_SHADOW
+  flasher.setListener(&shadow);
+#endif
+
+#if defined(GANG_TARGETS)
+  // second target of the gang, the first is on Wire
+  Wire1.setTimeout(20);
+  Wire1.begin(GANG_SDA_1, GANG_SCL_1);
+
+  gang.add(gangFlasher0);
+  gang.add(gangFlasher1);
+#endif
+
+#if defined(OUTPUT_TO_CONTROL_RESET_AVAILABLE)
+  // target stays powered until acquire or flashhex cycles it
+  pinMode(outputToControlReset, OUTPUT);
+  digitalWrite(outputToControlReset, TARGET_POWER_ON_LEVEL);
+#endif
+
+  // the esp8265/66 watchdogs stay enabled, long operations run as jobs a slice per loop() pass
+  // and the core feeds the watchdog every time loop() returns
+
+#if defined(SERIAL_RX_BUFFER_SIZE)
+  // room for a full window of binary frames while target is being written
+  Serial.setRxBufferSize(SERIAL_RX_BUFFER_SIZE);
 #endif
 
   // the boot text on some esp might be garbled due to other baud rates, but 115200 should be easily achievable afterward
@@ -659,98 +2247,132 @@ void loop()
 {
   // track state for handshake
   static uint8_t state = idle;
-  static uint8_t status;
+  static uint16_t status;
+
+  // a command line is looked up once, even if it then has to wait
+  static bool commandParsed = false;
+  static int heldCmd;
 
   // for parsing of serial
   int clicmd;
-  int16_t addr;
-  // for ack, nack, etc. results
-  byte result;
-  uint8_t results[64];
+  uint32_t addr;
 
-  unsigned int writeCount = 0;
-  unsigned int errorCount = 0;
+  // for pipeline statistics
+  bool inputBlocked = false;
+  bool inputAccepted = false;
+  bool programmed;
 
-#if defined(ESP8266)
-  // clear watchdog to avoid reset if using an ESP8265/8266
-  ESP.wdtFeed();
-  //yield();
-#endif
-
-  // want similar to what getLineWait does but not blocking
-  if (status != 0)
+  // binary upload bypasses the line parser entirely
+  if (binaryMode)
   {
-    ttycli.reset();
+    inputBlocked = pipeline.full() && (Serial.available() > 0);
+    inputAccepted = state_machine_binary();
+    programmed = state_machine_program(false);
+    pipeline.sample(inputBlocked, inputAccepted, programmed, true);
+
+    if (binaryMode && pipeline.empty() && (millis() - lastFrameTime > BINARY_IDLE_TIMEOUT_MS))
+    {
+      Serial.println(F("Binary mode timed out"));
+      binaryMode = false;
+    }
+
+    toggleLED_nb();
+    return;
   }
 
   // blocking version will trigger watchdog, so avoid that
-  // returns 0 until end-of-line seen.
-  status = ttycli.getLine();
+  // returns 0 until end-of-line seen, a complete line is held until it can be handled
+  // drain everything received so far, so serial keeps up with the program stage
+  while ((status == 0) && (Serial.available() > 0))
+  {
+    status = ttycli.getLine();
+  }
 
   if (status != 0)
   {
-    clicmd = ttycli.tryihex(&addr, results);
-
     // we have an intel hex file line?
-    if (clicmd > 0)
-    { 
-      writeCount = 0;
-      errorCount = 0;
-
-      // try to flash hex line
-      for (int i = 0; i < clicmd; i++)
+    if (ttycli.isihex())
+    {
+      if (!pipeline.full())
       {
-        // try to actually flash target
-        result = flasher.writeFlashByte(addr, results[i]);
-        if (result > 0)
-        {
-          checkError(result);
+        frame_t &record = pipeline.next();
 
-#ifdef VERBOSE_DEBUG
-          Serial.print("Write failed at addr 0x");
-          Serial.print(addr, HEX);
-          Serial.print(" for 0x");
-          Serial.println(results[i], HEX);
-#endif
-          errorCount += 1;
-        } else {
-          writeCount += 1;
+        clicmd = ttycli.tryihex(&addr, record.payload, FRAME_PAYLOAD_MAX);
+
+        // e.g., an extended linear address record pointing somewhere else than the 8051 code space
+        if ((clicmd > 0) && (addr + clicmd > TARGET_FLASH_SIZE))
+        {
+          Serial.print(F("Record outside flash at 0x"));
+          Serial.println(addr, HEX);
+          clicmd = -1;
         }
 
-        addr++;
-      }
+        // zero length records (e.g., end of file) have nothing to write
+        if (clicmd > 0)
+        {
+          record.type = FRAME_TYPE_DATA;
+          record.address = addr;
+          record.len = clicmd;
+          pipeline.commit();
+          inputAccepted = true;
+        }
 
-      if (errorCount > 0)
-      {
-        Serial.println("Write FAILED");
-        Serial.print("Errors: ");
-        Serial.println(errorCount);
-        Serial.println("[can try sending hex line again]");
+        ttycli.reset();
+        status = 0;
       } else {
-        Serial.println("Write successful");
-        Serial.print("Wrote ");
-        Serial.print(writeCount);
-        Serial.println(" bytes");
+        inputBlocked = true;
       }
     } else {
       // else try an "interactive" command.
 
       // look for a command.
-      clicmd = ttycli.keyword(cmds);
-      if (debug)
+      if (!commandParsed)
       {
-        printf("Have command %d\n", clicmd);
+        heldCmd = ttycli.keyword(cmds);
+        commandParsed = true;
+
+        if (debug)
+        {
+          printf("Have command %d\n", heldCmd);
+        }
       }
 
-      state = state_machine_command(clicmd, state);
+      // commands wait until earlier hex lines are written and a running job is done, so output stays in order
+      // abort is the exception, it is there to stop them
+      if ((heldCmd != CMD_ABORT) && (writes_pending() || (job != jobNone)))
+      {
+        inputBlocked = true;
+      } else {
+        state = state_machine_command(heldCmd, state);
+
+        ttycli.reset();
+        status = 0;
+        commandParsed = false;
+      }
     }
   }
 
+  // write part of the oldest queued hex line, hex lines sent during a job (e.g., erase) wait for it
+  // a command line being held has to wait for staged bytes, so they are written right away
+  programmed = (job == jobNone) && state_machine_program(status != 0);
+  pipeline.sample(inputBlocked, inputAccepted, programmed, (status != 0) || (Serial.available() > 0));
 
   // put your main code here, to run repeatedly:
 
   state = state_machine_flasher(state);
 
+  // erase, readhex or verify, one slice per pass
+  state_machine_job();
+
+  // flashhex, one step per pass
+  state_machine_autoflash();
+
+  // gang, a slice per pass
+  state_machine_gang();
+
+  // clock changes made while binary frames were flowing are printed here too
+  print_clock_decisions();
+
   // periodic led blink to show board is alive
   // this will only actually toggle pin if LED_BUILTIN is defined
   toggleLED_nb();
@@ -0,0 +1,415 @@
+/*
+  bitBangBus.h - OnbrightFlasher bus policy that bit bangs i2c on two fixed pins
+  Copyright (c) 2023 Jonathan Armstrong.  All right reserved.
+
+  Only what the flasher needs: start, address, data bytes, stop for writes and
+  start, address, data bytes with a NACK on the last one, stop for reads.
+  No arbitration, no repeated start, no slave mode.
+
+  Pins are template arguments so every pin access compiles down to a register
+  write on boards with a direct backend (ESP8266, AVR). Lines are driven open
+  drain: low means output enabled with the latch at zero, high means input and
+  the pull up does the rest.
+
+  Clock stretching is honoured by waiting for SCL to actually go high after it
+  is released, up to the timeout. The target holds SCL low while it erases, so
+  a timeout shorter than an erase returns 5 (timeout) just like Wire does.
+*/
+
+#ifndef Bit_bang_bus_h
+#define Bit_bang_bus_h
+
+// for byte type
+#include <Arduino.h>
+
+// default bus clock, OB38S003 is happy at 100 kHz
+#define BITBANG_CLOCK_HZ 100000
+
+// how long to wait for target to let go of SCL, matches the 20 ms Wire timeout set by the sketch
+#define BITBANG_STRETCH_TIMEOUT_US 20000
+
+// same status values endTransmission() returns
+#define BITBANG_SUCCESS      0
+#define BITBANG_NACK_ADDRESS 2
+#define BITBANG_NACK_DATA    3
+#define BITBANG_BUS_ERROR    4
+#define BITBANG_TIMEOUT      5
+
+// gpio backends
+// each provides begin(), low(), release() and read() for one pin
+
+#if defined(ESP8266)
+  // gpio0 to gpio15 go through GPES/GPEC (output enable) and GPI (input level)
+  // gpio16 sits on the RTC block and is not supported
+  template <uint8_t PIN>
+  struct Esp8266Gpio
+  {
+    static_assert(PIN < 16, "bit bang pins must be gpio0 to gpio15");
+
+    static void begin(void)
+    {
+      pinMode(PIN, INPUT_PULLUP);
+      // latch stays low, only output enable changes from here on
+      GPOC = (1 << PIN);
+    }
+
+    static inline void low(void)
+    {
+      GPES = (1 << PIN);
+    }
+
+    static inline void release(void)
+    {
+      GPEC = (1 << PIN);
+    }
+
+    static inline bool read(void)
+    {
+      return (GPI & (1 << PIN)) != 0;
+    }
+  };
+
+  template <uint8_t PIN> using BitBangGpio = Esp8266Gpio<PIN>;
+#elif defined(__AVR__)
+  // Arduino pin to port mapping lives in PROGMEM, so look it up once in begin()
+  // and keep the registers for every access after that
+  template <uint8_t PIN>
+  struct AvrGpio
+  {
+    static void begin(void)
+    {
+      const uint8_t port = digitalPinToPort(PIN);
+
+      mask = digitalPinToBitMask(PIN);
+      ddr = portModeRegister(port);
+      input = portInputRegister(port);
+
+      pinMode(PIN, INPUT);
+      *portOutputRegister(port) &= ~mask;
+    }
+
+    static inline void low(void)
+    {
+      *ddr |= mask;
+    }
+
+    static inline void release(void)
+    {
+      *ddr &= ~mask;
+    }
+
+    static inline bool read(void)
+    {
+      return (*input & mask) != 0;
+    }
+
+    static volatile uint8_t *ddr;
+    static volatile uint8_t *input;
+    static uint8_t mask;
+  };
+
+  template <uint8_t PIN> volatile uint8_t *AvrGpio<PIN>::ddr;
+  template <uint8_t PIN> volatile uint8_t *AvrGpio<PIN>::input;
+  template <uint8_t PIN> uint8_t AvrGpio<PIN>::mask;
+
+  template <uint8_t PIN> using BitBangGpio = AvrGpio<PIN>;
+#else
+  // anything else (e.g., ESP32 which has hardware i2c anyway) goes through the core calls
+  template <uint8_t PIN>
+  struct ArduinoGpio
+  {
+    static void begin(void)
+    {
+      pinMode(PIN, INPUT_PULLUP);
+    }
+
+    static inline void low(void)
+    {
+      pinMode(PIN, OUTPUT);
+      digitalWrite(PIN, LOW);
+    }
+
+    static inline void release(void)
+    {
+      pinMode(PIN, INPUT_PULLUP);
+    }
+
+    static inline bool read(void)
+    {
+      return digitalRead(PIN) == HIGH;
+    }
+  };
+
+  template <uint8_t PIN> using BitBangGpio = ArduinoGpio<PIN>;
+#endif
+
+// settings are shared by every copy for the same pins, so the flasher's copy of
+// the bus follows setClock()/setTimeoutMillis() made on the sketch's copy
+template <uint8_t SDA_PIN, uint8_t SCL_PIN, template <uint8_t> class Gpio = BitBangGpio>
+class BitBangBus
+{
+  typedef Gpio<SDA_PIN> sda;
+  typedef Gpio<SCL_PIN> scl;
+
+  public:
+    // both lines released
+    static void begin(void)
+    {
+      sda::begin();
+      scl::begin();
+      sda::release();
+      scl::release();
+    }
+
+    static void setClock(const unsigned long hz)
+    {
+      // half of one SCL period, zero runs as fast as the pins toggle
+      halfPeriodMicros = (hz > 0) ? (500000UL / hz) : 0;
+    }
+
+    static unsigned long getClock(void)
+    {
+      return halfPeriodMicros ? (500000UL / halfPeriodMicros) : 0;
+    }
+
+    static void setTimeoutMillis(const unsigned int timeout)
+    {
+      stretchTimeoutMicros = timeout * 1000UL;
+    }
+
+    // disabled: SCL is assumed high half a period after release, for targets known not to stretch
+    static void setClockStretch(const bool enabled)
+    {
+      stretchEnabled = enabled;
+    }
+
+    byte write(const uint8_t address, const uint8_t* data, const uint8_t length)
+    {
+      byte result;
+      uint8_t index;
+
+      result = start();
+      if (result != BITBANG_SUCCESS)
+      {
+        return result;
+      }
+
+      result = writeByte(address << 1);
+      if (result != BITBANG_SUCCESS)
+      {
+        return finish(result == BITBANG_NACK_DATA ? BITBANG_NACK_ADDRESS : result);
+      }
+
+      for (index = 0; index < length; index++)
+      {
+        result = writeByte(data[index]);
+        if (result != BITBANG_SUCCESS)
+        {
+          return finish(result);
+        }
+      }
+
+      return finish(BITBANG_SUCCESS);
+    }
+
+    uint8_t read(const uint8_t address, uint8_t* data, const uint8_t length)
+    {
+      uint8_t count = 0;
+
+      if (start() != BITBANG_SUCCESS)
+      {
+        return 0;
+      }
+
+      if (writeByte((address << 1) | 1) != BITBANG_SUCCESS)
+      {
+        finish(BITBANG_NACK_ADDRESS);
+        return 0;
+      }
+
+      while (count < length)
+      {
+        // NACK on the last byte tells target to let go of SDA for the stop
+        if (!readByte(data[count], count + 1 < length))
+        {
+          finish(BITBANG_TIMEOUT);
+          return count;
+        }
+
+        count++;
+      }
+
+      finish(BITBANG_SUCCESS);
+
+      return count;
+    }
+
+  private:
+    static inline void halfPeriod(void)
+    {
+      if (halfPeriodMicros)
+      {
+        delayMicroseconds(halfPeriodMicros);
+      }
+    }
+
+    // let SCL go high and wait while target stretches it
+    static bool clockHigh(void)
+    {
+      unsigned long startTime;
+
+      scl::release();
+
+      if (!stretchEnabled)
+      {
+        return true;
+      }
+
+      startTime = micros();
+      while (!scl::read())
+      {
+        if (micros() - startTime > stretchTimeoutMicros)
+        {
+          return false;
+        }
+
+        delayMicroseconds(1);
+      }
+
+      return true;
+    }
+
+    static byte start(void)
+    {
+      sda::release();
+      if (!clockHigh())
+      {
+        return BITBANG_TIMEOUT;
+      }
+      halfPeriod();
+
+      // something else is holding SDA, e.g., target stuck part way through a byte
+      if (!sda::read())
+      {
+        return BITBANG_BUS_ERROR;
+      }
+
+      sda::low();
+      halfPeriod();
+      scl::low();
+
+      return BITBANG_SUCCESS;
+    }
+
+    // stop condition, unless target is still holding SCL after a timeout
+    static byte finish(const byte result)
+    {
+      if (result == BITBANG_TIMEOUT)
+      {
+        sda::release();
+        scl::release();
+        return result;
+      }
+
+      sda::low();
+      halfPeriod();
+      if (!clockHigh())
+      {
+        sda::release();
+        return BITBANG_TIMEOUT;
+      }
+      halfPeriod();
+      sda::release();
+      halfPeriod();
+
+      return result;
+    }
+
+    // eight data bits then the ACK bit from target
+    static byte writeByte(const uint8_t value)
+    {
+      uint8_t mask;
+      bool ack;
+
+      for (mask = 0x80; mask != 0; mask >>= 1)
+      {
+        if (value & mask)
+        {
+          sda::release();
+        } else {
+          sda::low();
+        }
+
+        halfPeriod();
+        if (!clockHigh())
+        {
+          return BITBANG_TIMEOUT;
+        }
+        halfPeriod();
+        scl::low();
+      }
+
+      sda::release();
+      halfPeriod();
+      if (!clockHigh())
+      {
+        return BITBANG_TIMEOUT;
+      }
+      ack = !sda::read();
+      halfPeriod();
+      scl::low();
+
+      return ack ? BITBANG_SUCCESS : BITBANG_NACK_DATA;
+    }
+
+    static bool readByte(uint8_t &value, const bool ack)
+    {
+      uint8_t index;
+
+      value = 0;
+      sda::release();
+
+      for (index = 0; index < 8; index++)
+      {
+        halfPeriod();
+        if (!clockHigh())
+        {
+          return false;
+        }
+        value = (value << 1) | (sda::read() ? 1 : 0);
+        halfPeriod();
+        scl::low();
+      }
+
+      if (ack)
+      {
+        sda::low();
+      }
+
+      halfPeriod();
+      if (!clockHigh())
+      {
+        return false;
+      }
+      halfPeriod();
+      scl::low();
+      sda::release();
+
+      return true;
+    }
+
+    static unsigned int halfPeriodMicros;
+    static unsigned long stretchTimeoutMicros;
+    static bool stretchEnabled;
+};
+
+template <uint8_t SDA_PIN, uint8_t SCL_PIN, template <uint8_t> class Gpio>
+unsigned int BitBangBus<SDA_PIN, SCL_PIN, Gpio>::halfPeriodMicros = 500000UL / BITBANG_CLOCK_HZ;
+
+template <uint8_t SDA_PIN, uint8_t SCL_PIN, template <uint8_t> class Gpio>
+unsigned long BitBangBus<SDA_PIN, SCL_PIN, Gpio>::stretchTimeoutMicros = BITBANG_STRETCH_TIMEOUT_US;
+
+template <uint8_t SDA_PIN, uint8_t SCL_PIN, template <uint8_t> class Gpio>
+bool BitBangBus<SDA_PIN, SCL_PIN, Gpio>::stretchEnabled = true;
+
+#endif
@@ -0,0 +1,238 @@
+/*
+  clockRate.cpp - picks the i2c clock for each phase of a flash cycle from the errors seen on the bus
+  Copyright (c) 2023 Jonathan Armstrong.  All right reserved.
+*/
+
+#include "clockRate.h"
+
+// clocks tried from fastest to slowest, 10 kHz is what setup() used to fall back to by hand
+static const unsigned long clockSteps[] = { 400000, 200000, 100000, 50000, 20000, 10000 };
+
+#define CLOCK_STEPS (sizeof(clockSteps) / sizeof(clockSteps[0]))
+
+static const char *const phaseNames[] = { "handshake", "erase", "program", "read", "none" };
+
+ClockRateController::ClockRateController(const unsigned long maxHz, const unsigned long startHz)
+{
+  // fastest step the board is allowed to use
+  fastestStep = 0;
+  while ((fastestStep < CLOCK_STEPS - 1) && (clockSteps[fastestStep] > maxHz))
+  {
+    fastestStep++;
+  }
+
+  // phases start here and step up once transfers stay clean
+  startStep = fastestStep;
+  while ((startStep < CLOCK_STEPS - 1) && (clockSteps[startStep] > startHz))
+  {
+    startStep++;
+  }
+
+  fixedHz = 0;
+  phase = ratePhaseNone;
+  unit = 0;
+
+  decisionHead = 0;
+  decisionCount = 0;
+
+  reset();
+}
+
+void ClockRateController::reset(void)
+{
+  uint8_t index;
+
+  for (index = 0; index < ratePhaseCount; index++)
+  {
+    step[index] = startStep;
+    upWindows[index] = CLOCK_RATE_UP_WINDOWS;
+  }
+
+  transfers = 0;
+  errors = 0;
+  cleanWindows = 0;
+}
+
+void ClockRateController::setFixedClock(const unsigned long hz)
+{
+  fixedHz = hz;
+}
+
+unsigned long ClockRateController::getFixedClock(void)
+{
+  return fixedHz;
+}
+
+void ClockRateController::setPhase(const uint8_t newPhase)
+{
+  if (newPhase == phase)
+  {
+    return;
+  }
+
+  // a window only ever covers one phase
+  phase = newPhase;
+  transfers = 0;
+  errors = 0;
+  cleanWindows = 0;
+}
+
+uint8_t ClockRateController::getPhase(void)
+{
+  return phase;
+}
+
+void ClockRateController::newUnit(void)
+{
+  unit++;
+}
+
+uint16_t ClockRateController::getUnit(void)
+{
+  return unit;
+}
+
+unsigned long ClockRateController::clock(void)
+{
+  return phaseClock(phase);
+}
+
+unsigned long ClockRateController::phaseClock(const uint8_t index)
+{
+  if (fixedHz > 0)
+  {
+    return fixedHz;
+  }
+
+  if (index < ratePhaseCount)
+  {
+    return clockSteps[step[index]];
+  }
+
+  // nothing is judged outside a phase, so use the slowest clock any phase has settled on
+  uint8_t slowest = fastestStep;
+
+  for (uint8_t other = 0; other < ratePhaseCount; other++)
+  {
+    if (step[other] > slowest)
+    {
+      slowest = step[other];
+    }
+  }
+
+  return clockSteps[slowest];
+}
+
+// results that are part of normal operation and say nothing about the wiring
+bool ClockRateController::expected(const byte status)
+{
+  switch (phase)
+  {
+    case ratePhaseHandshake:
+      // target only answers inside its window after power up
+      return status == 2;
+    case ratePhaseErase:
+      // target holds the clock for longer than the bus timeout while erasing
+      return status == 5;
+    case ratePhaseProgram:
+      // target nacks its address while programming the previous byte, flasher waits and retries
+      return status == 2;
+  }
+
+  return false;
+}
+
+void ClockRateController::record(const byte status)
+{
+  if ((fixedHz > 0) || (phase >= ratePhaseCount))
+  {
+    return;
+  }
+
+  transfers++;
+  if ((status != 0) && !expected(status))
+  {
+    errors++;
+  }
+
+  // a target that answers nothing at all is missing or reset, not on marginal wiring
+  if ((errors >= CLOCK_RATE_DOWN_ERRORS) && (errors < transfers))
+  {
+    if (step[phase] < CLOCK_STEPS - 1)
+    {
+      change(step[phase] + 1);
+    }
+
+    if (upWindows[phase] < CLOCK_RATE_UP_WINDOWS_MAX)
+    {
+      upWindows[phase] *= 2;
+    }
+
+    transfers = 0;
+    errors = 0;
+    cleanWindows = 0;
+    return;
+  }
+
+  if (transfers < CLOCK_RATE_WINDOW)
+  {
+    return;
+  }
+
+  if (errors == 0)
+  {
+    cleanWindows++;
+  } else {
+    cleanWindows = 0;
+  }
+
+  if ((cleanWindows >= upWindows[phase]) && (step[phase] > fastestStep))
+  {
+    change(step[phase] - 1);
+    cleanWindows = 0;
+  }
+
+  transfers = 0;
+  errors = 0;
+}
+
+void ClockRateController::change(const uint8_t newStep)
+{
+  // oldest decision is dropped if nobody has printed it yet
+  rateDecision_t &decision = decisions[(decisionHead + decisionCount) % CLOCK_RATE_LOG_SIZE];
+
+  decision.unit = unit;
+  decision.phase = phase;
+  decision.fromHz = clockSteps[step[phase]];
+  decision.toHz = clockSteps[newStep];
+  decision.errors = errors;
+  decision.transfers = transfers;
+
+  if (decisionCount < CLOCK_RATE_LOG_SIZE)
+  {
+    decisionCount++;
+  } else {
+    decisionHead = (decisionHead + 1) % CLOCK_RATE_LOG_SIZE;
+  }
+
+  step[phase] = newStep;
+}
+
+bool ClockRateController::takeDecision(rateDecision_t &decision)
+{
+  if (decisionCount == 0)
+  {
+    return false;
+  }
+
+  decision = decisions[decisionHead];
+  decisionHead = (decisionHead + 1) % CLOCK_RATE_LOG_SIZE;
+  decisionCount--;
+
+  return true;
+}
+
+const char *ClockRateController::phaseName(const uint8_t index)
+{
+  return phaseNames[(index < ratePhaseCount) ? index : ratePhaseCount];
+}
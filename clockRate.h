@@ -0,0 +1,181 @@
+/*
+  clockRate.h - picks the i2c clock for each phase of a flash cycle from the errors seen on the bus
+  Copyright (c) 2023 Jonathan Armstrong.  All right reserved.
+
+  Every phase (handshake, erase, program, read) starts at standard mode
+  (100 kHz, what the i2c libraries default to) and a run of clean windows
+  steps it up towards the fastest clock the bus is set up for. Failed
+  transfers in a window of recent ones step that phase one clock down again.
+  Clocks are remembered across units, so a marginal fixture settles after the
+  first few and good wiring ends up running at full speed.
+
+  AdaptiveBus wraps any other bus policy, reports each result to the controller
+  and changes the clock of the wrapped bus before a transfer when needed.
+*/
+
+#ifndef Clock_rate_h
+#define Clock_rate_h
+
+#include <Arduino.h>
+
+// fastest clock tried, projectDefs.h picks it for the chosen bus
+#ifndef CLOCK_RATE_MAX_HZ
+  #define CLOCK_RATE_MAX_HZ 100000
+#endif
+
+// clock each phase starts at, never above the fastest
+#ifndef CLOCK_RATE_START_HZ
+  #define CLOCK_RATE_START_HZ 100000
+#endif
+
+// transfers judged together
+#define CLOCK_RATE_WINDOW 32
+
+// this many failures inside one window steps the clock down straight away
+#define CLOCK_RATE_DOWN_ERRORS 2
+
+// clean windows in a row before one step faster is tried again
+// doubled each time a phase has to step down, so a clock that keeps failing is tried less and less often
+#define CLOCK_RATE_UP_WINDOWS 8
+#define CLOCK_RATE_UP_WINDOWS_MAX 128
+
+// decisions kept until the sketch gets a chance to print them (not while binary frames are flowing)
+#ifndef CLOCK_RATE_LOG_SIZE
+  #define CLOCK_RATE_LOG_SIZE 4
+#endif
+
+enum { ratePhaseHandshake,
+       ratePhaseErase,
+       ratePhaseProgram,
+       ratePhaseRead,
+       ratePhaseCount
+};
+
+// nothing is judged outside the phases above (e.g., reset, signature on its own)
+#define ratePhaseNone ratePhaseCount
+
+struct rateDecision_t {
+  uint16_t unit;
+  uint8_t phase;
+  unsigned long fromHz;
+  unsigned long toHz;
+  uint8_t errors;
+  uint8_t transfers;
+};
+
+class ClockRateController
+{
+  public:
+    ClockRateController(const unsigned long maxHz = CLOCK_RATE_MAX_HZ, const unsigned long startHz = CLOCK_RATE_START_HZ);
+
+    // every phase back to the start clock
+    void reset(void);
+
+    // zero goes back to adapting, anything else holds every phase at that clock
+    void setFixedClock(const unsigned long hz);
+    unsigned long getFixedClock(void);
+
+    void setPhase(const uint8_t phase);
+    uint8_t getPhase(void);
+
+    // another target was connected, decisions are labelled with this count
+    void newUnit(void);
+    uint16_t getUnit(void);
+
+    // clock for the current phase, or for a given one
+    unsigned long clock(void);
+    unsigned long phaseClock(const uint8_t phase);
+
+    // a Wire style status of one transfer (0 success, 2 address nack, 3 data nack, 4 other, 5 timeout)
+    void record(const byte status);
+
+    // oldest decision not yet handed out, false if there is none
+    bool takeDecision(rateDecision_t &decision);
+
+    static const char *phaseName(const uint8_t phase);
+
+  private:
+    bool expected(const byte status);
+    void change(const uint8_t step);
+
+    uint8_t fastestStep;
+    uint8_t startStep;
+    uint8_t step[ratePhaseCount];
+    uint8_t upWindows[ratePhaseCount];
+    unsigned long fixedHz;
+
+    uint8_t phase;
+    uint16_t unit;
+
+    uint8_t transfers;
+    uint8_t errors;
+    uint8_t cleanWindows;
+
+    rateDecision_t decisions[CLOCK_RATE_LOG_SIZE];
+    uint8_t decisionHead;
+    uint8_t decisionCount;
+};
+
+// bus policy, e.g. OnbrightFlasher<AdaptiveBus<DefaultBus> >
+// the wrapped policy needs setClock(hz) on top of write()/read()
+template <class Bus>
+class AdaptiveBus
+{
+  public:
+    AdaptiveBus(const Bus &i2c, ClockRateController &controller) : bus(i2c), rate(&controller)
+    {
+      appliedHz = 0;
+    }
+
+    byte write(const uint8_t address, const uint8_t* data, const uint8_t length)
+    {
+      byte result;
+
+      applyClock();
+      result = bus.write(address, data, length);
+
+      // address only writes are handshake attempts and ready polls, target nacks those while busy
+      if (length > 0)
+      {
+        rate->record(result);
+      }
+
+      return result;
+    }
+
+    uint8_t read(const uint8_t address, uint8_t* data, const uint8_t length)
+    {
+      uint8_t count;
+
+      applyClock();
+      count = bus.read(address, data, length);
+
+      // a short read only happens when target nacked its address
+      rate->record((count == length) ? 0 : 2);
+
+      return count;
+    }
+
+    void setTimeoutMillis(const unsigned int timeout)
+    {
+      bus.setTimeoutMillis(timeout);
+    }
+
+  private:
+    void applyClock(void)
+    {
+      const unsigned long hz = rate->clock();
+
+      if (hz != appliedHz)
+      {
+        bus.setClock(hz);
+        appliedHz = hz;
+      }
+    }
+
+    Bus bus;
+    ClockRateController *rate;
+    unsigned long appliedHz;
+};
+
+#endif
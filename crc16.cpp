@@ -0,0 +1,31 @@
+#include "crc16.h"
+
+// bitwise rather than table driven, keeps 512 bytes of table out of AVR flash
+uint16_t crc16_update(uint16_t crc, uint8_t data)
+{
+  uint8_t bit;
+
+  crc ^= (uint16_t) data << 8;
+
+  for (bit = 0; bit < 8; bit++)
+  {
+    if (crc & 0x8000)
+    {
+      crc = (crc << 1) ^ 0x1021;
+    } else {
+      crc = crc << 1;
+    }
+  }
+
+  return crc;
+}
+
+uint16_t crc16_block(uint16_t crc, const uint8_t *data, size_t length)
+{
+  while (length--)
+  {
+    crc = crc16_update(crc, *data++);
+  }
+
+  return crc;
+}
@@ -0,0 +1,17 @@
+/*
+  crc16.h - CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF)
+  Same parameters as binascii.crc_hqx(data, 0xFFFF) in Python, so the host side needs nothing extra.
+*/
+
+#ifndef CRC16_H
+#define CRC16_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CRC16_INIT 0xFFFF
+
+extern uint16_t crc16_update(uint16_t crc, uint8_t data);
+extern uint16_t crc16_block(uint16_t crc, const uint8_t *data, size_t length);
+
+#endif // CRC16_H
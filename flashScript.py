@@ -4,6 +4,7 @@ import re
 import time
 import os
 import logging
+import binascii
 
 # Check and install pyserial
 try:
@@ -13,6 +14,103 @@ except ImportError:
     subprocess.check_call([python_executable, "-m", "pip", "install", "pyserial"])
     import serial.tools.list_ports
 
+# framed binary upload, see frameLink.h in the sketch
+FRAME_SYNC = 0xA5
+REPLY_SYNC = 0x5A
+FRAME_TYPE_DATA = 0x00
+FRAME_TYPE_END = 0x01
+FRAME_ACK = 0x06
+FRAME_NAK = 0x15
+FRAME_MAX_RETRIES = 10
+
+# target flash layout, see onbrightFlasher.h
+BLOCK_SIZE = 512
+FLASH_BLOCKS = 16
+ALL_BLOCKS = (1 << FLASH_BLOCKS) - 1
+# rewriting only helps bytes that still have bits to clear, give up and start over after this
+REPAIR_MAX_ATTEMPTS = 2
+
+# seconds flashhex keeps trying to handshake, see AUTOFLASH_HANDSHAKE_TIMEOUT_MS in the sketch
+AUTOFLASH_HANDSHAKE_TIMEOUT = 30
+
+
+def load_hex_image(path):
+    """Returns {address: byte} for every data record in an Intel HEX file."""
+    image = {}
+    with open(path, 'r') as file:
+        for line in file:
+            line = line.strip()
+            if not line.startswith(':'):
+                continue
+            record = bytes.fromhex(line[1:])
+            length, address, record_type = record[0], (record[1] << 8) | record[2], record[3]
+            if sum(record) & 0xFF or len(record) != length + 5:
+                raise ValueError(f"Bad record: {line}")
+            if record_type == 0x00:
+                for offset, value in enumerate(record[4:4 + length]):
+                    image[address + offset] = value
+            elif record_type == 0x01:
+                break
+    return image
+
+
+def build_frames(image, max_payload):
+    """Packs consecutive addresses into (address, payload) runs of at most max_payload bytes."""
+    frames = []
+    for address in sorted(image):
+        if frames and frames[-1][0] + len(frames[-1][1]) == address and len(frames[-1][1]) < max_payload:
+            frames[-1][1].append(image[address])
+        else:
+            frames.append((address, bytearray([image[address]])))
+    return frames
+
+
+def build_records(image, record_bytes):
+    """Intel HEX lines holding image in data records of at most record_bytes bytes, end of file record last."""
+    lines = []
+    for address, payload in build_frames(image, record_bytes):
+        record = bytes([len(payload), (address >> 8) & 0xFF, address & 0xFF, 0x00]) + bytes(payload)
+        lines.append(f":{record.hex().upper()}{(-sum(record)) & 0xFF:02X}\n")
+    lines.append(":00000001FF\n")
+    return lines
+
+
+def block_crcs(image):
+    """CRC-16/CCITT-FALSE of every 512 byte block as it should read back after programming (0xFF fill)."""
+    flash = bytearray([0xFF]) * (FLASH_BLOCKS * BLOCK_SIZE)
+    for address, value in image.items():
+        if address < len(flash):
+            flash[address] = value
+    return [binascii.crc_hqx(bytes(flash[block * BLOCK_SIZE:(block + 1) * BLOCK_SIZE]), 0xFFFF) for block in range(FLASH_BLOCKS)]
+
+
+def image_blocks(image):
+    """Mask of the blocks image has bytes in."""
+    blocks = 0
+    for address in image:
+        blocks |= 1 << (address // BLOCK_SIZE)
+    return blocks & ALL_BLOCKS
+
+
+def image_id(image):
+    """CRC-32 of the whole flash as it should read back (0xFF fill), names the image for resume."""
+    flash = bytearray([0xFF]) * (FLASH_BLOCKS * BLOCK_SIZE)
+    for address, value in image.items():
+        if address < len(flash):
+            flash[address] = value
+    return binascii.crc32(bytes(flash))
+
+
+def in_blocks(address, length, blocks):
+    """True if any byte of address..address+length-1 lies in a block set in the blocks mask."""
+    return any(blocks & (1 << (a // BLOCK_SIZE)) for a in range(address, address + length))
+
+
+def encode_frame(frame_type, seq, address, payload):
+    body = bytes([frame_type, seq & 0xFF, len(payload), (address >> 8) & 0xFF, address & 0xFF]) + bytes(payload)
+    crc = binascii.crc_hqx(body, 0xFFFF)
+    return bytes([FRAME_SYNC]) + body + bytes([crc >> 8, crc & 0xFF])
+
 
 class StateMachine:
     def __init__(self):
@@ -30,10 +128,41 @@ class StateMachine:
             self.erase,
             self.set_fuse,
             self.send_file,
+            self.verify,
             self.reset_mcu
         ]
         self.current_state = 0
 
+        # binary frames by default, --text sends hex lines one at a time like before
+        self.binary_upload = '--text' not in sys.argv[1:]
+
+        # --record-bytes=255 repacks the image into records that large for --text, fewer lines and round trips
+        self.record_bytes = 0
+
+        # blocks send_file still has to write, fewer once an interrupted upload resumes
+        # --no-resume always erases and sends everything
+        self.pending_blocks = ALL_BLOCKS
+        self.resume = '--no-resume' not in sys.argv[1:]
+        # an upload that broke off is resumed once before going back to the handshake (which starts a new journal)
+        self.upload_resumed = False
+        for arg in sys.argv[1:]:
+            if arg.startswith('--record-bytes='):
+                self.record_bytes = max(1, min(255, int(arg.split('=', 1)[1])))
+
+        # --auto lets the flasher run every step itself (flashhex command), script only streams the image
+        # --gang does the same for every target of a gang programmer (gang command)
+        self.gang = '--gang' in sys.argv[1:]
+        # set when retrying would not help (some targets of a gang failed), script exits non-zero
+        self.stop_status = 0
+        if '--auto' in sys.argv[1:] or self.gang:
+            self.states = [
+                self.select_port,
+                self.open_serial,
+                self.list_and_select_files,
+                self.check_ready,
+                self.autoflash
+            ]
+
         # Configure logging
         logging.basicConfig(
             level=logging.INFO,
@@ -50,6 +179,16 @@ class StateMachine:
             while self.current_state < len(self.states):
                 state_function = self.states[self.current_state]
                 success = state_function()
+                if not success and self.resume and state_function == self.send_file and not self.upload_resumed:
+                    self.logger.error(f"State {self.current_state} failed. Resuming the upload.")
+                    self.upload_resumed = True
+                    self.current_state = self.states.index(self.erase)
+                    continue
+                if success and state_function == self.send_file:
+                    self.upload_resumed = False
+                if not success and self.stop_status != 0:
+                    self.logger.error(f"State {self.current_state} failed. Stopping.")
+                    break
                 if not success:
                     self.logger.error(f"State {self.current_state} failed. Returning to handshake state.")
                     self.current_state = 3  # Set to index of the 'check_ready' state
@@ -62,6 +201,7 @@ class StateMachine:
             if self.ser and self.ser.isOpen():
                 self.ser.close()
                 print("Serial connection closed.")
+        return self.stop_status
 
     def select_port(self):
         available_ports = list(serial.tools.list_ports.comports())
@@ -182,7 +322,8 @@ class StateMachine:
 
     def handshake(self):
         try:
-            if self.send_command("handshake", "handshake"):
+            # acquire polls for the handshake window without breaks, keep trying for as long as we wait
+            if self.send_command("acquire 100 30000", "acquire 100 30000"):
                 if self.check_if_ready(timeout=30, expected_data="Status: 0"):
                     return True
         except serial.SerialException as e:
@@ -198,8 +339,46 @@ class StateMachine:
             self.logger.error(f"Error during connect_to_OBS38S003: {e}")
             return False
 
+    def resume_session(self):
+        """Names the image to the flasher, True if target already holds part of it and the erase can be skipped."""
+        self.pending_blocks = ALL_BLOCKS
+        image = load_hex_image(self.selected_file)
+        command = f"resume 0x{image_id(image):08X}"
+
+        if not self.send_command(command, command):
+            return False
+
+        resumed = False
+        start_time = time.time()
+        while time.time() - start_time < 5:
+            data = self.ser.readline().decode('utf-8', errors='replace').strip()
+            if data:
+                self.logger.info(data)
+            if data == "Session resumed":
+                resumed = True
+            if data.startswith("Resume:"):
+                break
+        else:
+            self.logger.error("No resume journal from the flasher")
+            return False
+
+        journal = dict(field.split('=', 1) for field in data.split()[1:] if '=' in field)
+        done = int(journal['programmed'], 16) | int(journal['verified'], 16)
+        used = image_blocks(image)
+
+        # a block that read back wrong needs bits set again, only an erase does that
+        if not resumed or int(journal['bad'], 16) or not (done & used):
+            return False
+
+        self.pending_blocks = used & ~done
+        self.logger.info(f"Resuming, blocks 0x{done & used:04X} already written, sending 0x{self.pending_blocks:04X}")
+        return True
+
     def erase(self):
         try:
+            if self.resume and self.resume_session():
+                return True
+
             if self.send_command("erase", "Erasing chip..."):
                 if self.check_if_ready(timeout=10, expected_data="Chip erase successful"):
                     return True
@@ -217,14 +396,139 @@ class StateMachine:
             self.logger.error(f"Error during set_fuse: {e}")
             return False
 
-    def send_file(self):
+    def send_file(self, blocks=None):
+        if blocks is None:
+            blocks = self.pending_blocks
+        if self.binary_upload:
+            return self.send_file_binary(blocks)
+        return self.send_file_text(blocks)
+
+    def read_reply(self, timeout=2):
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            data = self.ser.read(1)
+            if data and data[0] == REPLY_SYNC:
+                reply = self.ser.read(3)
+                if len(reply) == 3:
+                    return reply[0], reply[1], reply[2]
+        return None
+
+    def wait_binary_mode(self, timeout=5):
+        """Returns (window, max_payload) once the flasher is in binary mode, None otherwise."""
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            response = self.ser.readline().decode('utf-8', errors='replace').strip()
+            if response:
+                self.logger.info(response)
+            match = re.match(r'Binary mode window (\d+) max (\d+)', response)
+            if match:
+                return int(match.group(1)), int(match.group(2))
+            if response.startswith("RESULT"):
+                # flashhex stopped before programming
+                return None
+        return None
+
+    def send_frames(self, image, window, max_payload):
+        frames = build_frames(image, max_payload)
+        start_time = time.time()
+
+        # go back N: keep up to window frames unacknowledged, resend from the first one on NAK or timeout
+        base = 0
+        next_index = 0
+        retries = 0
+        while base < len(frames):
+            while next_index < len(frames) and next_index - base < window:
+                address, payload = frames[next_index]
+                self.ser.write(encode_frame(FRAME_TYPE_DATA, next_index, address, payload))
+                next_index += 1
+
+            reply = self.read_reply()
+            if reply is None:
+                self.logger.warning(f"No reply for frame {base}, resending")
+                retries += 1
+                next_index = base
+            else:
+                code, seq, status = reply
+                index = base + ((seq - base) & 0xFF)
+                if index >= next_index:
+                    # stale reply for something already acknowledged
+                    continue
+                if code == FRAME_ACK:
+                    base = index + 1
+                    retries = 0
+                elif code == FRAME_NAK:
+                    self.logger.warning(f"Frame {index} NAK (status {status}), resending")
+                    retries += 1
+                    base = index
+                    next_index = index
+
+            if retries > FRAME_MAX_RETRIES:
+                self.logger.error(f"Giving up on frame {base} at address 0x{frames[base][0]:04X}")
+                return False
+
+        for attempt in range(FRAME_MAX_RETRIES):
+            self.ser.write(encode_frame(FRAME_TYPE_END, len(frames), 0, b""))
+            reply = self.read_reply()
+            if reply and reply[0] == FRAME_ACK and reply[1] == len(frames) & 0xFF:
+                break
+        else:
+            self.logger.error("End of upload was not acknowledged")
+            return False
+
+        elapsed = time.time() - start_time
+        self.logger.info(f"Sent {len(image)} bytes in {len(frames)} frames, {elapsed:.2f} s")
+        return True
+
+    def send_file_binary(self, blocks=ALL_BLOCKS):
+        try:
+            if not self.check_if_ready(timeout=1):
+                return False
+
+            image = load_hex_image(self.selected_file)
+            image = {address: value for address, value in image.items() if in_blocks(address, 1, blocks)}
+
+            self.ser.write(b"binary\r\n")
+            params = self.wait_binary_mode()
+            if params is None:
+                self.logger.error("Flasher did not enter binary mode, try --text")
+                return False
+
+            if not self.send_frames(image, *params):
+                return False
+            return self.check_if_ready(timeout=5, expected_data="Binary upload done")
+        except Exception as e:
+            self.logger.error(f"Error sending file content: {e}")
+            return False
+
+    def read_upload_line(self):
+        """Next reply to a hex line, clock changes the flasher reports in between are only logged."""
+        while True:
+            response = self.ser.readline().decode('utf-8').strip()
+            if not response.startswith("Clock unit "):
+                return response
+            self.logger.info(response)
+
+    def send_file_text(self, blocks=ALL_BLOCKS):
         try:
             if self.check_if_ready(timeout=1):
                 with open(self.selected_file, 'r') as file:
                     lines = file.readlines()
+                    if self.record_bytes or blocks != ALL_BLOCKS:
+                        # only bytes inside those blocks, flasher sums the others already
+                        image = load_hex_image(self.selected_file)
+                        lines = build_records({address: value for address, value in image.items()
+                                               if in_blocks(address, 1, blocks)}, self.record_bytes or 16)
+                    else:
+                        # only data records, flasher answers nothing to the others
+                        # end of file record stays last
+                        lines = [line for line in lines[:-1]
+                                 if line.startswith(':') and int(line[7:9], 16) == 0] + lines[-1:]
                     for i, line in enumerate(lines):
+                        # flasher only takes a line once it sees the end of it, the last one may not have one
+                        if not line.endswith('\n'):
+                            line += '\n'
                         self.ser.write(line.encode('utf-8'))
-                        response = self.ser.readline().decode('utf-8').strip()
+                        response = self.read_upload_line()
                         self.logger.info(response)
 
                         if not response.strip() == line.strip():
@@ -234,7 +538,7 @@ class StateMachine:
                             return False
 
                         if not i == len(lines) - 1:
-                            response = self.ser.readline().decode('utf-8').strip()
+                            response = self.read_upload_line()
                             self.logger.info(response)
 
                             expected = "Write successful"
@@ -244,7 +548,7 @@ class StateMachine:
                                 self.logger.error(f"Response representation: {repr(response)}")
                                 return False
 
-                            response = self.ser.readline().decode('utf-8').strip()
+                            response = self.read_upload_line()
                             self.logger.info(response)
 
                             pattern = re.compile(r'Wrote (\d+) bytes')
@@ -261,6 +565,103 @@ class StateMachine:
             self.logger.error(f"Error sending file content: {e}")
             return False
 
+    def send_block_crcs(self):
+        for block, crc in enumerate(block_crcs(load_hex_image(self.selected_file))):
+            if not self.send_command(f"blockcrc {block} 0x{crc:04X}", f"Block crc {block}: 0x{crc:X}"):
+                return False
+        return True
+
+    def wait_verify_result(self, timeout=30):
+        """Returns the mask of blocks that differ (0 if flash is good), None if there was no result."""
+        start_time = time.time()
+        while time.time() - start_time < timeout:
+            data = self.ser.readline().decode('utf-8').strip()
+            if data:
+                self.logger.info(data)
+
+            if data.startswith("Verify OK"):
+                return 0
+
+            match = re.match(r'Verify FAILED blocks 0x([0-9A-Fa-f]+)', data)
+            if match:
+                return int(match.group(1), 16)
+
+        self.logger.error("Timeout reached while verifying")
+        return None
+
+    def verify(self):
+        # chip checksum is compared first, flash is only read back if that disagrees
+        # blocks that differ are written again instead of starting over
+        try:
+            if not self.send_block_crcs():
+                return False
+
+            if not self.send_command("verify", "Verifying..."):
+                return False
+            blocks = self.wait_verify_result()
+
+            for attempt in range(REPAIR_MAX_ATTEMPTS):
+                if not blocks:
+                    break
+
+                self.logger.warning(f"Blocks 0x{blocks:04X} differ, writing them again")
+                if not self.send_file(blocks):
+                    return False
+
+                if not self.send_command(f"blockverify 0x{blocks:X}", "Verifying blocks..."):
+                    return False
+                blocks = self.wait_verify_result()
+
+            if blocks:
+                self.logger.error(f"Verify failed for blocks 0x{blocks:04X}")
+            return blocks == 0
+        except Exception as e:
+            self.logger.error(f"Error during verify: {e}")
+        return False
+
+    def autoflash(self):
+        try:
+            image = load_hex_image(self.selected_file)
+
+            if self.gang:
+                if not self.send_command("gang", "Gang started"):
+                    return False
+            elif not self.send_command("flashhex", "Autoflash started"):
+                return False
+            print("Supply power to the target now.")
+
+            params = self.wait_binary_mode(timeout=AUTOFLASH_HANDSHAKE_TIMEOUT + 10)
+            if params is None:
+                # the RESULT line saying why has been logged already
+                self.logger.error("Autoflash stopped before programming")
+                return False
+
+            if not self.send_frames(image, *params):
+                return False
+
+            # one line: RESULT status=OK failed=none error=0 handshake_ms=... total_ms=...
+            start_time = time.time()
+            while time.time() - start_time < 60:
+                data = self.ser.readline().decode('utf-8', errors='replace').strip()
+                if data:
+                    self.logger.info(data)
+                if data.startswith("RESULT"):
+                    result = dict(field.split('=', 1) for field in data.split()[1:] if '=' in field)
+                    if self.gang and result.get('status') == 'FAILED' and result.get('passed', '0') != '0':
+                        # flashing the good ones again would not help, the failed targets need looking at
+                        self.logger.error(f"Gang failed for targets {result.get('failed')}, {result.get('passed')} of {result.get('targets')} passed")
+                        self.stop_status = 2
+                        return False
+                    if result.get('status') != 'OK':
+                        self.logger.error(f"Autoflash failed during {result.get('failed')} with error {result.get('error')}")
+                        return False
+                    return True
+
+            self.logger.error("Timeout reached waiting for autoflash result")
+        except Exception as e:
+            self.logger.error(f"Error during autoflash: {e}")
+        return False
+
     def reset_mcu(self):
         try:
             if self.send_command("mcureset", "MCU reset..."):
@@ -272,4 +673,4 @@ class StateMachine:
 
 if __name__ == "__main__":
     state_machine = StateMachine()
-    state_machine.run()
\ No newline at end of file
+    sys.exit(state_machine.run())
\ No newline at end of file
@@ -0,0 +1,185 @@
+/*
+  flashShadow.cpp - copy of target flash kept on the flasher, so bytes just written or read need not go over i2c again
+  Copyright (c) 2023 Jonathan Armstrong.  All right reserved.
+*/
+
+#include "flashShadow.h"
+
+FlashShadow::FlashShadow(void)
+{
+  hits = 0;
+  misses = 0;
+
+  flashInvalidated();
+}
+
+void FlashShadow::flashInvalidated(void)
+{
+  memset(known, 0, sizeof(known));
+  memset(checked, 0, sizeof(checked));
+  dirtyBlocks = 0;
+}
+
+void FlashShadow::flashInvalidated(const unsigned int flashAddress, const unsigned int length)
+{
+  unsigned int index;
+
+  if (length == 0)
+  {
+    return;
+  }
+
+  for (index = flashAddress / BLOCK_SIZE; (index <= (flashAddress + length - 1) / BLOCK_SIZE) && (index < FLASH_BLOCKS); index++)
+  {
+    known[index] = 0;
+    checked[index] = 0;
+    dirtyBlocks &= ~(1 << index);
+  }
+}
+
+void FlashShadow::flashErased(void)
+{
+  unsigned int index;
+
+  memset(image, FLASH_ERASED_VALUE, sizeof(image));
+
+  // erased is what target answered too, as far as the erase completing tells us
+  for (index = 0; index < FLASH_BLOCKS; index++)
+  {
+    known[index] = BLOCK_SIZE;
+    checked[index] = BLOCK_SIZE;
+  }
+
+  dirtyBlocks = 0;
+}
+
+void FlashShadow::flashWritten(const unsigned int flashAddress, const unsigned char* flashbyte, const unsigned int length)
+{
+  unsigned int address;
+  unsigned int index;
+
+  for (index = 0; index < length; index++)
+  {
+    address = flashAddress + index;
+
+    if ((address >= FLASH_SIZE) || ((address % BLOCK_SIZE) >= known[address / BLOCK_SIZE]))
+    {
+      continue;
+    }
+
+    image[address] &= flashbyte[index];
+
+    checked[address / BLOCK_SIZE] = 0;
+    dirtyBlocks |= (1 << (address / BLOCK_SIZE));
+  }
+}
+
+void FlashShadow::flashRead(const unsigned int flashAddress, const unsigned char* flashbyte, const unsigned int length)
+{
+  unsigned int address;
+  unsigned int offset;
+  unsigned int block;
+  unsigned int index;
+
+  for (index = 0; index < length; index++)
+  {
+    address = flashAddress + index;
+
+    if (address >= FLASH_SIZE)
+    {
+      break;
+    }
+
+    block = address / BLOCK_SIZE;
+    offset = address % BLOCK_SIZE;
+
+    // a byte right after the known ones extends them, one further on cannot be kept
+    if (offset > known[block])
+    {
+      continue;
+    }
+
+    if (offset == known[block])
+    {
+      known[block]++;
+    }
+
+    image[address] = flashbyte[index];
+
+    if (offset == checked[block])
+    {
+      checked[block]++;
+
+      if (checked[block] == BLOCK_SIZE)
+      {
+        dirtyBlocks &= ~(1 << block);
+      }
+    }
+  }
+}
+
+bool FlashShadow::fetch(const unsigned int flashAddress, unsigned char* flashbyte, const unsigned int length)
+{
+  unsigned int address;
+  unsigned int index;
+
+  for (index = 0; index < length; index++)
+  {
+    address = flashAddress + index;
+
+    // a dirty block holds what was sent, only target can tell what it took
+    if ((address >= FLASH_SIZE) || ((address % BLOCK_SIZE) >= known[address / BLOCK_SIZE]) || (dirtyBlocks & (1 << (address / BLOCK_SIZE))))
+    {
+      misses += length;
+      return false;
+    }
+  }
+
+  memcpy(flashbyte, &image[flashAddress], length);
+  hits += length;
+
+  return true;
+}
+
+uint16_t FlashShadow::getValidBlocks(void)
+{
+  uint16_t blocks = 0;
+  unsigned int index;
+
+  for (index = 0; index < FLASH_BLOCKS; index++)
+  {
+    if (known[index] == BLOCK_SIZE)
+    {
+      blocks |= (1 << index);
+    }
+  }
+
+  return blocks;
+}
+
+uint16_t FlashShadow::getDirtyBlocks(void)
+{
+  return dirtyBlocks;
+}
+
+unsigned long FlashShadow::getHits(void)
+{
+  return hits;
+}
+
+unsigned long FlashShadow::getMisses(void)
+{
+  return misses;
+}
+
+void FlashShadow::print(Print &out)
+{
+  out.print(F("Shadow: valid=0x"));
+  out.print(getValidBlocks(), HEX);
+  out.print(F(" dirty=0x"));
+  out.print(dirtyBlocks, HEX);
+  out.print(F(" hits="));
+  out.print(hits);
+  out.print(F(" misses="));
+  out.println(misses);
+}
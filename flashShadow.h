@@ -0,0 +1,72 @@
+/*
+  flashShadow.h - copy of target flash kept on the flasher, so bytes just written or read need not go over i2c again
+  Copyright (c) 2023 Jonathan Armstrong.  All right reserved.
+
+  The flasher passes on every erase, read and write (see FlashListener in
+  onbrightFlasher.h). An erase makes every byte known (0xFF). Otherwise bytes
+  become known block by block from the start of a block as reads go through
+  it in order, e.g. readhex or a verify readback. Writes only change bytes
+  already known, the way flash does (bits can only be cleared).
+
+  A block is dirty from the first write into it until it has been read back
+  in full, i.e. its copy is what was written rather than what target answered.
+  fetch() leaves dirty blocks to the bus, so that read back is a real one.
+
+  Power cycle, handshake and reset forget everything, since target may have
+  been changed behind our back, and so does a failed write for its range.
+*/
+
+#ifndef Flash_shadow_h
+#define Flash_shadow_h
+
+#include <Arduino.h>
+
+#include "onbrightFlasher.h"
+
+// a copy of the whole flash does not fit most AVR boards
+#ifndef FLASH_SHADOW
+  #if defined(__AVR__)
+    #define FLASH_SHADOW 0
+  #else
+    #define FLASH_SHADOW 1
+  #endif
+#endif
+
+class FlashShadow : public FlashListener
+{
+  public:
+    FlashShadow(void);
+
+    void flashInvalidated(void);
+    void flashInvalidated(const unsigned int flashAddress, const unsigned int length);
+    void flashErased(void);
+    void flashWritten(const unsigned int flashAddress, const unsigned char* flashbyte, const unsigned int length);
+    void flashRead(const unsigned int flashAddress, const unsigned char* flashbyte, const unsigned int length);
+
+    // copies the range if every byte of it is known and none is in a dirty block, otherwise copies nothing and returns false
+    bool fetch(const unsigned int flashAddress, unsigned char* flashbyte, const unsigned int length);
+
+    // one bit per block
+    uint16_t getValidBlocks(void);
+    uint16_t getDirtyBlocks(void);
+
+    // bytes fetch() served from the copy and bytes it had to leave to the bus
+    unsigned long getHits(void);
+    unsigned long getMisses(void);
+
+    // e.g. "Shadow: valid=0xFFFF dirty=0x3 hits=8192 misses=0"
+    void print(Print &out);
+
+  private:
+    uint8_t image[FLASH_SIZE];
+
+    // bytes known from the start of each block, and of those read back since the last write into it
+    uint16_t known[FLASH_BLOCKS];
+    uint16_t checked[FLASH_BLOCKS];
+    uint16_t dirtyBlocks;
+
+    unsigned long hits;
+    unsigned long misses;
+};
+
+#endif
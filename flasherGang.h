@@ -0,0 +1,616 @@
+/*
+  flasherGang.h - flashes several targets at once, each through its own flasher on its own bus
+  Copyright (c) 2023 Jonathan Armstrong.  All right reserved.
+
+  Every target goes through the same steps as flashhex (handshake, signature,
+  erase, fuse, program, verify, reset) but they take turns: step() does one
+  short piece of work for the next target that has something to do, so one
+  target's erase runs while another one is being handshaked or verified.
+
+  The image is only streamed once. Once every target still working has reached
+  the program phase, each piece of it is written to all of them (write()).
+
+  A target that fails drops out with its own status and the rest carry on, so
+  one bad unit or loose clip does not cost the whole gang.
+
+  Buses of different types (e.g., Wire, Wire1 and a bit banged pair) go into one
+  gang through GangBus, flashers are then all OnbrightFlasher<GangBus>.
+*/
+
+#ifndef Flasher_gang_h
+#define Flasher_gang_h
+
+#include <Arduino.h>
+
+#include "onbrightFlasher.h"
+#include "imageChecksum.h"
+#include "crc16.h"
+
+#ifndef GANG_MAX_TARGETS
+  #define GANG_MAX_TARGETS 4
+#endif
+
+// tight handshake polling per turn, other targets wait meanwhile
+#define GANG_ACQUIRE_SLICE_MICROS 2000
+
+// a target that does not answer by then fails, the others go on without it
+#define GANG_HANDSHAKE_TIMEOUT_MS 30000
+
+// same pause between handshake and chip type as the official programmer
+#define GANG_SETTLE_MS 120
+
+// a piece of the image that fails on one target is written again this many times before it drops out
+#define GANG_WRITE_RETRIES 3
+
+enum { gangIdle,
+       gangHandshake,
+       gangSignature,
+       gangErase,
+       gangFuse,
+       gangProgram,
+       gangVerify,
+       gangReadback,
+       gangReset,
+       gangDone,
+       gangFailed
+};
+
+struct gangTarget_t {
+  uint8_t phase;
+  // where a failed target stopped, and why (Wire style status, 4 for wrong data)
+  uint8_t failedPhase;
+  byte error;
+  unsigned char chipType;
+  unsigned long bytes;
+  uint16_t badBlocks;
+  unsigned long startMillis;
+  unsigned long phaseMillis;
+  unsigned long doneMillis;
+
+  // readback in progress
+  unsigned int readAddress;
+  uint32_t blockSum;
+  uint16_t blockCrc;
+};
+
+// bus type erasure, one virtual call per transaction is nothing next to the transfer itself
+class GangPort
+{
+  public:
+    virtual byte write(const uint8_t address, const uint8_t* data, const uint8_t length) = 0;
+    virtual uint8_t read(const uint8_t address, uint8_t* data, const uint8_t length) = 0;
+    virtual void setTimeoutMillis(const unsigned int timeout) = 0;
+    virtual void setClock(const unsigned long hz) = 0;
+};
+
+template <class Bus>
+class GangPortOf : public GangPort
+{
+  public:
+    GangPortOf(const Bus &i2c) : bus(i2c)
+    {
+    }
+
+    byte write(const uint8_t address, const uint8_t* data, const uint8_t length)
+    {
+      return bus.write(address, data, length);
+    }
+
+    uint8_t read(const uint8_t address, uint8_t* data, const uint8_t length)
+    {
+      return bus.read(address, data, length);
+    }
+
+    void setTimeoutMillis(const unsigned int timeout)
+    {
+      bus.setTimeoutMillis(timeout);
+    }
+
+    void setClock(const unsigned long hz)
+    {
+      bus.setClock(hz);
+    }
+
+  private:
+    Bus bus;
+};
+
+// bus policy for any port above, e.g. OnbrightFlasher<GangBus> flasher((GangBus(port)));
+class GangBus
+{
+  public:
+    GangBus(GangPort &i2c) : port(&i2c)
+    {
+    }
+
+    byte write(const uint8_t address, const uint8_t* data, const uint8_t length)
+    {
+      return port->write(address, data, length);
+    }
+
+    uint8_t read(const uint8_t address, uint8_t* data, const uint8_t length)
+    {
+      return port->read(address, data, length);
+    }
+
+    void setTimeoutMillis(const unsigned int timeout)
+    {
+      port->setTimeoutMillis(timeout);
+    }
+
+    void setClock(const unsigned long hz)
+    {
+      port->setClock(hz);
+    }
+
+  private:
+    GangPort *port;
+};
+
+template <class Bus>
+class FlasherGang
+{
+  public:
+    typedef OnbrightFlasher<Bus> Flasher;
+
+    FlasherGang(void);
+
+    // targets are numbered in the order they are added, false once the gang is full
+    bool add(Flasher &flasher);
+    uint8_t size(void);
+    Flasher &flasher(const uint8_t index);
+    const gangTarget_t &target(const uint8_t index);
+    static const char *phaseName(const uint8_t phase);
+
+    // every target starts over at the handshake, polling every pollMicros
+    void start(const unsigned char fuseAddress, const unsigned char fuseValue, const unsigned long pollMicros);
+
+    // one piece of work for the next target that has something to do
+    // false if none had, e.g. every target waits for image data or is finished
+    bool step(void);
+
+    // every target still working waits for image data (or none is left)
+    bool ready(void);
+    uint8_t working(void);
+
+    // writes a piece of the image to every target in the program phase
+    void write(const unsigned int flashAddress, unsigned char* data, const uint8_t length);
+
+    // image is complete, targets verify against it (kept until the gang is done)
+    void finish(ImageChecksum &image);
+
+    // every target still working fails, e.g. host stopped sending the image
+    void fail(const byte error);
+
+    bool done(void);
+    uint8_t passed(void);
+
+    // one line per target, e.g.
+    // "GANG target=1 status=FAILED failed=verify error=4 chip_type=0xA bytes=6016 bad_blocks=0x8 ms=1840"
+    void print(Print &out);
+
+  private:
+    void next(gangTarget_t &target, const uint8_t phase);
+    void failTarget(gangTarget_t &target, const byte error);
+    bool stepTarget(Flasher &flasher, gangTarget_t &target);
+    void readbackStep(Flasher &flasher, gangTarget_t &target);
+
+    Flasher *flashers[GANG_MAX_TARGETS];
+    gangTarget_t targets[GANG_MAX_TARGETS];
+    uint8_t count;
+
+    // whose turn it is
+    uint8_t turn;
+
+    unsigned char fuseAddress;
+    unsigned char fuseValue;
+    unsigned long pollMicros;
+    ImageChecksum *image;
+};
+
+static const char *const gangPhaseNames[] = { "idle", "handshake", "signature", "erase", "fuse", "program", "verify", "readback", "reset", "done", "failed" };
+
+template <class Bus>
+FlasherGang<Bus>::FlasherGang(void)
+{
+  count = 0;
+  turn = 0;
+  fuseAddress = 0;
+  fuseValue = 0;
+  pollMicros = 0;
+  image = NULL;
+}
+
+template <class Bus>
+bool FlasherGang<Bus>::add(Flasher &flasher)
+{
+  if (count >= GANG_MAX_TARGETS)
+  {
+    return false;
+  }
+
+  memset(&targets[count], 0, sizeof(targets[count]));
+  flashers[count++] = &flasher;
+
+  return true;
+}
+
+template <class Bus>
+uint8_t FlasherGang<Bus>::size(void)
+{
+  return count;
+}
+
+template <class Bus>
+OnbrightFlasher<Bus> &FlasherGang<Bus>::flasher(const uint8_t index)
+{
+  return *flashers[index];
+}
+
+template <class Bus>
+const gangTarget_t &FlasherGang<Bus>::target(const uint8_t index)
+{
+  return targets[index];
+}
+
+template <class Bus>
+const char *FlasherGang<Bus>::phaseName(const uint8_t phase)
+{
+  return gangPhaseNames[(phase <= gangFailed) ? phase : gangIdle];
+}
+
+template <class Bus>
+void FlasherGang<Bus>::start(const unsigned char address, const unsigned char value, const unsigned long poll)
+{
+  uint8_t index;
+
+  fuseAddress = address;
+  fuseValue = value;
+  pollMicros = poll;
+  image = NULL;
+  turn = 0;
+
+  for (index = 0; index < count; index++)
+  {
+    memset(&targets[index], 0, sizeof(targets[index]));
+    targets[index].startMillis = millis();
+    next(targets[index], gangHandshake);
+
+    flashers[index]->beginAcquire();
+  }
+}
+
+template <class Bus>
+void FlasherGang<Bus>::next(gangTarget_t &target, const uint8_t phase)
+{
+  target.phase = phase;
+  target.phaseMillis = millis();
+
+  if ((phase == gangDone) || (phase == gangFailed))
+  {
+    target.doneMillis = millis();
+  }
+}
+
+template <class Bus>
+void FlasherGang<Bus>::failTarget(gangTarget_t &target, const byte error)
+{
+  target.failedPhase = target.phase;
+  target.error = error;
+  next(target, gangFailed);
+}
+
+template <class Bus>
+bool FlasherGang<Bus>::step(void)
+{
+  uint8_t tries;
+  uint8_t index;
+
+  // round robin, starting after whoever went last
+  for (tries = 0; tries < count; tries++)
+  {
+    index = turn;
+    turn = (turn + 1) % count;
+
+    if (stepTarget(*flashers[index], targets[index]))
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+template <class Bus>
+bool FlasherGang<Bus>::stepTarget(Flasher &flasher, gangTarget_t &target)
+{
+  byte result;
+  unsigned char fuse = 0;
+  uint32_t checksum;
+
+  switch (target.phase)
+  {
+    case gangHandshake:
+      if (flasher.acquireHandshake(pollMicros, GANG_ACQUIRE_SLICE_MICROS))
+      {
+        next(target, gangSignature);
+      } else if (millis() - target.phaseMillis > GANG_HANDSHAKE_TIMEOUT_MS) {
+        failTarget(target, 5);
+      }
+      return true;
+    case gangSignature:
+      if (millis() - target.phaseMillis < GANG_SETTLE_MS)
+      {
+        return false;
+      }
+
+      // a protected chip nacks the read but still reports its type
+      result = flasher.readChipType(target.chipType);
+
+      if (target.chipType != CHIP_TYPE_OB38S003)
+      {
+        failTarget(target, result ? result : 4);
+      } else {
+        next(target, gangErase);
+        flasher.beginErase();
+      }
+      return true;
+    case gangErase:
+      // one poll per turn, the other targets get on with their own work in between
+      if (flasher.pollErase(result))
+      {
+        if (result != 0)
+        {
+          failTarget(target, result);
+        } else {
+          next(target, gangFuse);
+        }
+      }
+      return true;
+    case gangFuse:
+      result = flasher.writeConfigByte(fuseAddress, fuseValue);
+      if (result == 0)
+      {
+        result = flasher.readConfigByte(fuseAddress, fuse);
+      }
+
+      if ((result != 0) || (fuse != fuseValue))
+      {
+        failTarget(target, result ? result : 4);
+      } else {
+        next(target, gangProgram);
+      }
+      return true;
+    case gangVerify:
+      // compare the checksum the chip keeps, read back only if it disagrees
+      result = flasher.readFlashChecksum(checksum);
+
+      if ((result == 0) && ((checksum == image->total(FLASH_ERASED_VALUE)) || (checksum == image->total(0x00))))
+      {
+        next(target, gangReset);
+      } else {
+        target.readAddress = 0;
+        next(target, gangReadback);
+      }
+      return true;
+    case gangReadback:
+      readbackStep(flasher, target);
+      return true;
+    case gangReset:
+      // target never acknowledges a reset
+      flasher.resetMCU();
+      next(target, gangDone);
+      return true;
+  }
+
+  // idle, waiting for image data, done or failed
+  return false;
+}
+
+// one burst of a block by block readback, same checks as blockverify in the sketch
+template <class Bus>
+void FlasherGang<Bus>::readbackStep(Flasher &flasher, gangTarget_t &target)
+{
+  unsigned char buffer[FLASH_BURST_MAX];
+  const uint8_t index = target.readAddress / BLOCK_SIZE;
+  byte result;
+  uint8_t position;
+  bool differs;
+
+  if ((target.readAddress % BLOCK_SIZE) == 0)
+  {
+    target.blockSum = 0;
+    target.blockCrc = CRC16_INIT;
+  }
+
+  // a failed read counts as a difference, whatever the buffer holds
+  result = flasher.readFlashBlock(target.readAddress, buffer, FLASH_BURST_MAX);
+  if (result != 0)
+  {
+    target.badBlocks |= (1 << index);
+  }
+
+  target.blockCrc = crc16_block(target.blockCrc, buffer, FLASH_BURST_MAX);
+  for (position = 0; position < FLASH_BURST_MAX; position++)
+  {
+    target.blockSum += buffer[position];
+  }
+
+  target.readAddress += FLASH_BURST_MAX;
+
+  if ((target.readAddress % BLOCK_SIZE) == 0)
+  {
+    if (image->hasBlockCrc(index))
+    {
+      differs = (target.blockCrc != image->blockCrc(index));
+    } else {
+      differs = (target.blockSum != image->block(index, FLASH_ERASED_VALUE));
+    }
+
+    if (differs)
+    {
+      target.badBlocks |= (1 << index);
+    }
+  }
+
+  if (target.readAddress < FLASH_SIZE)
+  {
+    return;
+  }
+
+  if (target.badBlocks != 0)
+  {
+    failTarget(target, 4);
+  } else {
+    next(target, gangReset);
+  }
+}
+
+template <class Bus>
+bool FlasherGang<Bus>::ready(void)
+{
+  uint8_t index;
+
+  for (index = 0; index < count; index++)
+  {
+    if ((targets[index].phase != gangProgram) && (targets[index].phase != gangDone) && (targets[index].phase != gangFailed))
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+template <class Bus>
+uint8_t FlasherGang<Bus>::working(void)
+{
+  uint8_t index;
+  uint8_t busy = 0;
+
+  for (index = 0; index < count; index++)
+  {
+    if ((targets[index].phase != gangIdle) && (targets[index].phase != gangDone) && (targets[index].phase != gangFailed))
+    {
+      busy++;
+    }
+  }
+
+  return busy;
+}
+
+template <class Bus>
+void FlasherGang<Bus>::write(const unsigned int flashAddress, unsigned char* data, const uint8_t length)
+{
+  uint8_t index;
+  uint8_t retries;
+  byte result;
+
+  for (index = 0; index < count; index++)
+  {
+    if (targets[index].phase != gangProgram)
+    {
+      continue;
+    }
+
+    // same as a host resending a hex line, but only to the target that needs it
+    retries = GANG_WRITE_RETRIES;
+    do {
+      result = flashers[index]->writeFlashBlock(flashAddress, data, length);
+    } while (((result != 0) || (flashers[index]->getWriteErrors() > 0)) && retries--);
+
+    if ((result != 0) || (flashers[index]->getWriteErrors() > 0))
+    {
+      failTarget(targets[index], result ? result : 4);
+    } else {
+      targets[index].bytes += length;
+    }
+  }
+}
+
+template <class Bus>
+void FlasherGang<Bus>::finish(ImageChecksum &checksum)
+{
+  uint8_t index;
+
+  image = &checksum;
+
+  for (index = 0; index < count; index++)
+  {
+    if (targets[index].phase == gangProgram)
+    {
+      next(targets[index], gangVerify);
+    }
+  }
+}
+
+template <class Bus>
+void FlasherGang<Bus>::fail(const byte error)
+{
+  uint8_t index;
+
+  for (index = 0; index < count; index++)
+  {
+    if ((targets[index].phase != gangIdle) && (targets[index].phase != gangDone) && (targets[index].phase != gangFailed))
+    {
+      // an erase in progress is left to finish on its own
+      flashers[index]->abortErase();
+      failTarget(targets[index], error);
+    }
+  }
+}
+
+template <class Bus>
+bool FlasherGang<Bus>::done(void)
+{
+  return working() == 0;
+}
+
+template <class Bus>
+uint8_t FlasherGang<Bus>::passed(void)
+{
+  uint8_t index;
+  uint8_t good = 0;
+
+  for (index = 0; index < count; index++)
+  {
+    if (targets[index].phase == gangDone)
+    {
+      good++;
+    }
+  }
+
+  return good;
+}
+
+template <class Bus>
+void FlasherGang<Bus>::print(Print &out)
+{
+  uint8_t index;
+
+  for (index = 0; index < count; index++)
+  {
+    const gangTarget_t &target = targets[index];
+
+    out.print(F("GANG target="));
+    out.print(index);
+    out.print(F(" status="));
+    out.print((target.phase == gangDone) ? F("OK") : (target.phase == gangFailed) ? F("FAILED") : F("BUSY"));
+    out.print(F(" failed="));
+    out.print(phaseName((target.phase == gangFailed) ? target.failedPhase : gangIdle));
+    out.print(F(" error="));
+    out.print(target.error);
+    out.print(F(" chip_type=0x"));
+    out.print(target.chipType, HEX);
+    out.print(F(" bytes="));
+    out.print(target.bytes);
+    out.print(F(" bad_blocks=0x"));
+    out.print(target.badBlocks, HEX);
+    out.print(F(" first_ack_us="));
+    out.print(flashers[index]->getFirstAckMicros());
+    out.print(F(" ms="));
+    out.println((target.doneMillis ? target.doneMillis : millis()) - target.startMillis);
+  }
+}
+
+#endif
@@ -0,0 +1,176 @@
+/*
+  flasherStats.cpp - transfer counters and latency histograms for each kind of flasher operation
+  Copyright (c) 2023 Jonathan Armstrong.  All right reserved.
+*/
+
+#include "flasherStats.h"
+
+static const char *const operationNames[] = { "handshake", "erase", "config_write", "config_read", "flash_write", "flash_read", "none" };
+
+FlasherStats::FlasherStats(void)
+{
+  current = statsNone;
+  depth = 0;
+  startMicros = 0;
+
+  reset();
+}
+
+void FlasherStats::reset(void)
+{
+  // an operation in progress keeps going, it just lands in the fresh counters
+  memset(operations, 0, sizeof(operations));
+}
+
+void FlasherStats::begin(const uint8_t operation)
+{
+  if (depth++ > 0)
+  {
+    return;
+  }
+
+  current = operation;
+  startMicros = micros();
+}
+
+void FlasherStats::end(void)
+{
+  unsigned long elapsed;
+  unsigned long limit = FLASHER_STATS_FIRST_US;
+  uint8_t bucket = 0;
+
+  if ((depth == 0) || (--depth > 0) || (current >= statsOperations))
+  {
+    return;
+  }
+
+  operationStats_t &stats = operations[current];
+
+  elapsed = micros() - startMicros;
+
+  while ((elapsed >= limit) && (bucket < FLASHER_STATS_BUCKETS - 1))
+  {
+    limit <<= 1;
+    bucket++;
+  }
+
+  stats.calls++;
+  stats.totalMicros += elapsed;
+  if (elapsed > stats.maxMicros)
+  {
+    stats.maxMicros = elapsed;
+  }
+
+  // saturate rather than wrap
+  if (stats.histogram[bucket] < 0xFFFF)
+  {
+    stats.histogram[bucket]++;
+  }
+
+  current = statsNone;
+}
+
+void FlasherStats::written(const byte status, const uint8_t length)
+{
+  if (current >= statsOperations)
+  {
+    return;
+  }
+
+  operationStats_t &stats = operations[current];
+
+  stats.transactions++;
+
+  if (status == 0)
+  {
+    stats.bytes += length;
+  } else if ((status == 2) || (status == 3)) {
+    stats.nacks++;
+  } else if (status == 5) {
+    stats.timeouts++;
+  }
+}
+
+void FlasherStats::received(const uint8_t requested, const uint8_t count)
+{
+  if (current >= statsOperations)
+  {
+    return;
+  }
+
+  operationStats_t &stats = operations[current];
+
+  stats.transactions++;
+  stats.bytes += count;
+
+  if (count < requested)
+  {
+    stats.nacks++;
+  }
+}
+
+void FlasherStats::retry(void)
+{
+  if (current < statsOperations)
+  {
+    operations[current].retries++;
+  }
+}
+
+const operationStats_t &FlasherStats::get(const uint8_t operation)
+{
+  return operations[(operation < statsOperations) ? operation : 0];
+}
+
+const char *FlasherStats::operationName(const uint8_t operation)
+{
+  return operationNames[(operation < statsOperations) ? operation : statsOperations];
+}
+
+void FlasherStats::print(Print &out)
+{
+  uint8_t operation;
+  uint8_t bucket;
+
+  out.print(F("STATS buckets="));
+  out.print(FLASHER_STATS_BUCKETS);
+  out.print(F(" first_us="));
+  out.println(FLASHER_STATS_FIRST_US);
+
+  // every operation is listed, even if unused, so lines are the same from run to run
+  for (operation = 0; operation < statsOperations; operation++)
+  {
+    const operationStats_t &stats = operations[operation];
+
+    out.print(F("STATS op="));
+    out.print(operationNames[operation]);
+    out.print(F(" calls="));
+    out.print(stats.calls);
+    out.print(F(" tx="));
+    out.print(stats.transactions);
+    out.print(F(" bytes="));
+    out.print(stats.bytes);
+    out.print(F(" nacks="));
+    out.print(stats.nacks);
+    out.print(F(" timeouts="));
+    out.print(stats.timeouts);
+    out.print(F(" retries="));
+    out.print(stats.retries);
+    out.print(F(" total_us="));
+    out.print(stats.totalMicros);
+    out.print(F(" max_us="));
+    out.print(stats.maxMicros);
+    out.print(F(" hist="));
+
+    for (bucket = 0; bucket < FLASHER_STATS_BUCKETS; bucket++)
+    {
+      if (bucket > 0)
+      {
+        out.print(F(","));
+      }
+      out.print(stats.histogram[bucket]);
+    }
+
+    out.println();
+  }
+}
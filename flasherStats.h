@@ -0,0 +1,84 @@
+/*
+  flasherStats.h - transfer counters and latency histograms for each kind of flasher operation
+  Copyright (c) 2023 Jonathan Armstrong.  All right reserved.
+
+  OnbrightFlasher marks where each public operation starts and ends and
+  reports every i2c transfer in between. An operation called from inside
+  another one (e.g., readFlashByte() from readFlashBlock()) counts towards
+  the outer one, so every call is timed exactly once.
+
+  Latency of a call goes into a bucket: the first one holds calls shorter
+  than FLASHER_STATS_FIRST_US, every following one is twice as wide and the
+  last one takes everything longer.
+*/
+
+#ifndef Flasher_stats_h
+#define Flasher_stats_h
+
+#include <Arduino.h>
+
+#ifndef FLASHER_STATS_BUCKETS
+  #define FLASHER_STATS_BUCKETS 12
+#endif
+
+// with 12 buckets the last one starts at 32768 us, a transfer held by clock stretching during an erase lands near there
+#define FLASHER_STATS_FIRST_US 32
+
+enum { statsHandshake,
+       statsErase,
+       statsConfigWrite,
+       statsConfigRead,
+       statsFlashWrite,
+       statsFlashRead,
+       statsOperations
+};
+
+// transfers outside the operations above (e.g., resetMCU()) are not counted
+#define statsNone statsOperations
+
+struct operationStats_t {
+  unsigned long calls;
+  unsigned long transactions;
+  unsigned long bytes;
+  unsigned long nacks;
+  unsigned long timeouts;
+  unsigned long retries;
+  unsigned long totalMicros;
+  unsigned long maxMicros;
+  uint16_t histogram[FLASHER_STATS_BUCKETS];
+};
+
+class FlasherStats
+{
+  public:
+    FlasherStats(void);
+
+    void reset(void);
+
+    // flasher side
+    void begin(const uint8_t operation);
+    void end(void);
+    // a Wire style status for writes, bytes received for reads (short read counts as a nack)
+    void written(const byte status, const uint8_t length);
+    void received(const uint8_t requested, const uint8_t count);
+    // same transfer sent again after a failure or a busy target
+    void retry(void);
+
+    const operationStats_t &get(const uint8_t operation);
+
+    static const char *operationName(const uint8_t operation);
+
+    // "STATS buckets=12 first_us=32" then one line per operation, e.g.
+    // "STATS op=erase calls=275 tx=275 bytes=1 nacks=273 timeouts=0 retries=0 total_us=30340 max_us=200 hist=0,0,274,1,0,0,0,0,0,0,0,0"
+    // (an erase is the command plus one call per poll until target answers again)
+    void print(Print &out);
+
+  private:
+    operationStats_t operations[statsOperations];
+
+    uint8_t current;
+    uint8_t depth;
+    unsigned long startMicros;
+};
+
+#endif
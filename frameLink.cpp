@@ -0,0 +1,184 @@
+/*
+  frameLink.cpp - framed binary upload over serial
+  Copyright (c) 2023 Jonathan Armstrong.  All right reserved.
+*/
+
+#include "frameLink.h"
+#include "crc16.h"
+
+FrameLink::FrameLink(Stream &io)
+{
+  S = &io;
+  begin();
+}
+
+void FrameLink::begin(void)
+{
+  index = 0;
+  crc = CRC16_INIT;
+  receivedCrc = 0;
+  inFrame = false;
+  lastByteTime = millis();
+
+  expectedSeq = 0;
+  nakPending = false;
+
+  ackedSeq = 0;
+  anyAcked = false;
+
+  frameCount = 0;
+  retryCount = 0;
+}
+
+void FrameLink::reply(const uint8_t code, const uint8_t seq, const uint8_t status)
+{
+  S->write(REPLY_SYNC);
+  S->write(code);
+  S->write(seq);
+  S->write(status);
+}
+
+void FrameLink::ack(const frame_t &frame, const uint8_t status)
+{
+  ack(frame.seq, status);
+}
+
+void FrameLink::nak(const frame_t &frame, const uint8_t status)
+{
+  nak(frame.seq, status);
+}
+
+void FrameLink::ack(const uint8_t seq, const uint8_t status)
+{
+  reply(FRAME_ACK, seq, status);
+
+  ackedSeq = seq;
+  anyAcked = true;
+}
+
+void FrameLink::nak(const uint8_t seq, const uint8_t status)
+{
+  reply(FRAME_NAK, seq, status);
+
+  // accept this frame again, and drop whatever follows until it arrives
+  expectedSeq = seq;
+  nakPending = true;
+  retryCount++;
+}
+
+// a frame with a good crc has arrived, decide what to do with it
+bool FrameLink::complete(frame_t &frame)
+{
+  const uint8_t seq = header[1];
+  const uint8_t distance = seq - expectedSeq;
+
+  if (receivedCrc != crc)
+  {
+    // only one NAK per gap, frames still in flight behind it are dropped quietly
+    if (!nakPending)
+    {
+      reply(FRAME_NAK, expectedSeq, FRAME_STATUS_BAD_CRC);
+      nakPending = true;
+      retryCount++;
+    }
+    return false;
+  }
+
+  if (distance == 0)
+  {
+    frame.type = header[0];
+    frame.seq = seq;
+    frame.len = header[2];
+    frame.address = (header[3] << 8) | header[4];
+
+    expectedSeq++;
+    frameCount++;
+    nakPending = false;
+    return true;
+  }
+
+  // behind us, host resent something we already have because our ACK got lost or is still to come
+  if (distance >= 128)
+  {
+    if (anyAcked)
+    {
+      reply(FRAME_ACK, ackedSeq, FRAME_STATUS_OK);
+    }
+    return false;
+  }
+
+  // ahead of us, a frame went missing
+  if (!nakPending)
+  {
+    reply(FRAME_NAK, expectedSeq, FRAME_STATUS_BAD_SEQUENCE);
+    nakPending = true;
+    retryCount++;
+  }
+
+  return false;
+}
+
+bool FrameLink::poll(frame_t &frame)
+{
+  int c;
+
+  // give up on a frame that stopped part way, host will time out and resend it
+  if (inFrame && (millis() - lastByteTime > FRAME_TIMEOUT_MS))
+  {
+    inFrame = false;
+  }
+
+  while ((c = S->read()) >= 0)
+  {
+    lastByteTime = millis();
+
+    if (!inFrame)
+    {
+      // anything between frames (e.g., line ending after the command) is skipped
+      if (c == FRAME_SYNC)
+      {
+        inFrame = true;
+        index = 0;
+        crc = CRC16_INIT;
+      }
+      continue;
+    }
+
+    if (index < FRAME_HEADER_SIZE)
+    {
+      header[index] = c;
+      crc = crc16_update(crc, c);
+
+      if ((index == 2) && (header[2] > FRAME_PAYLOAD_MAX))
+      {
+        inFrame = false;
+
+        if (!nakPending)
+        {
+          reply(FRAME_NAK, expectedSeq, FRAME_STATUS_TOO_LONG);
+          nakPending = true;
+          retryCount++;
+        }
+        continue;
+      }
+    } else if (index < FRAME_HEADER_SIZE + header[2]) {
+      frame.payload[index - FRAME_HEADER_SIZE] = c;
+      crc = crc16_update(crc, c);
+    } else if (index == FRAME_HEADER_SIZE + header[2]) {
+      receivedCrc = c << 8;
+    } else {
+      receivedCrc |= c;
+      inFrame = false;
+
+      if (complete(frame))
+      {
+        return true;
+      }
+      continue;
+    }
+
+    index++;
+  }
+
+  return false;
+}
@@ -0,0 +1,115 @@
+/*
+  frameLink.h - framed binary upload over serial
+  Copyright (c) 2023 Jonathan Armstrong.  All right reserved.
+
+  Host to flasher frame:
+    0xA5 | type | seq | len | address high | address low | payload (len bytes) | crc high | crc low
+  crc is CRC-16/CCITT-FALSE over type through payload.
+
+  Flasher to host reply:
+    0x5A | ACK (0x06) or NAK (0x15) | seq | status
+
+  An ACK means frame seq and every frame before it have been handled.
+  A NAK carries the sequence number the flasher expects next; the host resends from there (go back N).
+  Frames after a NAK are dropped silently until the expected one arrives.
+  Repeated frames that were already acknowledged are acknowledged again but not reprocessed.
+
+  Frames may be accepted (poll) well before they are answered (ack/nak), e.g. while
+  earlier frames are still being written. A NAK rewinds to that frame, so anything
+  accepted after it has to be discarded by the caller.
+*/
+
+#ifndef Frame_link_h
+#define Frame_link_h
+
+#include <Arduino.h>
+
+#define FRAME_SYNC 0xA5
+#define REPLY_SYNC 0x5A
+
+#define FRAME_HEADER_SIZE 5
+
+// largest payload in one frame, also the largest hex record the line parser takes
+// same as an intel hex record, boards short of RAM may build with less (host is told at "binary")
+#ifndef FRAME_PAYLOAD_MAX
+  #if defined(__AVR__)
+    // a whole frame fits the 64 byte serial receive buffer, and the pipeline slots and line buffer stay small
+    #define FRAME_PAYLOAD_MAX 32
+  #else
+    #define FRAME_PAYLOAD_MAX 255
+  #endif
+#endif
+
+// drop a partial frame when no byte has arrived for this long
+#define FRAME_TIMEOUT_MS 200
+
+// frame types
+#define FRAME_TYPE_DATA 0x00
+#define FRAME_TYPE_END  0x01
+
+// reply codes
+#define FRAME_ACK 0x06
+#define FRAME_NAK 0x15
+
+// reply status
+#define FRAME_STATUS_OK           0
+#define FRAME_STATUS_BAD_CRC      1
+#define FRAME_STATUS_BAD_SEQUENCE 2
+#define FRAME_STATUS_WRITE_FAILED 3
+#define FRAME_STATUS_TOO_LONG     4
+#define FRAME_STATUS_BAD_TYPE     5
+
+struct frame_t {
+  uint8_t  type;
+  uint8_t  seq;
+  uint8_t  len;
+  uint16_t address;
+  uint8_t  payload[FRAME_PAYLOAD_MAX];
+};
+
+class FrameLink
+{
+  public:
+    FrameLink(Stream &io);
+
+    // start a new upload, first frame is expected to carry sequence number zero
+    void begin(void);
+
+    // non-blocking, consumes whatever serial bytes are available
+    // returns true once a complete, valid, in sequence frame has been received into frame
+    bool poll(frame_t &frame);
+
+    // reply to a frame returned by poll(), in the order they were received
+    // a NAK asks host to send that frame and everything after it again
+    void ack(const frame_t &frame, const uint8_t status);
+    void nak(const frame_t &frame, const uint8_t status);
+    // same by sequence number, for frames whose slot has been reused since
+    void ack(const uint8_t seq, const uint8_t status);
+    void nak(const uint8_t seq, const uint8_t status);
+
+    // frames accepted and frames that had to be resent (bad crc, lost, or failed writes)
+    unsigned int frameCount;
+    unsigned int retryCount;
+
+  private:
+    void reply(const uint8_t code, const uint8_t seq, const uint8_t status);
+    bool complete(frame_t &frame);
+
+    Stream *S;
+
+    uint8_t header[FRAME_HEADER_SIZE];
+    uint16_t index;
+    uint16_t crc;
+    uint16_t receivedCrc;
+    bool inFrame;
+    unsigned long lastByteTime;
+
+    uint8_t expectedSeq;
+    bool nakPending;
+
+    // only sequence numbers actually acknowledged are repeated to the host
+    uint8_t ackedSeq;
+    bool anyAcked;
+};
+
+#endif
@@ -0,0 +1,119 @@
+/*
+  Arduino.h - minimal host (Linux) stand-in for the Arduino core
+  Only what the flasher sources actually use is provided here.
+  Time is virtual and is advanced by delay() and by the simulated i2c target,
+  so benchmark numbers are repeatable from run to run.
+*/
+
+#ifndef Host_arduino_h
+#define Host_arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+// no separate program memory on the host
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define F(string_literal) (string_literal)
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define LOW    0
+#define HIGH   1
+#define INPUT  0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+// pretend there is an LED so the sketch builds without a warning
+#define LED_BUILTIN 2
+
+// virtual clock
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield(void);
+
+// used by the simulator to account for time spent on the bus
+void hostAdvanceMicros(unsigned long us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+class Print
+{
+  public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    size_t write(const char *str) { return write((const uint8_t *) str, strlen(str)); }
+
+    size_t print(const char *str);
+    size_t print(char c);
+    size_t print(unsigned char value, int base = DEC);
+    size_t print(int value, int base = DEC);
+    size_t print(unsigned int value, int base = DEC);
+    size_t print(long value, int base = DEC);
+    size_t print(unsigned long value, int base = DEC);
+    size_t print(double value, int digits = 2);
+
+    size_t println(void);
+    size_t println(const char *str);
+    size_t println(char c);
+    size_t println(unsigned char value, int base = DEC);
+    size_t println(int value, int base = DEC);
+    size_t println(unsigned int value, int base = DEC);
+    size_t println(long value, int base = DEC);
+    size_t println(unsigned long value, int base = DEC);
+    size_t println(double value, int digits = 2);
+
+  private:
+    size_t printNumber(unsigned long value, int base);
+};
+
+class Stream : public Print
+{
+  public:
+    virtual int available(void) = 0;
+    virtual int read(void) = 0;
+    virtual int peek(void) = 0;
+    virtual void flush(void) {}
+};
+
+// stdin/stdout backed serial port
+class HardwareSerial : public Stream
+{
+  public:
+    void begin(unsigned long baud);
+    operator bool() { return true; }
+
+    int available(void);
+    int read(void);
+    int peek(void);
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+
+    // host only, true once stdin has been closed
+    bool eof(void) const { return endOfInput; }
+
+  private:
+    int peeked = -1;
+    bool endOfInput = false;
+};
+
+extern HardwareSerial Serial;
+
+#endif
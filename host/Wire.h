@@ -0,0 +1,69 @@
+/*
+  Wire.h - host stand-in for the Arduino Wire library
+  Transactions are handed to a simulated target instead of real hardware.
+*/
+
+#ifndef Host_wire_h
+#define Host_wire_h
+
+#include <Arduino.h>
+
+#define BUFFER_LENGTH 128
+
+class Ob38s003Sim;
+
+class TwoWire : public Stream
+{
+  public:
+    TwoWire(void);
+
+    // connect this bus to a simulated target (nothing attached means every address nacks)
+    void attach(Ob38s003Sim *simTarget) { target = simTarget; }
+
+    void begin(void) {}
+    void begin(int sda, int scl) { (void) sda; (void) scl; }
+    void setClock(uint32_t hz) { clockHz = hz; }
+    uint32_t getClock(void) const { return clockHz; }
+    void setTimeout(uint16_t ms) { timeoutMicros = ms * 1000UL; }
+
+    void beginTransmission(uint8_t address);
+    void beginTransmission(int address) { beginTransmission((uint8_t) address); }
+    uint8_t endTransmission(bool sendStop = true);
+
+    uint8_t requestFrom(uint8_t address, uint8_t quantity);
+    uint8_t requestFrom(int address, int quantity) { return requestFrom((uint8_t) address, (uint8_t) quantity); }
+
+    size_t write(uint8_t data);
+    size_t write(const uint8_t *data, size_t quantity);
+    using Print::write;
+
+    // same convenience overloads as the real library so write(0) is not ambiguous
+    size_t write(int data) { return write((uint8_t) data); }
+    size_t write(unsigned int data) { return write((uint8_t) data); }
+    size_t write(long data) { return write((uint8_t) data); }
+    size_t write(unsigned long data) { return write((uint8_t) data); }
+
+    int available(void);
+    int read(void);
+    int peek(void);
+
+  private:
+    Ob38s003Sim *target;
+    uint32_t clockHz;
+    unsigned long timeoutMicros;
+
+    uint8_t txAddress;
+    uint8_t txBuffer[BUFFER_LENGTH];
+    size_t txLength;
+
+    uint8_t rxBuffer[BUFFER_LENGTH];
+    size_t rxLength;
+    size_t rxIndex;
+};
+
+extern TwoWire Wire;
+
+// second bus, e.g. for the second target of a gang
+extern TwoWire Wire1;
+
+#endif
@@ -0,0 +1,676 @@
+/*
+  benchFlasher.cpp - runs a complete flash cycle against the simulated target
+  and reports time, throughput and bus transaction counts for each phase
+*/
+
+#include <Arduino.h>
+#include <Wire.h>
+
+#include "onbrightFlasher.h"
+#include "wireBus.h"
+#include "ihx.h"
+#include "ob38s003Sim.h"
+#include "simBus.h"
+#include "bitBangBus.h"
+#include "mockGpio.h"
+#include "clockRate.h"
+#include "traceRecorder.h"
+#include "flasherGang.h"
+#include "imageChecksum.h"
+
+#define BENCH_FLASH_SIZE FLASH_SIZE
+
+static Ob38s003Sim target;
+
+// only consulted when the bus is wrapped with --adaptive, phases are set either way
+static ClockRateController benchRate;
+
+// only recording with --trace, the default Wire bus always goes through it
+static TraceRecorder benchTrace;
+
+// flasher statistics and traces print through the Arduino Print interface, same lines as the sketch's commands
+class FilePrint : public Print
+{
+  public:
+    FilePrint(FILE *output) : file(output)
+    {
+    }
+
+    using Print::write;
+
+    size_t write(uint8_t c)
+    {
+      // println() ends lines with \r\n, keep the bench output plain
+      return (c == '\r') ? 1 : fwrite(&c, 1, 1, file);
+    }
+
+  private:
+    FILE *file;
+};
+
+static FilePrint benchOut(stdout);
+
+static uint8_t image[BENCH_FLASH_SIZE];
+static unsigned char readback[BENCH_FLASH_SIZE];
+
+struct benchPhase
+{
+  unsigned long startMicros;
+};
+
+struct benchOptions
+{
+  const char *hexPath;
+  bool readAll;
+  bool burst;
+  bool skipErased;
+  unsigned long dataBytes;
+  unsigned int units;
+  unsigned int gang;
+  bool gangMix;
+};
+
+static void usage(void)
+{
+  printf("usage: benchFlasher [--hex=file] [--clock=hz] [--no-read] [--no-burst] [--no-skip] [--bus=wire|sim|bitbang] [--vcd=file] [--trace=file] [--adaptive] [--units=n] [--gang=n] [--gang-mix] [simulated target options]\n");
+  ob38s003SimUsage();
+}
+
+// clock changes made by the adaptive controller since the last call
+static void printDecisions(void)
+{
+  rateDecision_t decision;
+
+  while (benchRate.takeDecision(decision))
+  {
+    printf("clock unit=%u phase=%s from_hz=%lu to_hz=%lu errors=%u transfers=%u\n", decision.unit,
+           ClockRateController::phaseName(decision.phase), decision.fromHz, decision.toHz, decision.errors, decision.transfers);
+  }
+}
+
+static void startPhase(benchPhase &phase)
+{
+  target.resetCounters();
+  phase.startMicros = micros();
+}
+
+// one line per phase so runs can be diffed or parsed by scripts
+static void endPhase(const benchPhase &phase, const char *name, const unsigned long payloadBytes, const unsigned int errors)
+{
+  const unsigned long elapsed = micros() - phase.startMicros;
+  const double rate = elapsed ? payloadBytes * 1000000.0 / elapsed : 0.0;
+
+  printf("phase=%-9s bytes=%-5lu us=%-9lu tx=%-6lu bus_bytes=%-6lu nacks=%-4lu timeouts=%-3lu errors=%-4u bytes_per_sec=%.1f\n",
+         name, payloadBytes, elapsed, target.counters.transactions, target.counters.bytes,
+         target.counters.nacks, target.counters.timeouts, errors, rate);
+
+  printDecisions();
+}
+
+// whole file in memory, records are then decoded where they lie by ihx_scan()
+static uint8_t *readFile(const char *path, size_t &size)
+{
+  FILE *file = fopen(path, "rb");
+  uint8_t *text;
+  long length;
+
+  if (file == NULL)
+  {
+    perror(path);
+    return NULL;
+  }
+
+  fseek(file, 0, SEEK_END);
+  length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  text = (uint8_t *) malloc(length + 1);
+  size = fread(text, 1, length, file);
+  fclose(file);
+
+  return text;
+}
+
+// every record of the image through callback, false if the file could not be read or a record is bad
+static bool scanHex(const char *path, ihx_callback_t callback, void *context, unsigned int &records)
+{
+  ihx_scan_t scan;
+  size_t size;
+  uint8_t *text = readFile(path, size);
+  uint8_t err;
+
+  if (text == NULL)
+  {
+    return false;
+  }
+
+  ihx_scan_begin(&scan);
+  err = ihx_scan(&scan, text, size, 1, callback, context);
+  free(text);
+
+  records = scan.records;
+
+  if (err != IHX_SUCCESS)
+  {
+    fprintf(stderr, "%s: bad record %u at offset %lu\n", path, scan.records, (unsigned long) scan.offset);
+    return false;
+  }
+
+  return true;
+}
+
+struct loadContext
+{
+  const char *path;
+  unsigned long dataBytes;
+};
+
+static uint8_t loadRecord(void *context, const ihx_t *h, uint32_t address)
+{
+  loadContext &load = *(loadContext *) context;
+
+  if (h->record_type != IHX_RT_DATA)
+  {
+    return 0;
+  }
+
+  if (address + h->len > BENCH_FLASH_SIZE)
+  {
+    fprintf(stderr, "%s: record at 0x%04lx outside target flash\n", load.path, (unsigned long) address);
+    return 1;
+  }
+
+  memcpy(&image[address], h->data, h->len);
+  load.dataBytes += h->len;
+
+  return 0;
+}
+
+// copies data records into the image
+static int loadHex(const char *path, unsigned long &dataBytes, unsigned int &records)
+{
+  loadContext load = { path, 0 };
+
+  memset(image, 0xff, sizeof(image));
+
+  if (!scanHex(path, loadRecord, &load, records))
+  {
+    return -1;
+  }
+
+  dataBytes = load.dataBytes;
+
+  return 0;
+}
+
+template <class Flasher>
+struct programContext
+{
+  Flasher *flasher;
+  unsigned int errors;
+};
+
+// same retry policy as rf_decode_and_write() in the sketch
+template <class Flasher>
+static uint8_t programRecord(void *context, const ihx_t *h, uint32_t address)
+{
+  programContext<Flasher> &program = *(programContext<Flasher> *) context;
+  int retries = 5;
+  byte err;
+
+  if (h->record_type != IHX_RT_DATA)
+  {
+    return 0;
+  }
+
+  do {
+    err = program.flasher->writeFlashBlock(address, (unsigned char *) h->data, h->len);
+  } while (err > 0 && retries--);
+
+  if (err > 0)
+  {
+    program.errors++;
+  }
+
+  return 0;
+}
+
+template <class Flasher>
+static unsigned int programHex(Flasher &flasher, const char *path)
+{
+  programContext<Flasher> program = { &flasher, 0 };
+  unsigned int records;
+
+  scanHex(path, programRecord<Flasher>, &program, records);
+
+  return program.errors;
+}
+
+// where each phase of the adaptive controller ended up
+static void printClocks(void)
+{
+  uint8_t index;
+
+  printf("clocks");
+  for (index = ratePhaseHandshake; index < ratePhaseCount; index++)
+  {
+    printf(" %s_hz=%lu", ClockRateController::phaseName(index), benchRate.phaseClock(index));
+  }
+  printf("\n");
+}
+
+// units flashed one after another on the same fixture, as a production station would
+template <class Flasher>
+static int runUnits(Flasher &flasher, const benchOptions &options)
+{
+  unsigned int unit;
+  int result = 0;
+
+  for (unit = 0; unit < options.units; unit++)
+  {
+    if (options.units > 1)
+    {
+      printf("unit=%u\n", unit + 1);
+    }
+
+    target.powerOff();
+    result |= runBench(flasher, options);
+  }
+
+  // totals over every unit
+  flasher.getStats().print(benchOut);
+
+  return result;
+}
+
+// every phase of a flash cycle, for any bus policy
+template <class Flasher>
+static int runBench(Flasher &flasher, const benchOptions &options)
+{
+  unsigned int attempts;
+  unsigned int errors;
+  unsigned char chipType = 0;
+  unsigned char fuse = 0;
+  uint32_t checksum;
+  benchPhase phase;
+  int index;
+
+  flasher.setBurstRead(options.burst);
+  flasher.setBurstWrite(options.burst);
+  flasher.setSkipErased(options.skipErased);
+
+  // power up and poll like the handshake state in the sketch does
+  startPhase(phase);
+  benchRate.setPhase(ratePhaseHandshake);
+  target.powerOn();
+  for (attempts = 1; attempts <= 100; attempts++)
+  {
+    if (flasher.onbrightHandshake())
+    {
+      break;
+    }
+  }
+  endPhase(phase, "handshake", 0, target.isConnected() ? 0 : 1);
+
+  if (!target.isConnected())
+  {
+    printf("handshake failed after %u attempts\n", attempts);
+    return 1;
+  }
+
+  benchRate.newUnit();
+
+  startPhase(phase);
+  benchRate.setPhase(ratePhaseNone);
+  errors = flasher.readChipType(chipType) ? 1 : 0;
+  endPhase(phase, "signature", 1, errors);
+
+  startPhase(phase);
+  benchRate.setPhase(ratePhaseErase);
+  errors = flasher.eraseChip() ? 1 : 0;
+  endPhase(phase, "erase", 0, errors);
+
+  startPhase(phase);
+  benchRate.setPhase(ratePhaseProgram);
+  errors = flasher.writeConfigByte(18, 249) ? 1 : 0;
+  errors += flasher.readConfigByte(18, fuse) ? 1 : 0;
+  errors += (fuse != 249) ? 1 : 0;
+  endPhase(phase, "setfuse", 1, errors);
+
+  startPhase(phase);
+  errors = programHex(flasher, options.hexPath);
+  endPhase(phase, "program", options.dataBytes, errors);
+
+  printf("burst_write=%s\n", flasher.getBurstWriteMode() == burstSupported ? "supported" :
+                             flasher.getBurstWriteMode() == burstUnsupported ? "unsupported" : "unknown");
+  // quick verify against the chip checksum bytes, compare with the read phase below
+  startPhase(phase);
+  benchRate.setPhase(ratePhaseRead);
+  errors = flasher.readFlashChecksum(checksum) ? 1 : 0;
+  for (index = 0; index < BENCH_FLASH_SIZE; index++)
+  {
+    checksum -= image[index];
+  }
+  errors += checksum ? 1 : 0;
+  endPhase(phase, "verify", 4, errors);
+
+  printf("skipped_bytes=%lu untouched_blocks=%u\n", flasher.getSkippedBytes(), flasher.getUntouchedBlocks());
+  printf("erase_busy_us=%lu write_busy_us=%lu busy_polls=%lu\n", flasher.getEraseBusyMicros(), flasher.getWriteBusyMicros(), flasher.getBusyPolls());
+
+  if (options.readAll)
+  {
+    startPhase(phase);
+    flasher.readFlashBlock(0, readback, BENCH_FLASH_SIZE);
+
+    errors = 0;
+    for (index = 0; index < BENCH_FLASH_SIZE; index++)
+    {
+      if (readback[index] != image[index])
+      {
+        errors++;
+      }
+    }
+    endPhase(phase, "read", BENCH_FLASH_SIZE, errors);
+
+    printf("burst_read=%s\n", flasher.getBurstReadMode() == burstSupported ? "supported" :
+                              flasher.getBurstReadMode() == burstUnsupported ? "unsupported" : "unknown");
+  }
+
+  printClocks();
+
+  // compare what the target really holds, independent of the flasher read path
+  errors = memcmp(target.flash, image, sizeof(image)) ? 1 : 0;
+  printf("result=%s chip_type=0x%02x\n", errors ? "MISMATCH" : "OK", chipType);
+
+  return errors ? 1 : 0;
+}
+
+struct gangContext
+{
+  FlasherGang<GangBus> *gang;
+  ImageChecksum *checksum;
+};
+
+// every data record of the image in turn is handed to the whole gang
+static uint8_t gangRecord(void *context, const ihx_t *h, uint32_t address)
+{
+  gangContext &program = *(gangContext *) context;
+
+  if (h->record_type == IHX_RT_DATA)
+  {
+    program.gang->write(address, (unsigned char *) h->data, h->len);
+    program.checksum->add(address, h->data, h->len);
+  }
+
+  return 0;
+}
+
+// fault profiles --gang-mix hands out in turn, the first target keeps the options given on the command line
+static void gangProfile(const unsigned int index, Ob38s003SimConfig &config)
+{
+  switch (index % 4)
+  {
+    case 1:
+      config.nackRate = 0.002;
+      break;
+    case 2:
+      // acknowledged but not programmed, only verify finds it
+      config.dropRate = 0.002;
+      break;
+    case 3:
+      config.busyNack = true;
+      config.programBusyMicros = 40;
+      break;
+  }
+}
+
+// several targets on their own buses flashed together by FlasherGang, as a gang programmer would
+// each target is switched on a little later than the one before, as a person plugging them in would
+static int runGang(const benchOptions &options)
+{
+  const unsigned int count = (options.gang < GANG_MAX_TARGETS) ? options.gang : GANG_MAX_TARGETS;
+  Ob38s003Sim *targets[GANG_MAX_TARGETS];
+  SimBus *buses[GANG_MAX_TARGETS];
+  GangPortOf<SimBus> *ports[GANG_MAX_TARGETS];
+  OnbrightFlasher<GangBus> *flashers[GANG_MAX_TARGETS];
+  FlasherGang<GangBus> gang;
+  ImageChecksum checksum;
+  unsigned long startMicros;
+  unsigned long elapsed;
+  unsigned long steps = 0;
+  unsigned int index;
+  int result = 0;
+
+  for (index = 0; index < count; index++)
+  {
+    Ob38s003SimConfig config = target.config;
+
+    config.seed = target.config.seed + index;
+    config.autoPowerOn = true;
+    config.powerOnDelayMicros = target.config.powerOnDelayMicros + index * 15000UL;
+    if (options.gangMix)
+    {
+      gangProfile(index, config);
+    }
+
+    targets[index] = new Ob38s003Sim(config);
+    buses[index] = new SimBus(*targets[index], Wire.getClock(), 20000);
+    ports[index] = new GangPortOf<SimBus>(*buses[index]);
+    flashers[index] = new OnbrightFlasher<GangBus>(GangBus(*ports[index]));
+
+    flashers[index]->setBurstRead(options.burst);
+    flashers[index]->setBurstWrite(options.burst);
+    flashers[index]->setSkipErased(options.skipErased);
+
+    gang.add(*flashers[index]);
+  }
+
+  printf("gang targets=%u mix=%s\n", count, options.gangMix ? "yes" : "no");
+
+  // nothing to do for a moment (e.g., waiting for the settle time) lets virtual time pass instead
+  startMicros = micros();
+  gang.start(18, 249, 100);
+  while (!gang.ready())
+  {
+    steps++;
+    if (!gang.step())
+    {
+      hostAdvanceMicros(100);
+    }
+  }
+  printf("phase=ready     us=%lu steps=%lu working=%u\n", micros() - startMicros, steps, gang.working());
+
+  gangContext program = { &gang, &checksum };
+  unsigned int records;
+
+  scanHex(options.hexPath, gangRecord, &program, records);
+  printf("phase=program   us=%lu\n", micros() - startMicros);
+
+  gang.finish(checksum);
+  while (!gang.done())
+  {
+    steps++;
+    if (!gang.step())
+    {
+      hostAdvanceMicros(100);
+    }
+  }
+
+  elapsed = micros() - startMicros;
+
+  gang.print(benchOut);
+
+  // a target reported as passed has to really hold the image, one that failed may hold anything
+  for (index = 0; index < count; index++)
+  {
+    const bool matches = (memcmp(targets[index]->flash, image, sizeof(image)) == 0);
+    const bool passed = (gang.target(index).phase == gangDone);
+
+    printf("target=%u flash=%s reported=%s%s\n", index, matches ? "OK" : "MISMATCH", passed ? "OK" : "FAILED",
+           (passed && !matches) ? " WRONG" : "");
+
+    if (passed && !matches)
+    {
+      result = 1;
+    }
+  }
+
+  printf("gang passed=%u targets=%u us=%lu steps=%lu bytes_per_sec=%.1f\n", gang.passed(), count, elapsed, steps,
+         elapsed ? options.dataBytes * (double) gang.passed() * 1000000.0 / elapsed : 0.0);
+
+  return result;
+}
+
+// same lines as the sketch's trace command, for traceReplay
+static int writeTrace(const char *path)
+{
+  FILE *file;
+
+  if (path == NULL)
+  {
+    return 0;
+  }
+
+  file = fopen(path, "w");
+  if (file == NULL)
+  {
+    perror(path);
+    return 1;
+  }
+
+  FilePrint out(file);
+
+  benchTrace.print(out);
+  fclose(file);
+
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  benchOptions options = { "../blink.ihx", true, true, true, 0, 1, 0, false };
+  bool adaptive = false;
+  const char *busName = "wire";
+  const char *vcdPath = NULL;
+  const char *tracePath = NULL;
+  int result;
+  unsigned int records;
+  int index;
+
+  for (index = 1; index < argc; index++)
+  {
+    if (strncmp(argv[index], "--hex=", 6) == 0)
+    {
+      options.hexPath = argv[index] + 6;
+    } else if (strncmp(argv[index], "--clock=", 8) == 0) {
+      Wire.setClock(strtoul(argv[index] + 8, NULL, 0));
+    } else if (strcmp(argv[index], "--no-read") == 0) {
+      options.readAll = false;
+    } else if (strcmp(argv[index], "--no-burst") == 0) {
+      options.burst = false;
+    } else if (strcmp(argv[index], "--no-skip") == 0) {
+      options.skipErased = false;
+    } else if ((strcmp(argv[index], "--bus=wire") == 0) || (strcmp(argv[index], "--bus=sim") == 0) ||
+               (strcmp(argv[index], "--bus=bitbang") == 0)) {
+      busName = argv[index] + 6;
+    } else if (strcmp(argv[index], "--adaptive") == 0) {
+      adaptive = true;
+    } else if (strncmp(argv[index], "--units=", 8) == 0) {
+      options.units = strtoul(argv[index] + 8, NULL, 0);
+    } else if (strncmp(argv[index], "--gang=", 7) == 0) {
+      options.gang = strtoul(argv[index] + 7, NULL, 0);
+    } else if (strcmp(argv[index], "--gang-mix") == 0) {
+      options.gangMix = true;
+    } else if (strncmp(argv[index], "--vcd=", 6) == 0) {
+      vcdPath = argv[index] + 6;
+    } else if (strncmp(argv[index], "--trace=", 8) == 0) {
+      tracePath = argv[index] + 8;
+    } else if (!ob38s003SimOption(argv[index], target.config)) {
+      usage();
+      return 2;
+    }
+  }
+
+  if (loadHex(options.hexPath, options.dataBytes, records) != 0)
+  {
+    return 1;
+  }
+
+  printf("image=%s records=%u data_bytes=%lu clock_hz=%lu bus=%s\n", options.hexPath, records, options.dataBytes,
+         (unsigned long) Wire.getClock(), busName);
+
+  if (options.gang > 0)
+  {
+    return runGang(options);
+  }
+
+  if ((tracePath != NULL) && (strcmp(busName, "wire") != 0))
+  {
+    printf("--trace records the Wire bus only\n");
+    return 2;
+  }
+
+  if (strcmp(busName, "sim") == 0)
+  {
+    // same clock and timeout as the Wire setup below
+    SimBus bus(target, Wire.getClock(), 20000);
+
+    if (adaptive)
+    {
+      OnbrightFlasher<AdaptiveBus<SimBus> > flasher(AdaptiveBus<SimBus>(bus, benchRate));
+
+      return runUnits(flasher, options);
+    }
+
+    OnbrightFlasher<SimBus> flasher(bus);
+
+    return runUnits(flasher, options);
+  }
+
+  if (strcmp(busName, "bitbang") == 0)
+  {
+    // bit level model of the same target, pins are only labels here
+    typedef BitBangBus<PIN_WIRE_SDA, PIN_WIRE_SCL, MockGpio> MockBitBangBus;
+
+    mockI2c.attach(&target, PIN_WIRE_SDA, PIN_WIRE_SCL);
+    mockI2c.record(vcdPath != NULL);
+
+    MockBitBangBus::setClock(Wire.getClock());
+    MockBitBangBus::setTimeoutMillis(20);
+    MockBitBangBus::begin();
+
+    OnbrightFlasher<MockBitBangBus> flasher((MockBitBangBus()));
+
+    result = runUnits(flasher, options);
+
+    printf("starts=%lu stops=%lu line_bytes=%lu stretches=%lu stretch_us=%lu edges=%lu\n", mockI2c.counters.starts,
+           mockI2c.counters.stops, mockI2c.counters.bytes, mockI2c.counters.stretches, mockI2c.counters.stretchMicros,
+           (unsigned long) mockI2c.waveform.size());
+
+    if ((vcdPath != NULL) && !mockI2c.writeVcd(vcdPath))
+    {
+      return 1;
+    }
+
+    return result;
+  }
+
+  Wire.attach(&target);
+  Wire.setTimeout(20);
+  Wire.begin();
+
+  benchTrace.enable(tracePath != NULL);
+
+  if (adaptive)
+  {
+    OnbrightFlasher<AdaptiveBus<TracingBus<DefaultBus> > > flasher(AdaptiveBus<TracingBus<DefaultBus> >(TracingBus<DefaultBus>(DefaultBus(Wire), benchTrace), benchRate));
+
+    result = runUnits(flasher, options);
+  } else {
+    OnbrightFlasher<TracingBus<DefaultBus> > flasher(TracingBus<DefaultBus>(DefaultBus(Wire), benchTrace));
+
+    result = runUnits(flasher, options);
+  }
+
+  return (writeTrace(tracePath) == 0) ? result : 1;
+}
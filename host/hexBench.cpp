@@ -0,0 +1,427 @@
+/*
+  hexBench.cpp - throughput and correctness of the intel hex decoders
+
+  Decodes every record of the given hex files (blink.ihx by default) and of a
+  synthetic image made of random records (--synthetic-kb), with:
+    - legacy_ihx     ihx_decode() as it was, a linear search per nibble
+    - legacy_parser  the line parser's old hexton(), uppercase only
+    - table          ihx_decode() on the shared lookup table
+  and prints MB/s of hex text for each.
+
+  Then fuzzes: records of the corpus with a few characters replaced, flipped
+  in case, dropped or added are decoded by each decoder and compared with a
+  strict reference. The table decoder has to agree with it on every one, the
+  legacy decoders show how many bad records they let through or got wrong.
+  Exits non zero if the table decoder disagrees.
+*/
+
+#include <Arduino.h>
+
+#include <string>
+#include <vector>
+#include <time.h>
+
+#include "ihx.h"
+
+// every decoder gets at least this much wall clock time per corpus
+#define HEX_BENCH_MIN_SECONDS 0.2
+
+// ':' + 255 data bytes + length, address, type and checksum, as text
+#define HEX_RECORD_MAX_CHARS (11 + 255 * 2)
+
+typedef std::vector<std::string> hexCorpus;
+
+// ihx_decode() before the lookup table, including its habit of reading bad digits as 0
+static const char *legacyConv = "0123456789ABCDEFabcdef";
+
+static uint8_t legacyValueOfHex(uint8_t ch)
+{
+  uint8_t i = 0;
+
+  while (legacyConv[i] && ch != legacyConv[i]) i++;
+
+  if (!legacyConv[i]) return 0;
+  if (i >= 16) return i - 6;
+  return i;
+}
+
+static uint8_t legacyIhxDecode(uint8_t *buff, uint16_t slen)
+{
+  if (buff[0] != ':') return IHX_ERROR;
+  while (buff[slen - 1] == '\n' || buff[slen - 1] == '\r') slen--;
+  if (slen < 11 || slen % 2 != 1) return IHX_ERROR;
+
+  uint8_t cs = 0;
+  for (int i = 0; i < (slen - 1) / 2; ++i) {
+    buff[i] = (legacyValueOfHex(buff[2 * i + 1]) << 4) | legacyValueOfHex(buff[2 * i + 2]);
+    cs += buff[i];
+  }
+
+  if (cs) return IHX_ERROR;
+  if (buff[0] * 2 + 11 != slen) return IHX_ERROR;
+
+  return IHX_SUCCESS;
+}
+
+// parserCore::hexton() before the lookup table
+static uint8_t legacyHexton(uint8_t h)
+{
+  if (h >= '0' && h <= '9') return (h - '0');
+  if (h >= 'A' && h <= 'F') return ((h - 'A') + 10);
+  return 0;
+}
+
+// tryihex() with the old hexton(), same checks as ihx_decode() so results compare
+static uint8_t legacyParserDecode(uint8_t *buff, uint16_t slen)
+{
+  uint8_t cs = 0;
+  uint16_t i;
+
+  if (buff[0] != ':' || slen < 11 || slen % 2 != 1) return IHX_ERROR;
+
+  for (i = 0; i < (slen - 1) / 2; i++) {
+    buff[i] = (legacyHexton(buff[2 * i + 1]) << 4) + legacyHexton(buff[2 * i + 2]);
+    cs += buff[i];
+  }
+
+  if (cs) return IHX_ERROR;
+  if (buff[0] * 2 + 11 != slen) return IHX_ERROR;
+
+  return IHX_SUCCESS;
+}
+
+// strict and obviously correct, the yardstick for the fuzzer
+static uint8_t referenceDecode(uint8_t *buff, uint16_t slen)
+{
+  uint8_t decoded[HEX_RECORD_MAX_CHARS / 2];
+  uint8_t cs = 0;
+  uint16_t i;
+
+  if (slen < 11 || slen % 2 != 1 || buff[0] != ':') return IHX_ERROR;
+
+  for (i = 1; i < slen; i++) {
+    if (!isxdigit(buff[i])) return IHX_ERROR;
+  }
+
+  for (i = 0; i < (slen - 1) / 2; i++) {
+    const char pair[3] = { (char) buff[2 * i + 1], (char) buff[2 * i + 2], 0 };
+
+    decoded[i] = strtoul(pair, NULL, 16);
+    cs += decoded[i];
+  }
+
+  if (cs) return IHX_ERROR;
+  if (decoded[0] * 2 + 11 != slen) return IHX_ERROR;
+
+  memcpy(buff, decoded, (slen - 1) / 2);
+
+  return IHX_SUCCESS;
+}
+
+typedef uint8_t (*hexDecoder)(uint8_t *buff, uint16_t slen);
+
+struct namedDecoder
+{
+  const char *name;
+  hexDecoder decode;
+};
+
+static const namedDecoder decoders[] = {
+  { "legacy_ihx", legacyIhxDecode },
+  { "legacy_parser", legacyParserDecode },
+  { "table", ihx_decode },
+};
+
+#define DECODER_COUNT (sizeof(decoders) / sizeof(decoders[0]))
+
+static double seconds(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// one record per line, line endings dropped
+static bool loadCorpus(const char *path, hexCorpus &corpus)
+{
+  FILE *file = fopen(path, "r");
+  char line[HEX_RECORD_MAX_CHARS + 16];
+
+  if (file == NULL)
+  {
+    perror(path);
+    return false;
+  }
+
+  while (fgets(line, sizeof(line), file) != NULL)
+  {
+    size_t length = strcspn(line, "\r\n");
+
+    if ((length > 0) && (line[0] == ':'))
+    {
+      corpus.push_back(std::string(line, length));
+    }
+  }
+
+  fclose(file);
+
+  return true;
+}
+
+static std::string makeRecord(const uint8_t type, const unsigned int address, const uint8_t *data, const uint8_t length, const bool lower)
+{
+  char text[16];
+  std::string record = ":";
+  uint8_t sum = length + (address >> 8) + (address & 0xff) + type;
+  unsigned int index;
+
+  snprintf(text, sizeof(text), lower ? "%02x%04x%02x" : "%02X%04X%02X", length, address & 0xffff, type);
+  record += text;
+
+  for (index = 0; index < length; index++)
+  {
+    snprintf(text, sizeof(text), lower ? "%02x" : "%02X", data[index]);
+    record += text;
+    sum += data[index];
+  }
+
+  snprintf(text, sizeof(text), lower ? "%02x" : "%02X", (uint8_t) -sum);
+  record += text;
+
+  return record;
+}
+
+// random data records of mixed lengths, every fourth one in lowercase as some toolchains write them
+static void makeSynthetic(const unsigned long bytes, hexCorpus &corpus)
+{
+  static const uint8_t lengths[] = { 16, 32, 64, 255 };
+  uint8_t data[255];
+  unsigned long address = 0;
+  unsigned int count = 0;
+  unsigned int index;
+
+  while (address < bytes)
+  {
+    const uint8_t length = lengths[count % sizeof(lengths)];
+
+    for (index = 0; index < length; index++)
+    {
+      data[index] = rand();
+    }
+
+    corpus.push_back(makeRecord(IHX_RT_DATA, address, data, length, (count % 4) == 3));
+
+    address += length;
+    count++;
+  }
+
+  corpus.push_back(makeRecord(IHX_RT_END_OF_FILE, 0, NULL, 0, false));
+}
+
+// every record decoded from a scratch copy (decoding is in place), repeated for long enough to time
+static void benchCorpus(const char *name, const hexCorpus &corpus)
+{
+  std::vector<uint8_t> scratch(HEX_RECORD_MAX_CHARS + 16);
+  unsigned long textBytes = 0;
+  unsigned int decoder;
+  size_t index;
+
+  for (index = 0; index < corpus.size(); index++)
+  {
+    textBytes += corpus[index].size();
+  }
+
+  for (decoder = 0; decoder < DECODER_COUNT; decoder++)
+  {
+    const double start = seconds();
+    unsigned long rounds = 0;
+    unsigned long failures = 0;
+    double elapsed;
+
+    do {
+      for (index = 0; index < corpus.size(); index++)
+      {
+        memcpy(scratch.data(), corpus[index].data(), corpus[index].size());
+        failures += (decoders[decoder].decode(scratch.data(), corpus[index].size()) != IHX_SUCCESS);
+      }
+
+      rounds++;
+      elapsed = seconds() - start;
+    } while (elapsed < HEX_BENCH_MIN_SECONDS);
+
+    printf("corpus=%-10s decoder=%-13s records=%-6lu text_bytes=%-8lu rejected=%-5lu mb_per_sec=%.1f\n", name,
+           decoders[decoder].name, (unsigned long) corpus.size(), textBytes, failures / rounds,
+           textBytes * (double) rounds / elapsed / 1e6);
+  }
+}
+
+// a few random edits to one record
+static std::string mutate(const std::string &record)
+{
+  static const char alphabet[] = "0123456789ABCDEFabcdefGgZz: \r\n\t\x80\xff";
+  std::string mutated = record;
+  const int edits = 1 + rand() % 3;
+  int edit;
+
+  for (edit = 0; edit < edits; edit++)
+  {
+    const size_t position = 1 + rand() % (mutated.size() - 1);
+
+    switch (rand() % 4)
+    {
+      case 0:
+        mutated[position] = alphabet[rand() % (sizeof(alphabet) - 1)];
+        break;
+      case 1:
+        mutated[position] = isupper(mutated[position]) ? tolower(mutated[position]) : toupper(mutated[position]);
+        break;
+      case 2:
+        mutated.erase(position, 1);
+        break;
+      case 3:
+        mutated.insert(position, 1, alphabet[rand() % (sizeof(alphabet) - 1)]);
+        break;
+    }
+
+    if (mutated.size() < 2)
+    {
+      break;
+    }
+  }
+
+  return mutated;
+}
+
+// returns the number of records the table decoder got wrong
+static unsigned long fuzz(const hexCorpus &corpus, const unsigned long iterations)
+{
+  uint8_t expected[HEX_RECORD_MAX_CHARS + 16];
+  uint8_t actual[HEX_RECORD_MAX_CHARS + 16];
+  unsigned long accepted[DECODER_COUNT] = { 0 };
+  unsigned long wrong[DECODER_COUNT] = { 0 };
+  unsigned long valid = 0;
+  unsigned long iteration;
+  unsigned int decoder;
+
+  for (iteration = 0; iteration < iterations; iteration++)
+  {
+    // every other one unmodified, so good records are checked as often as bad ones
+    const std::string &original = corpus[rand() % corpus.size()];
+    const std::string record = (iteration % 2) ? mutate(original) : original;
+    const size_t length = record.size();
+    uint8_t reference;
+
+    if ((length < 2) || (length > sizeof(expected)))
+    {
+      continue;
+    }
+
+    memcpy(expected, record.data(), length);
+    reference = referenceDecode(expected, length);
+    valid += (reference == IHX_SUCCESS);
+
+    for (decoder = 0; decoder < DECODER_COUNT; decoder++)
+    {
+      uint8_t result;
+
+      memcpy(actual, record.data(), length);
+      result = decoders[decoder].decode(actual, length);
+
+      accepted[decoder] += (result == IHX_SUCCESS);
+
+      // accepting a bad record, rejecting a good one or decoding a good one differently
+      if ((result != reference) || ((result == IHX_SUCCESS) && (memcmp(actual, expected, (length - 1) / 2) != 0)))
+      {
+        wrong[decoder]++;
+
+        if ((decoder == DECODER_COUNT - 1) && (wrong[decoder] <= 5))
+        {
+          printf("table decoder %s \"%s\"\n", (result == IHX_SUCCESS) ? "accepted" : "rejected", record.c_str());
+        }
+      }
+    }
+  }
+
+  for (decoder = 0; decoder < DECODER_COUNT; decoder++)
+  {
+    printf("fuzz decoder=%-13s records=%lu reference_valid=%lu accepted=%lu wrong=%lu\n", decoders[decoder].name,
+           iterations, valid, accepted[decoder], wrong[decoder]);
+  }
+
+  return wrong[DECODER_COUNT - 1];
+}
+
+static void usage(void)
+{
+  printf("usage: hexBench [--synthetic-kb=n] [--fuzz=n] [--seed=n] [hex file ...]\n");
+}
+
+int main(int argc, char **argv)
+{
+  unsigned long syntheticKb = 1024;
+  unsigned long fuzzCount = 200000;
+  unsigned int seed = 1;
+  hexCorpus all;
+  hexCorpus synthetic;
+  int files = 0;
+  int index;
+
+  for (index = 1; index < argc; index++)
+  {
+    if (strncmp(argv[index], "--synthetic-kb=", 15) == 0)
+    {
+      syntheticKb = strtoul(argv[index] + 15, NULL, 0);
+    } else if (strncmp(argv[index], "--fuzz=", 7) == 0) {
+      fuzzCount = strtoul(argv[index] + 7, NULL, 0);
+    } else if (strncmp(argv[index], "--seed=", 7) == 0) {
+      seed = strtoul(argv[index] + 7, NULL, 0);
+    } else if (argv[index][0] == '-') {
+      usage();
+      return 2;
+    }
+  }
+
+  srand(seed);
+
+  for (index = 1; index < argc; index++)
+  {
+    if (argv[index][0] != '-')
+    {
+      hexCorpus corpus;
+      const char *name = strrchr(argv[index], '/') ? strrchr(argv[index], '/') + 1 : argv[index];
+
+      if (!loadCorpus(argv[index], corpus))
+      {
+        return 1;
+      }
+
+      benchCorpus(name, corpus);
+      all.insert(all.end(), corpus.begin(), corpus.end());
+      files++;
+    }
+  }
+
+  if (files == 0)
+  {
+    hexCorpus corpus;
+
+    if (!loadCorpus("../blink.ihx", corpus))
+    {
+      return 1;
+    }
+
+    benchCorpus("blink.ihx", corpus);
+    all.insert(all.end(), corpus.begin(), corpus.end());
+  }
+
+  if (syntheticKb > 0)
+  {
+    makeSynthetic(syntheticKb * 1024, synthetic);
+    benchCorpus("synthetic", synthetic);
+    all.insert(all.end(), synthetic.begin(), synthetic.end());
+  }
+
+  return (fuzz(all, fuzzCount) == 0) ? 0 : 1;
+}
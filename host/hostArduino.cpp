@@ -0,0 +1,222 @@
+/*
+  hostArduino.cpp - virtual clock, pins and stdin/stdout serial for host builds
+*/
+
+#include <Arduino.h>
+
+#include <poll.h>
+#include <unistd.h>
+
+HardwareSerial Serial;
+
+// time only moves when something spends it (bus transfers, delays)
+static unsigned long virtualMicros = 0;
+
+// remember pin levels so digitalRead() returns what was last written
+static uint8_t pinLevels[256];
+
+unsigned long millis(void)
+{
+  return virtualMicros / 1000;
+}
+
+unsigned long micros(void)
+{
+  return virtualMicros;
+}
+
+void hostAdvanceMicros(unsigned long us)
+{
+  virtualMicros += us;
+}
+
+void delay(unsigned long ms)
+{
+  virtualMicros += ms * 1000;
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  virtualMicros += us;
+}
+
+void yield(void)
+{
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  (void) pin;
+  (void) mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+  pinLevels[pin] = value ? HIGH : LOW;
+}
+
+int digitalRead(uint8_t pin)
+{
+  return pinLevels[pin];
+}
+
+// Print ///////////////////////////////////////////////////////////////////////
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+  size_t count = 0;
+
+  while (size--)
+  {
+    count += write(*buffer++);
+  }
+
+  return count;
+}
+
+size_t Print::printNumber(unsigned long value, int base)
+{
+  char text[8 * sizeof(long) + 1];
+  char *p = &text[sizeof(text) - 1];
+
+  if (base < 2)
+  {
+    base = 10;
+  }
+
+  *p = '\0';
+  do {
+    const unsigned long digit = value % base;
+    *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    value /= base;
+  } while (value);
+
+  return write(p);
+}
+
+size_t Print::print(const char *str)
+{
+  return write(str);
+}
+
+size_t Print::print(char c)
+{
+  return write((uint8_t) c);
+}
+
+size_t Print::print(unsigned char value, int base)
+{
+  return printNumber(value, base);
+}
+
+size_t Print::print(int value, int base)
+{
+  return print((long) value, base);
+}
+
+size_t Print::print(unsigned int value, int base)
+{
+  return printNumber(value, base);
+}
+
+size_t Print::print(long value, int base)
+{
+  if ((base == DEC) && (value < 0))
+  {
+    return write('-') + printNumber(-(unsigned long) value, base);
+  }
+
+  return printNumber((unsigned long) value, base);
+}
+
+size_t Print::print(unsigned long value, int base)
+{
+  return printNumber(value, base);
+}
+
+size_t Print::print(double value, int digits)
+{
+  char text[64];
+
+  snprintf(text, sizeof(text), "%.*f", digits, value);
+
+  return write(text);
+}
+
+size_t Print::println(void)
+{
+  return write("\r\n");
+}
+
+size_t Print::println(const char *str) { return print(str) + println(); }
+size_t Print::println(char c) { return print(c) + println(); }
+size_t Print::println(unsigned char value, int base) { return print(value, base) + println(); }
+size_t Print::println(int value, int base) { return print(value, base) + println(); }
+size_t Print::println(unsigned int value, int base) { return print(value, base) + println(); }
+size_t Print::println(long value, int base) { return print(value, base) + println(); }
+size_t Print::println(unsigned long value, int base) { return print(value, base) + println(); }
+size_t Print::println(double value, int digits) { return print(value, digits) + println(); }
+
+// HardwareSerial //////////////////////////////////////////////////////////////
+
+void HardwareSerial::begin(unsigned long baud)
+{
+  (void) baud;
+}
+
+int HardwareSerial::available(void)
+{
+  struct pollfd pfd;
+  unsigned char c;
+
+  if (peeked >= 0)
+  {
+    return 1;
+  }
+
+  if (endOfInput)
+  {
+    return 0;
+  }
+
+  pfd.fd = STDIN_FILENO;
+  pfd.events = POLLIN;
+
+  // avoid spinning a core while waiting on someone typing at a terminal
+  if ((poll(&pfd, 1, isatty(STDIN_FILENO) ? 1 : 0) > 0) && (pfd.revents & (POLLIN | POLLHUP)))
+  {
+    if (::read(STDIN_FILENO, &c, 1) == 1)
+    {
+      peeked = c;
+      return 1;
+    }
+
+    endOfInput = true;
+  }
+
+  return 0;
+}
+
+int HardwareSerial::peek(void)
+{
+  return available() ? peeked : -1;
+}
+
+int HardwareSerial::read(void)
+{
+  const int c = peek();
+
+  peeked = -1;
+
+  return c;
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  return fwrite(&c, 1, 1, stdout);
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+  return fwrite(buffer, 1, size, stdout);
+}
@@ -0,0 +1,66 @@
+/*
+  hostSketch.cpp - runs OnbrightFlasher.ino on the host against the simulated target
+  Commands and hex lines are read from stdin, so the sketch can be driven
+  interactively or by piping a script into it.
+*/
+
+#include <Arduino.h>
+#include <Wire.h>
+
+#include "ob38s003Sim.h"
+
+void setup(void);
+void loop(void);
+
+// keep running the loop this many times after input ends so pending work completes
+#define LOOPS_AFTER_EOF 1000
+
+// virtual time each loop() pass costs on top of what it spends on the bus,
+// so waits that only check millis() (e.g., after the handshake) come to an end
+#define LOOP_MICROS 1
+
+int main(int argc, char **argv)
+{
+  Ob38s003SimConfig simConfig;
+  unsigned int idleLoops = 0;
+  int index;
+
+  // the target is powered the moment the sketch first tries to handshake
+  simConfig.autoPowerOn = true;
+
+  for (index = 1; index < argc; index++)
+  {
+    if (!ob38s003SimOption(argv[index], simConfig))
+    {
+      printf("usage: onbrightSketch [simulated target options]\n");
+      ob38s003SimUsage();
+      return 2;
+    }
+  }
+
+  static Ob38s003Sim target(simConfig);
+  Wire.attach(&target);
+
+  // same kind of target on Wire1 for the gang command, with faults of its own
+  simConfig.seed++;
+  static Ob38s003Sim secondTarget(simConfig);
+  Wire1.attach(&secondTarget);
+
+  setup();
+
+  while (idleLoops < LOOPS_AFTER_EOF)
+  {
+    loop();
+    hostAdvanceMicros(LOOP_MICROS);
+
+    // stdin closed and nothing buffered
+    if (!Serial.available() && Serial.eof())
+    {
+      idleLoops++;
+    }
+
+    fflush(stdout);
+  }
+
+  return 0;
+}
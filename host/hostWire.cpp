@@ -0,0 +1,116 @@
+/*
+  hostWire.cpp - host Wire library that talks to a simulated target
+*/
+
+#include <Wire.h>
+
+#include "ob38s003Sim.h"
+
+TwoWire Wire;
+TwoWire Wire1;
+
+TwoWire::TwoWire(void)
+{
+  target = NULL;
+  clockHz = 100000;
+  timeoutMicros = 50000;
+
+  txAddress = 0;
+  txLength = 0;
+
+  rxLength = 0;
+  rxIndex = 0;
+}
+
+void TwoWire::beginTransmission(uint8_t address)
+{
+  txAddress = address;
+  txLength = 0;
+}
+
+size_t TwoWire::write(uint8_t data)
+{
+  if (txLength >= sizeof(txBuffer))
+  {
+    return 0;
+  }
+
+  txBuffer[txLength++] = data;
+
+  return 1;
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t quantity)
+{
+  size_t index;
+
+  for (index = 0; index < quantity; index++)
+  {
+    if (!write(data[index]))
+    {
+      break;
+    }
+  }
+
+  return index;
+}
+
+// like the ESP cores, calling this without beginTransmission() resends to the last address
+uint8_t TwoWire::endTransmission(bool sendStop)
+{
+  uint8_t result = SIM_STATUS_NACK_ADDRESS;
+
+  (void) sendStop;
+
+  if (target != NULL)
+  {
+    result = target->write(txAddress, txBuffer, txLength, clockHz, timeoutMicros);
+  }
+
+  txLength = 0;
+
+  return result;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity)
+{
+  if (quantity > sizeof(rxBuffer))
+  {
+    quantity = sizeof(rxBuffer);
+  }
+
+  rxIndex = 0;
+  rxLength = 0;
+
+  if (target != NULL)
+  {
+    rxLength = target->read(address, rxBuffer, quantity, clockHz, timeoutMicros);
+  }
+
+  return rxLength;
+}
+
+int TwoWire::available(void)
+{
+  return rxLength - rxIndex;
+}
+
+int TwoWire::read(void)
+{
+  if (rxIndex >= rxLength)
+  {
+    return -1;
+  }
+
+  return rxBuffer[rxIndex++];
+}
+
+int TwoWire::peek(void)
+{
+  if (rxIndex >= rxLength)
+  {
+    return -1;
+  }
+
+  return rxBuffer[rxIndex];
+}
@@ -0,0 +1,299 @@
+/*
+  mockGpio.cpp - open drain i2c lines with a simulated target listening on them
+*/
+
+#include "mockGpio.h"
+#include "ob38s003Sim.h"
+
+MockI2cLine mockI2c;
+
+MockI2cLine::MockI2cLine(void)
+{
+  target = NULL;
+  sdaPin = 0xff;
+  sclPin = 0xff;
+  recording = false;
+
+  masterSda = false;
+  masterScl = false;
+  targetSda = false;
+  stretchUntil = 0;
+
+  lastSda = true;
+  lastScl = true;
+
+  state = lineIdle;
+  shift = 0;
+  bitCount = 0;
+  ackPhase = false;
+  readRequest = false;
+  masterAck = false;
+  busy = 0;
+
+  memset(&counters, 0, sizeof(counters));
+}
+
+void MockI2cLine::attach(Ob38s003Sim *simTarget, const uint8_t sda, const uint8_t scl)
+{
+  target = simTarget;
+  sdaPin = sda;
+  sclPin = scl;
+}
+
+bool MockI2cLine::sdaLevel(void) const
+{
+  return !(masterSda || targetSda);
+}
+
+bool MockI2cLine::sclLevel(void) const
+{
+  return !(masterScl || (micros() < stretchUntil));
+}
+
+void MockI2cLine::drive(const uint8_t pin, const bool low)
+{
+  if (pin == sdaPin)
+  {
+    masterSda = low;
+  } else if (pin == sclPin) {
+    masterScl = low;
+  }
+
+  update();
+}
+
+bool MockI2cLine::level(const uint8_t pin)
+{
+  // target may have let go of SCL since the last look
+  update();
+
+  if (pin == sdaPin)
+  {
+    return sdaLevel();
+  } else if (pin == sclPin) {
+    return sclLevel();
+  }
+
+  // nothing attached, pull up wins
+  return true;
+}
+
+void MockI2cLine::update(void)
+{
+  bool sda = sdaLevel();
+  bool scl = sclLevel();
+  mockEdge edge;
+
+  if ((sda == lastSda) && (scl == lastScl))
+  {
+    return;
+  }
+
+  // SDA moving while SCL stays high is a start or a stop, otherwise data changes only while SCL is low
+  if (scl && lastScl)
+  {
+    if (!sda)
+    {
+      onStart();
+    } else {
+      onStop();
+    }
+  } else if (scl && !lastScl) {
+    onRise();
+  } else if (!scl && lastScl) {
+    onFall();
+  }
+
+  if (recording)
+  {
+    edge.micros = micros();
+    edge.sda = sda;
+    edge.scl = scl;
+    waveform.push_back(edge);
+  }
+
+  // target answered the edge (ACK, next data bit), SCL is low so this is not an event
+  lastSda = sda = sdaLevel();
+  lastScl = scl = sclLevel();
+
+  if (recording && ((sda != edge.sda) || (scl != edge.scl)))
+  {
+    edge.sda = sda;
+    edge.scl = scl;
+    waveform.push_back(edge);
+  }
+}
+
+void MockI2cLine::onStart(void)
+{
+  counters.starts++;
+
+  state = (target != NULL) ? lineAddress : lineIgnore;
+  shift = 0;
+  bitCount = 0;
+  ackPhase = false;
+  targetSda = false;
+}
+
+void MockI2cLine::onStop(void)
+{
+  counters.stops++;
+
+  state = lineIdle;
+  targetSda = false;
+}
+
+// flasher samples on the rising edge, so does target
+void MockI2cLine::onRise(void)
+{
+  switch (state)
+  {
+    case lineAddress:
+    case lineWrite:
+      if (!ackPhase && (bitCount < 8))
+      {
+        shift = (shift << 1) | (sdaLevel() ? 1 : 0);
+        bitCount++;
+      }
+      break;
+    case lineRead:
+      if (ackPhase)
+      {
+        masterAck = !sdaLevel();
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+// target changes SDA only while SCL is low
+void MockI2cLine::onFall(void)
+{
+  switch (state)
+  {
+    case lineAddress:
+    case lineWrite:
+      if (ackPhase)
+      {
+        // end of the ACK clock, hold SCL if target is busy with what it just received
+        ackPhase = false;
+        targetSda = false;
+        bitCount = 0;
+        shift = 0;
+        stretch(busy + target->config.clockStretchMicros);
+        busy = 0;
+
+        if (state == lineAddress)
+        {
+          if (readRequest)
+          {
+            state = lineRead;
+            counters.bytes++;
+            shift = target->readByte();
+            targetSda = !(shift & 0x80);
+            bitCount = 1;
+          } else {
+            state = lineWrite;
+          }
+        }
+      } else if (bitCount == 8) {
+        counters.bytes++;
+
+        if (state == lineAddress)
+        {
+          readRequest = (shift & 1) != 0;
+
+          if (!(readRequest ? target->beginRead(shift >> 1) : target->beginWrite(shift >> 1)))
+          {
+            // SDA stays released, flasher sees a NACK
+            state = lineIgnore;
+            break;
+          }
+        } else {
+          busy = target->writeByte(shift);
+        }
+
+        targetSda = true;
+        ackPhase = true;
+      }
+      break;
+    case lineRead:
+      if (ackPhase)
+      {
+        ackPhase = false;
+        stretch(target->config.clockStretchMicros);
+
+        if (masterAck)
+        {
+          counters.bytes++;
+          shift = target->readByte();
+          targetSda = !(shift & 0x80);
+          bitCount = 1;
+        } else {
+          // NACK after the last byte, wait for the stop
+          state = lineIgnore;
+        }
+      } else if (bitCount < 8) {
+        targetSda = !(shift & (0x80 >> bitCount));
+        bitCount++;
+      } else {
+        // flasher drives the ACK bit
+        targetSda = false;
+        ackPhase = true;
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void MockI2cLine::stretch(const unsigned long busyMicros)
+{
+  if (busyMicros == 0)
+  {
+    return;
+  }
+
+  counters.stretches++;
+  counters.stretchMicros += busyMicros;
+  stretchUntil = micros() + busyMicros;
+}
+
+// value change dump, opens in GTKWave or PulseView
+bool MockI2cLine::writeVcd(const char *path) const
+{
+  FILE *file = fopen(path, "w");
+  unsigned long lastTime = 0;
+  size_t index;
+
+  if (file == NULL)
+  {
+    perror(path);
+    return false;
+  }
+
+  fprintf(file, "$timescale 1us $end\n");
+  fprintf(file, "$scope module i2c $end\n");
+  fprintf(file, "$var wire 1 ! sda $end\n");
+  fprintf(file, "$var wire 1 \" scl $end\n");
+  fprintf(file, "$upscope $end\n");
+  fprintf(file, "$enddefinitions $end\n");
+  fprintf(file, "#0\n1!\n1\"\n");
+
+  for (index = 0; index < waveform.size(); index++)
+  {
+    // several changes inside the same microsecond share one timestamp
+    if (waveform[index].micros != lastTime)
+    {
+      fprintf(file, "#%lu\n", waveform[index].micros);
+      lastTime = waveform[index].micros;
+    }
+
+    fprintf(file, "%d!\n%d\"\n", waveform[index].sda ? 1 : 0, waveform[index].scl ? 1 : 0);
+  }
+
+  fclose(file);
+
+  return true;
+}
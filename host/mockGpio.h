@@ -0,0 +1,116 @@
+/*
+  mockGpio.h - pin backend for BitBangBus on a Linux host
+  SDA and SCL are modelled as open drain lines shared by the flasher and a
+  simulated target. The target side watches the levels, decodes start, stop,
+  address and data bits like real hardware would, and answers through the
+  byte level calls of Ob38s003Sim (acknowledge, read data, clock stretching).
+  Every level change is timestamped so a run can be dumped as a VCD waveform.
+*/
+
+#ifndef Mock_gpio_h
+#define Mock_gpio_h
+
+#include <Arduino.h>
+
+#include <vector>
+
+class Ob38s003Sim;
+
+struct mockEdge
+{
+  unsigned long micros;
+  bool sda;
+  bool scl;
+};
+
+struct mockLineCounters
+{
+  unsigned long starts;
+  unsigned long stops;
+  unsigned long bytes;
+  unsigned long stretches;
+  unsigned long stretchMicros;
+};
+
+class MockI2cLine
+{
+  public:
+    MockI2cLine(void);
+
+    void attach(Ob38s003Sim *simTarget, const uint8_t sda, const uint8_t scl);
+
+    // flasher side, through MockGpio
+    void drive(const uint8_t pin, const bool low);
+    bool level(const uint8_t pin);
+
+    void record(const bool enable) { recording = enable; }
+    void clearWaveform(void) { waveform.clear(); }
+    bool writeVcd(const char *path) const;
+
+    std::vector<mockEdge> waveform;
+    mockLineCounters counters;
+
+  private:
+    // levels as both sides see them (wired AND of the two drivers, high when nobody pulls)
+    bool sdaLevel(void) const;
+    bool sclLevel(void) const;
+    void update(void);
+
+    void onStart(void);
+    void onStop(void);
+    void onRise(void);
+    void onFall(void);
+    void stretch(const unsigned long busyMicros);
+
+    Ob38s003Sim *target;
+    uint8_t sdaPin;
+    uint8_t sclPin;
+    bool recording;
+
+    // what each side is pulling low
+    bool masterSda;
+    bool masterScl;
+    bool targetSda;
+    unsigned long stretchUntil;
+
+    bool lastSda;
+    bool lastScl;
+
+    // target state machine
+    enum { lineIdle, lineAddress, lineWrite, lineRead, lineIgnore } state;
+    uint8_t shift;
+    uint8_t bitCount;
+    bool ackPhase;
+    bool readRequest;
+    bool masterAck;
+    unsigned long busy;
+};
+
+// single bus shared by every MockGpio pin
+extern MockI2cLine mockI2c;
+
+template <uint8_t PIN>
+struct MockGpio
+{
+  static void begin(void)
+  {
+    mockI2c.drive(PIN, false);
+  }
+
+  static void low(void)
+  {
+    mockI2c.drive(PIN, true);
+  }
+
+  static void release(void)
+  {
+    mockI2c.drive(PIN, false);
+  }
+
+  static bool read(void)
+  {
+    return mockI2c.level(PIN);
+  }
+};
+
+#endif
@@ -0,0 +1,524 @@
+/*
+  ob38s003Sim.cpp - software model of an OB38S003 target on the i2c bus
+*/
+
+#include "ob38s003Sim.h"
+
+// reuse the command set exactly as the flasher sends it
+#include "onbrightFlasher.h"
+
+Ob38s003Sim::Ob38s003Sim(void) : Ob38s003Sim(Ob38s003SimConfig())
+{
+}
+
+Ob38s003Sim::Ob38s003Sim(const Ob38s003SimConfig &simConfig)
+{
+  config = simConfig;
+
+  // a blank part with only the chip type programmed
+  memset(flash, 0xff, sizeof(flash));
+  memset(configBytes, 0xff, sizeof(configBytes));
+  configBytes[CHIP_TYPE_BYTE] = 0x0a;
+
+  powered = false;
+  connected = false;
+  handshakeStage = 0;
+  powerOnMicros = 0;
+  powerRequested = false;
+  powerRequestMicros = 0;
+
+  command = 0;
+  address = 0;
+  addressHigh = 0;
+
+  transferAddress = 0;
+  transferIndex = 0;
+
+  busyUntil = 0;
+  lastBusy = 0;
+
+  randomState = config.seed ? config.seed : 1;
+
+  resetCounters();
+}
+
+void Ob38s003Sim::powerOn(void)
+{
+  powered = true;
+  connected = false;
+  handshakeStage = 0;
+  powerOnMicros = micros();
+}
+
+void Ob38s003Sim::powerOff(void)
+{
+  powered = false;
+  connected = false;
+  handshakeStage = 0;
+  busyUntil = 0;
+  powerRequested = false;
+}
+
+void Ob38s003Sim::resetCounters(void)
+{
+  memset(&counters, 0, sizeof(counters));
+}
+
+// xorshift32, good enough to sprinkle faults deterministically
+bool Ob38s003Sim::randomChance(const double rate)
+{
+  if (rate <= 0.0)
+  {
+    return false;
+  }
+
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 17;
+  randomState ^= randomState << 5;
+
+  return (randomState / 4294967296.0) < rate;
+}
+
+bool Ob38s003Sim::randomNack(void)
+{
+  return randomChance(config.nackRate);
+}
+
+uint8_t Ob38s003Sim::readConfig(const unsigned int configAddress)
+{
+  uint32_t sum = 0;
+  unsigned int index;
+
+  if (!config.checksumRegisters || (configAddress < FLASH_CHECKSUM01) || (configAddress > FLASH_CHECKSUM04))
+  {
+    return configBytes[configAddress];
+  }
+
+  for (index = 0; index < SIM_FLASH_SIZE; index++)
+  {
+    sum += flash[index];
+  }
+
+  return (sum >> (8 * (configAddress - FLASH_CHECKSUM01))) & 0xff;
+}
+
+// too fast for the wiring, a data bit gets lost and target nacks
+bool Ob38s003Sim::marginalFault(const unsigned long clockHz)
+{
+  return (config.marginalClockHz > 0) && (clockHz > config.marginalClockHz) && randomChance(config.marginalRate);
+}
+
+// address byte plus data bytes, nine clocks each, plus start and stop
+unsigned long Ob38s003Sim::transferMicros(const size_t length, const unsigned long clockHz)
+{
+  const unsigned long clocks = 9 * (length + 1) + 2;
+  const unsigned long hz = clockHz ? clockHz : 100000;
+
+  return config.transactionLatencyMicros + (clocks * 1000000UL + hz - 1) / hz + config.clockStretchMicros * (length + 1);
+}
+
+// target still holds SCL from an earlier erase or program, bus waits up to its timeout
+bool Ob38s003Sim::waitReady(const unsigned long timeoutMicros)
+{
+  const unsigned long now = micros();
+
+  if (config.busyNack || ((long) (busyUntil - now) <= 0))
+  {
+    return true;
+  }
+
+  if (busyUntil - now > timeoutMicros)
+  {
+    counters.timeouts++;
+    finish(timeoutMicros);
+    return false;
+  }
+
+  finish(busyUntil - now);
+  return true;
+}
+
+// with autoPowerOn the first handshake attempt asks for power, which comes powerOnDelayMicros later
+void Ob38s003Sim::autoPower(const uint8_t i2cAddress)
+{
+  if (powered || !config.autoPowerOn)
+  {
+    return;
+  }
+
+  if (!powerRequested)
+  {
+    if (i2cAddress != RESET_CHIP)
+    {
+      return;
+    }
+
+    powerRequested = true;
+    powerRequestMicros = micros();
+  }
+
+  if (micros() - powerRequestMicros >= config.powerOnDelayMicros)
+  {
+    powerOn();
+  }
+}
+
+void Ob38s003Sim::finish(const unsigned long elapsedMicros)
+{
+  counters.busMicros += elapsedMicros;
+  hostAdvanceMicros(elapsedMicros);
+}
+
+bool Ob38s003Sim::beginWrite(const uint8_t i2cAddress)
+{
+  unsigned long sincePowerOn;
+  bool ack = false;
+
+  counters.transactions++;
+  counters.writeTransactions++;
+  counters.bytes++;
+
+  transferAddress = i2cAddress;
+  transferIndex = 0;
+  lastBusy = 0;
+
+  autoPower(i2cAddress);
+
+  switch (i2cAddress)
+  {
+    case RESET_CHIP:
+      // once the window closes the part runs its application until the next power cycle
+      sincePowerOn = micros() - powerOnMicros;
+      ack = powered && (sincePowerOn >= config.powerUpMicros) && (sincePowerOn <= config.powerUpMicros + config.handshakeWindowMicros);
+      if (ack)
+      {
+        handshakeStage = 1;
+      }
+      break;
+    case HANDSHAKE01:
+      ack = (handshakeStage >= 1);
+      if (ack)
+      {
+        handshakeStage = 2;
+      }
+      break;
+    case HANDSHAKE02:
+      ack = (handshakeStage >= 2);
+      if (ack)
+      {
+        connected = true;
+      }
+      break;
+    case DEVICE_ADDRESS:
+    case DATA_ADDRESS:
+      // busy target does not answer at all
+      ack = connected && ((long) (micros() - busyUntil) >= 0);
+      break;
+  }
+
+  if (!ack || randomNack())
+  {
+    counters.nacks++;
+    return false;
+  }
+
+  return true;
+}
+
+unsigned long Ob38s003Sim::writeByte(const uint8_t value)
+{
+  const size_t index = transferIndex++;
+  unsigned long busy = 0;
+
+  counters.bytes++;
+
+  if (transferAddress == DEVICE_ADDRESS)
+  {
+    if (index == 0)
+    {
+      command = value;
+
+      if (command == ERASE_CHIP)
+      {
+        // target holds the clock for the whole erase
+        memset(flash, 0xff, sizeof(flash));
+        busy = config.eraseBusyMicros;
+      }
+    } else if ((command == WRITE_FLASH) || (command == READ_FLASH)) {
+      if (index == 1)
+      {
+        addressHigh = value;
+      } else if (index == 2) {
+        address = ((addressHigh << 8) | value) % SIM_FLASH_SIZE;
+      }
+    } else if ((command == WRITE_CONFIG_BYTE) || (command == READ_CONFIG_BYTE)) {
+      if (index == 1)
+      {
+        address = value % SIM_CONFIG_SIZE;
+      }
+    }
+  } else if (transferAddress == DATA_ADDRESS) {
+    if (command == WRITE_FLASH)
+    {
+      // flash programming can only clear bits
+      if (!randomChance(config.dropRate))
+      {
+        flash[address] &= value;
+      }
+
+      if (config.writeAutoIncrement)
+      {
+        address = (address + 1) % SIM_FLASH_SIZE;
+      }
+
+      busy = config.programBusyMicros;
+    } else if (command == WRITE_CONFIG_BYTE) {
+      configBytes[address] = value;
+    }
+  }
+
+  lastBusy = busy;
+
+  if (config.busyNack)
+  {
+    busyUntil = micros() + busy;
+    return 0;
+  }
+
+  return busy;
+}
+
+bool Ob38s003Sim::beginRead(const uint8_t i2cAddress)
+{
+  counters.transactions++;
+  counters.readTransactions++;
+  counters.bytes++;
+
+  transferAddress = i2cAddress;
+  transferIndex = 0;
+
+  // reset request, target leaves programming mode and starts its application
+  if (i2cAddress == RESET_CHIP)
+  {
+    connected = false;
+    handshakeStage = 0;
+    counters.nacks++;
+    return false;
+  }
+
+  if (!connected || ((long) (micros() - busyUntil) < 0) || ((i2cAddress != DEVICE_ADDRESS) && (i2cAddress != DATA_ADDRESS)) || randomNack())
+  {
+    counters.nacks++;
+    return false;
+  }
+
+  return true;
+}
+
+uint8_t Ob38s003Sim::readByte(void)
+{
+  uint8_t value = 0xff;
+
+  transferIndex++;
+  counters.bytes++;
+
+  if (transferAddress == DEVICE_ADDRESS)
+  {
+    value = 0x00;
+  } else if (command == READ_FLASH) {
+    value = flash[address];
+
+    if (config.readAutoIncrement)
+    {
+      address = (address + 1) % SIM_FLASH_SIZE;
+    }
+  } else if (command == READ_CONFIG_BYTE) {
+    value = readConfig(address);
+  }
+
+  return value;
+}
+
+uint8_t Ob38s003Sim::write(const uint8_t i2cAddress, const uint8_t *data, const size_t length, const unsigned long clockHz, const unsigned long timeoutMicros)
+{
+  unsigned long elapsed = transferMicros(length, clockHz);
+  unsigned long busy;
+  bool timedOut = false;
+  size_t index;
+
+  autoPower(i2cAddress);
+
+  if (!powered && config.unpoweredFails)
+  {
+    counters.transactions++;
+    counters.writeTransactions++;
+    finish(transferMicros(0, clockHz));
+    return SIM_STATUS_OTHER;
+  }
+
+  if (!waitReady(timeoutMicros))
+  {
+    return SIM_STATUS_TIMEOUT;
+  }
+
+  if (!beginWrite(i2cAddress))
+  {
+    // transfer stops right after the address byte
+    finish(transferMicros(0, clockHz));
+    return SIM_STATUS_NACK_ADDRESS;
+  }
+
+  if ((length > 0) && marginalFault(clockHz))
+  {
+    counters.nacks++;
+    finish(transferMicros(1, clockHz));
+    return SIM_STATUS_NACK_DATA;
+  }
+
+  for (index = 0; index < length; index++)
+  {
+    busy = writeByte(data[index]);
+
+    // a short bus timeout trips before target lets go of the clock
+    if (busy > timeoutMicros)
+    {
+      elapsed += timeoutMicros;
+      timedOut = true;
+    } else {
+      elapsed += busy;
+    }
+  }
+
+  if (timedOut)
+  {
+    counters.timeouts++;
+    finish(elapsed);
+
+    // bus gave up, target keeps holding SCL for the rest of the erase
+    busyUntil = micros() + lastBusy - timeoutMicros;
+    return SIM_STATUS_TIMEOUT;
+  }
+
+  finish(elapsed);
+
+  // busy starts once the last byte was acknowledged, not when the transfer began
+  if (config.busyNack && (lastBusy > 0))
+  {
+    busyUntil = micros() + lastBusy;
+  }
+
+  return SIM_STATUS_SUCCESS;
+}
+
+uint8_t Ob38s003Sim::read(const uint8_t i2cAddress, uint8_t *data, const size_t length, const unsigned long clockHz, const unsigned long timeoutMicros)
+{
+  size_t index;
+
+  if (!powered && config.unpoweredFails)
+  {
+    counters.transactions++;
+    counters.readTransactions++;
+    finish(transferMicros(0, clockHz));
+    return 0;
+  }
+
+  if (!waitReady(timeoutMicros))
+  {
+    return 0;
+  }
+
+  if (!beginRead(i2cAddress))
+  {
+    finish(transferMicros(0, clockHz));
+    return 0;
+  }
+
+  if (marginalFault(clockHz))
+  {
+    counters.nacks++;
+    finish(transferMicros(0, clockHz));
+    return 0;
+  }
+
+  for (index = 0; index < length; index++)
+  {
+    data[index] = readByte();
+  }
+
+  finish(transferMicros(length, clockHz));
+
+  return length;
+}
+
+bool ob38s003SimOption(const char *arg, Ob38s003SimConfig &simConfig)
+{
+  const char *value = strchr(arg, '=');
+
+  if (value == NULL)
+  {
+    return false;
+  }
+  value++;
+
+  if (strncmp(arg, "--latency=", 10) == 0) {
+    simConfig.transactionLatencyMicros = strtoul(value, NULL, 0);
+  } else if (strncmp(arg, "--nack-rate=", 12) == 0) {
+    simConfig.nackRate = strtod(value, NULL);
+  } else if (strncmp(arg, "--drop-rate=", 12) == 0) {
+    simConfig.dropRate = strtod(value, NULL);
+  } else if (strncmp(arg, "--marginal-clock=", 17) == 0) {
+    simConfig.marginalClockHz = strtoul(value, NULL, 0);
+  } else if (strncmp(arg, "--marginal-rate=", 16) == 0) {
+    simConfig.marginalRate = strtod(value, NULL);
+  } else if (strncmp(arg, "--stretch=", 10) == 0) {
+    simConfig.clockStretchMicros = strtoul(value, NULL, 0);
+  } else if (strncmp(arg, "--erase-busy=", 13) == 0) {
+    simConfig.eraseBusyMicros = strtoul(value, NULL, 0);
+  } else if (strncmp(arg, "--program-busy=", 15) == 0) {
+    simConfig.programBusyMicros = strtoul(value, NULL, 0);
+  } else if (strncmp(arg, "--busy-nack=", 12) == 0) {
+    simConfig.busyNack = strtoul(value, NULL, 0) != 0;
+  } else if (strncmp(arg, "--power-up=", 11) == 0) {
+    simConfig.powerUpMicros = strtoul(value, NULL, 0);
+  } else if (strncmp(arg, "--power-on-delay=", 17) == 0) {
+    simConfig.powerOnDelayMicros = strtoul(value, NULL, 0);
+  } else if (strncmp(arg, "--unpowered-fails=", 18) == 0) {
+    simConfig.unpoweredFails = strtoul(value, NULL, 0) != 0;
+  } else if (strncmp(arg, "--window=", 9) == 0) {
+    simConfig.handshakeWindowMicros = strtoul(value, NULL, 0);
+  } else if (strncmp(arg, "--read-increment=", 17) == 0) {
+    simConfig.readAutoIncrement = strtoul(value, NULL, 0) != 0;
+  } else if (strncmp(arg, "--write-increment=", 18) == 0) {
+    simConfig.writeAutoIncrement = strtoul(value, NULL, 0) != 0;
+  } else if (strncmp(arg, "--checksum=", 11) == 0) {
+    simConfig.checksumRegisters = strtoul(value, NULL, 0) != 0;
+  } else if (strncmp(arg, "--seed=", 7) == 0) {
+    simConfig.seed = strtoul(value, NULL, 0);
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+void ob38s003SimUsage(void)
+{
+  printf("simulated target options:\n");
+  printf("  --latency=us        fixed overhead per i2c transaction\n");
+  printf("  --nack-rate=p       probability of a random nack per transaction (0..1)\n");
+  printf("  --drop-rate=p       probability a flash byte is acknowledged but not programmed\n");
+  printf("  --marginal-clock=hz transfers faster than this fail now and then (wiring limit)\n");
+  printf("  --marginal-rate=p   probability of such a failure per transfer (default 0.05)\n");
+  printf("  --stretch=us        clock stretch per byte\n");
+  printf("  --erase-busy=us     clock held low during chip erase\n");
+  printf("  --program-busy=us   clock held low per flash byte programmed\n");
+  printf("  --busy-nack=0|1     nack while erasing or programming instead of holding the clock\n");
+  printf("  --power-up=us       delay after power on before handshake is accepted\n");
+  printf("  --window=us         length of the handshake window\n");
+  printf("  --power-on-delay=us target is switched on this long after the first handshake attempt (sketch only)\n");
+  printf("  --unpowered-fails=0|1 transfers fail rather than nack while target is unpowered\n");
+  printf("  --read-increment=0|1  whether multi byte flash reads advance the address\n");
+  printf("  --write-increment=0|1 whether consecutive flash data writes advance the address\n");
+  printf("  --checksum=0|1      whether the flash checksum config bytes hold the flash sum\n");
+  printf("  --seed=n            seed for random faults\n");
+}
@@ -0,0 +1,154 @@
+/*
+  ob38s003Sim.h - software model of an OB38S003 target on the i2c bus
+  Implements the command set used by onbrightFlasherImpl.h so the flasher
+  can be benchmarked and regression tested on a Linux host.
+*/
+
+#ifndef Ob38s003_sim_h
+#define Ob38s003_sim_h
+
+#include <Arduino.h>
+
+#define SIM_FLASH_SIZE  8192
+#define SIM_CONFIG_SIZE   64
+
+// values reported by the Wire library from endTransmission()
+#define SIM_STATUS_SUCCESS       0
+#define SIM_STATUS_NACK_ADDRESS  2
+#define SIM_STATUS_NACK_DATA     3
+#define SIM_STATUS_OTHER         4
+#define SIM_STATUS_TIMEOUT       5
+
+struct Ob38s003SimConfig
+{
+  // fixed cost per transaction (driver overhead, start/stop, turnaround)
+  unsigned long transactionLatencyMicros = 0;
+
+  // probability that any transaction is randomly nacked by the target
+  double nackRate = 0.0;
+
+  // probability that a flash byte is acknowledged but silently not programmed
+  double dropRate = 0.0;
+
+  // wiring that only works up to this clock, faster transfers fail with marginalRate (0 is any clock)
+  unsigned long marginalClockHz = 0;
+  double marginalRate = 0.05;
+
+  // extra time the target holds SCL low for every byte it receives or sends
+  unsigned long clockStretchMicros = 0;
+
+  // SCL is held low for this long while a chip erase or a flash byte program is in progress
+  unsigned long eraseBusyMicros = 40000;
+  unsigned long programBusyMicros = 0;
+
+  // nack every address while erasing or programming instead of holding SCL low
+  bool busyNack = false;
+
+  // the reset command is only acknowledged inside a short window after power up
+  unsigned long powerUpMicros = 2000;
+  unsigned long handshakeWindowMicros = 50000;
+
+  // whether the flash address advances after each byte of a multi byte read
+  bool readAutoIncrement = true;
+
+  // whether the flash address advances after each byte programmed through DATA_ADDRESS
+  bool writeAutoIncrement = true;
+
+  // whether FLASH_CHECKSUM01..04 report the sum of all flash bytes (little endian)
+  // the real chip is assumed to do so, disable to exercise the readback fallback of verify
+  bool checksumRegisters = true;
+
+  // power the target automatically on the first handshake attempt (interactive use)
+  bool autoPowerOn = false;
+  // and only this long after it, like an operator reaching for the switch
+  unsigned long powerOnDelayMicros = 0;
+
+  // an unpowered target drags SDA/SCL low, so transfers fail outright instead of being nacked
+  bool unpoweredFails = false;
+
+  uint32_t seed = 1;
+};
+
+struct Ob38s003SimCounters
+{
+  unsigned long transactions;
+  unsigned long writeTransactions;
+  unsigned long readTransactions;
+  unsigned long bytes;
+  unsigned long nacks;
+  unsigned long timeouts;
+  unsigned long busMicros;
+};
+
+class Ob38s003Sim
+{
+  public:
+    Ob38s003Sim(void);
+    explicit Ob38s003Sim(const Ob38s003SimConfig &simConfig);
+
+    void powerOn(void);
+    void powerOff(void);
+    bool isConnected(void) const { return connected; }
+
+    // bus side, called by the host Wire implementation
+    // returns a Wire style status (0 success, 2 address nack, 3 data nack, 5 timeout)
+    uint8_t write(const uint8_t address, const uint8_t *data, const size_t length, const unsigned long clockHz, const unsigned long timeoutMicros);
+    // returns number of bytes the target supplied (zero if the address was nacked)
+    uint8_t read(const uint8_t address, uint8_t *data, const size_t length, const unsigned long clockHz, const unsigned long timeoutMicros);
+
+    // the same transfers one byte at a time, for a bus model that works out the bytes from
+    // pin levels itself (see mockGpio.h), bus time is whatever that model spends
+    // address phase of a write, returns whether target acknowledges
+    bool beginWrite(const uint8_t address);
+    // returns how long target holds SCL low after acknowledging this byte (zero with busyNack)
+    unsigned long writeByte(const uint8_t value);
+    bool beginRead(const uint8_t address);
+    uint8_t readByte(void);
+
+    void resetCounters(void);
+
+    Ob38s003SimConfig config;
+    Ob38s003SimCounters counters;
+
+    uint8_t flash[SIM_FLASH_SIZE];
+    uint8_t configBytes[SIM_CONFIG_SIZE];
+
+  private:
+    bool randomChance(const double rate);
+    bool randomNack(void);
+    uint8_t readConfig(const unsigned int configAddress);
+    unsigned long transferMicros(const size_t length, const unsigned long clockHz);
+    bool marginalFault(const unsigned long clockHz);
+    bool waitReady(const unsigned long timeoutMicros);
+    void autoPower(const uint8_t i2cAddress);
+    void finish(const unsigned long elapsedMicros);
+
+    bool powered;
+    bool connected;
+    unsigned char handshakeStage;
+    unsigned long powerOnMicros;
+    bool powerRequested;
+    unsigned long powerRequestMicros;
+
+    // command latched by the last write to DEVICE_ADDRESS
+    uint8_t command;
+    unsigned int address;
+    uint8_t addressHigh;
+
+    // transfer in progress through the byte level calls
+    uint8_t transferAddress;
+    size_t transferIndex;
+
+    // erase or program still in progress until then, and how long the last byte started
+    unsigned long busyUntil;
+    unsigned long lastBusy;
+
+    uint32_t randomState;
+};
+
+// parses one "--name=value" command line option into a config
+// returns false if the option is not a simulator option
+bool ob38s003SimOption(const char *arg, Ob38s003SimConfig &simConfig);
+void ob38s003SimUsage(void);
+
+#endif
@@ -0,0 +1,46 @@
+/*
+  simBus.h - OnbrightFlasher bus policy that talks to the simulated target directly
+  No Wire library in between, so it shows what the protocol costs by itself and
+  lets several flashers on several simulated targets share one program.
+*/
+
+#ifndef Sim_bus_h
+#define Sim_bus_h
+
+#include "ob38s003Sim.h"
+
+class SimBus
+{
+  public:
+    SimBus(Ob38s003Sim &sim, const unsigned long clock = 100000, const unsigned long timeout = 20000) :
+      target(&sim), clockHz(clock), timeoutMicros(timeout)
+    {
+    }
+
+    byte write(const uint8_t address, const uint8_t* data, const uint8_t length)
+    {
+      return target->write(address, data, length, clockHz, timeoutMicros);
+    }
+
+    uint8_t read(const uint8_t address, uint8_t* data, const uint8_t length)
+    {
+      return target->read(address, data, length, clockHz, timeoutMicros);
+    }
+
+    void setTimeoutMillis(const unsigned int timeout)
+    {
+      timeoutMicros = timeout * 1000UL;
+    }
+
+    void setClock(const unsigned long hz)
+    {
+      clockHz = hz;
+    }
+
+  private:
+    Ob38s003Sim *target;
+    unsigned long clockHz;
+    unsigned long timeoutMicros;
+};
+
+#endif
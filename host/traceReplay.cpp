@@ -0,0 +1,803 @@
+/*
+  traceReplay.cpp - compares i2c traces of this flasher with captures of the official programmer
+  and replays them against the simulated target
+
+  Reads three kinds of trace:
+    - a dump of the sketch's "trace" command (or benchFlasher --trace), any line
+      holding "T <hex>", so flashScript.log works as it is
+    - a Saleae Logic 1.x i2c export ("Time [s],Packet ID,Address,Data,Read/Write,ACK/NAK")
+    - a Saleae Logic 2 i2c export ("name,type,start_time,duration,ack,address,read,data")
+
+  With two traces, transactions are matched up in order and every match is
+  compared by the time it took including the idle gap in front of it, so the
+  report shows per kind of transaction, and for the worst single ones, where
+  the first trace is slower than the second.
+
+  --replay sends every transaction of the first trace to the simulated target
+  at the time it was recorded and reports where the model answers differently.
+*/
+
+#include <Arduino.h>
+
+#include <vector>
+
+#include "onbrightFlasher.h"
+#include "traceRecorder.h"
+#include "ob38s003Sim.h"
+
+// how far ahead to look for a transaction the other trace does not have
+#define REPLAY_LOOKAHEAD 256
+
+// bus timeout the sketch sets, a trace dump has status 5 where it ran out
+#define REPLAY_DUMP_TIMEOUT_US 20000
+// a capture only shows acknowledges, the programmer waited as long as it took
+#define REPLAY_CAPTURE_TIMEOUT_US 1000000
+
+#define REPLAY_LINE_MAX 512
+
+enum { kindHandshake,
+       kindPoll,
+       kindErase,
+       kindConfigWrite,
+       kindConfigRead,
+       kindFlashWrite,
+       kindFlashRead,
+       kindReset,
+       kindOther,
+       kindCount
+};
+
+// same names as the flasher's STATS lines where there is one
+static const char *const kindNames[] = { "handshake", "poll", "erase", "config_write", "config_read", "flash_write", "flash_read", "reset", "other" };
+
+struct replayTrace
+{
+  const char *path;
+  bool captured;
+  std::vector<traceEvent_t> events;
+  // kind of each event, clock changes are dropped while loading
+  std::vector<uint8_t> kinds;
+};
+
+struct replayOptions
+{
+  bool replay;
+  bool all;
+  unsigned int top;
+  unsigned long clockHz;
+};
+
+static bool isHex(const char c)
+{
+  return isxdigit((unsigned char) c) != 0;
+}
+
+static uint8_t hexByte(const char *text)
+{
+  char digits[3] = { text[0], text[1], 0 };
+
+  return strtoul(digits, NULL, 16);
+}
+
+// "T " followed by a packed event, anywhere in the line
+static bool parseDumpLine(const char *line, traceEvent_t &event)
+{
+  const char *found = line;
+  uint8_t packed[TRACE_PACKED_SIZE];
+  uint8_t index;
+
+  while ((found = strstr(found, "T ")) != NULL)
+  {
+    const char *hex = found + 2;
+
+    found++;
+
+    for (index = 0; index < 2 * TRACE_PACKED_SIZE; index++)
+    {
+      if (!isHex(hex[index]))
+      {
+        break;
+      }
+    }
+
+    if ((index < 2 * TRACE_PACKED_SIZE) || isHex(hex[index]))
+    {
+      continue;
+    }
+
+    for (index = 0; index < TRACE_PACKED_SIZE; index++)
+    {
+      packed[index] = hexByte(&hex[2 * index]);
+    }
+
+    event.micros = packed[0] | (packed[1] << 8) | (packed[2] << 16) | ((uint32_t) packed[3] << 24);
+    event.duration = packed[4] | (packed[5] << 8);
+    event.type = packed[6];
+    event.address = packed[7];
+    event.length = packed[8];
+    event.status = packed[9];
+    memcpy(event.data, &packed[10], TRACE_DATA_BYTES);
+
+    return true;
+  }
+
+  return false;
+}
+
+// splits a csv line in place, quotes are dropped
+static unsigned int splitCsv(char *line, char **fields, const unsigned int maxFields)
+{
+  unsigned int count = 0;
+  char *cursor = line;
+
+  while ((count < maxFields) && (cursor != NULL))
+  {
+    char *next = strchr(cursor, ',');
+
+    if (next != NULL)
+    {
+      *next++ = '\0';
+    }
+
+    while ((*cursor == ' ') || (*cursor == '"') || (*cursor == '\''))
+    {
+      cursor++;
+    }
+
+    char *end = cursor + strlen(cursor);
+    while ((end > cursor) && ((end[-1] == '"') || (end[-1] == '\'') || (end[-1] == '\r') || (end[-1] == '\n') || (end[-1] == ' ')))
+    {
+      *--end = '\0';
+    }
+
+    fields[count++] = cursor;
+    cursor = next;
+  }
+
+  return count;
+}
+
+static int findField(char **fields, const unsigned int count, const char *name)
+{
+  unsigned int index;
+
+  for (index = 0; index < count; index++)
+  {
+    if (strcasecmp(fields[index], name) == 0)
+    {
+      return index;
+    }
+  }
+
+  return -1;
+}
+
+// a capture transaction being put together byte by byte
+struct captureBuilder
+{
+  bool open;
+  double startSeconds;
+  double endSeconds;
+  traceEvent_t event;
+  uint8_t count;
+};
+
+static void captureBegin(captureBuilder &builder, const double seconds, const uint8_t address, const bool read, const bool ack)
+{
+  memset(&builder.event, 0, sizeof(builder.event));
+  builder.open = true;
+  builder.startSeconds = seconds;
+  builder.endSeconds = seconds;
+  builder.event.type = read ? traceRead : traceWrite;
+  builder.event.address = address;
+  // a nacked address ends the transaction, a write reports 2 and a read gets nothing
+  builder.event.status = (!ack && !read) ? 2 : 0;
+  builder.count = 0;
+}
+
+static void captureData(captureBuilder &builder, const double seconds, const uint8_t value, const bool ack)
+{
+  if (builder.count < TRACE_DATA_BYTES)
+  {
+    builder.event.data[builder.count] = value;
+  }
+  builder.count++;
+  builder.endSeconds = seconds;
+
+  if (builder.event.type == traceRead)
+  {
+    builder.event.status = builder.count;
+  } else if (!ack && (builder.event.status == 0)) {
+    builder.event.status = 3;
+  }
+}
+
+static void captureEnd(captureBuilder &builder, replayTrace &trace)
+{
+  if (!builder.open)
+  {
+    return;
+  }
+
+  builder.event.micros = (uint32_t) (builder.startSeconds * 1e6 + 0.5);
+  builder.event.duration = (uint16_t) ((builder.endSeconds - builder.startSeconds) * 1e6 + 0.5);
+  builder.event.length = builder.count;
+  trace.events.push_back(builder.event);
+  builder.open = false;
+}
+
+static bool parseBool(const char *text)
+{
+  return (strcasecmp(text, "true") == 0) || (strcasecmp(text, "ack") == 0) || (strcmp(text, "1") == 0);
+}
+
+static uint8_t parseNumber(const char *text)
+{
+  return strtoul(text, NULL, 0);
+}
+
+// Logic 1.x writes one row per byte, rows of one transaction share a packet id
+static void loadLogic1(FILE *file, replayTrace &trace)
+{
+  char line[REPLAY_LINE_MAX];
+  char *fields[8];
+  captureBuilder builder = { false, 0, 0, {}, 0 };
+  long packet = -1;
+
+  while (fgets(line, sizeof(line), file) != NULL)
+  {
+    if (splitCsv(line, fields, 6) < 6)
+    {
+      continue;
+    }
+
+    const double seconds = strtod(fields[0], NULL);
+    const long id = strtol(fields[1], NULL, 0);
+    const bool read = (strncasecmp(fields[4], "read", 4) == 0);
+    const bool ack = (strncasecmp(fields[5], "ack", 3) == 0);
+
+    if (!builder.open || (id != packet))
+    {
+      captureEnd(builder, trace);
+      captureBegin(builder, seconds, parseNumber(fields[2]), read, true);
+      packet = id;
+    }
+
+    // the address is acknowledged if any data follows, the last row alone cannot tell
+    if (fields[3][0] != '\0')
+    {
+      captureData(builder, seconds, parseNumber(fields[3]), ack);
+    } else if (!ack) {
+      builder.event.status = read ? 0 : 2;
+    }
+  }
+
+  captureEnd(builder, trace);
+}
+
+// Logic 2 writes one row per frame: start, address, data, stop
+static void loadLogic2(FILE *file, char **header, const unsigned int headerCount, replayTrace &trace)
+{
+  char line[REPLAY_LINE_MAX];
+  char *fields[16];
+  captureBuilder builder = { false, 0, 0, {}, 0 };
+  const int typeField = findField(header, headerCount, "type");
+  const int timeField = findField(header, headerCount, "start_time");
+  const int durationField = findField(header, headerCount, "duration");
+  const int ackField = findField(header, headerCount, "ack");
+  const int addressField = findField(header, headerCount, "address");
+  const int readField = findField(header, headerCount, "read");
+  const int dataField = findField(header, headerCount, "data");
+  unsigned int count;
+
+  while (fgets(line, sizeof(line), file) != NULL)
+  {
+    count = splitCsv(line, fields, 16);
+    if ((typeField < 0) || (timeField < 0) || ((unsigned int) typeField >= count) || ((unsigned int) timeField >= count))
+    {
+      continue;
+    }
+
+    const char *type = fields[typeField];
+    double seconds = strtod(fields[timeField], NULL);
+    const bool ack = (ackField >= 0) && ((unsigned int) ackField < count) && parseBool(fields[ackField]);
+
+    if ((durationField >= 0) && ((unsigned int) durationField < count))
+    {
+      seconds += strtod(fields[durationField], NULL);
+    }
+
+    if (strcmp(type, "address") == 0)
+    {
+      // a repeated start shows up as another address frame
+      captureEnd(builder, trace);
+      captureBegin(builder, strtod(fields[timeField], NULL), parseNumber(fields[addressField]),
+                   (readField >= 0) && parseBool(fields[readField]), ack);
+      builder.endSeconds = seconds;
+    } else if ((strcmp(type, "data") == 0) && builder.open) {
+      captureData(builder, seconds, parseNumber(fields[dataField]), ack);
+    } else if (strcmp(type, "stop") == 0) {
+      captureEnd(builder, trace);
+    }
+  }
+
+  captureEnd(builder, trace);
+}
+
+// what each transaction does, data address transfers depend on the command latched before them
+static void classify(replayTrace &trace)
+{
+  std::vector<traceEvent_t> events;
+  uint8_t command = 0;
+  bool connected = false;
+  uint8_t kind;
+  size_t index;
+
+  trace.kinds.clear();
+
+  for (index = 0; index < trace.events.size(); index++)
+  {
+    const traceEvent_t &event = trace.events[index];
+
+    if (event.type == traceClock)
+    {
+      continue;
+    }
+
+    kind = kindOther;
+
+    switch (event.address)
+    {
+      case RESET_CHIP:
+        kind = (event.type == traceRead) ? kindReset : kindHandshake;
+        connected = connected && (event.type != traceRead);
+        break;
+      case HANDSHAKE01:
+        kind = kindHandshake;
+        break;
+      case HANDSHAKE02:
+        kind = kindHandshake;
+        connected = true;
+        break;
+      case DEVICE_ADDRESS:
+        // an address only write opens every handshake attempt, once connected it is a ready poll
+        if (event.type == traceRead)
+        {
+          kind = kindHandshake;
+        } else if (event.length == 0) {
+          kind = connected ? kindPoll : kindHandshake;
+        } else {
+          command = event.data[0];
+          kind = (command == ERASE_CHIP) ? kindErase :
+                 (command == WRITE_FLASH) ? kindFlashWrite :
+                 (command == READ_FLASH) ? kindFlashRead :
+                 (command == WRITE_CONFIG_BYTE) ? kindConfigWrite :
+                 (command == READ_CONFIG_BYTE) ? kindConfigRead : kindOther;
+        }
+        break;
+      case DATA_ADDRESS:
+        kind = (command == WRITE_FLASH) ? kindFlashWrite :
+               (command == READ_FLASH) ? kindFlashRead :
+               (command == WRITE_CONFIG_BYTE) ? kindConfigWrite :
+               (command == READ_CONFIG_BYTE) ? kindConfigRead : kindOther;
+        break;
+    }
+
+    events.push_back(event);
+    trace.kinds.push_back(kind);
+  }
+
+  trace.events.swap(events);
+}
+
+static bool loadTrace(const char *path, replayTrace &trace)
+{
+  FILE *file = fopen(path, "r");
+  char line[REPLAY_LINE_MAX];
+  char header[REPLAY_LINE_MAX];
+  char *fields[16];
+  unsigned int count;
+  traceEvent_t event;
+  bool shifted = false;
+  uint32_t first;
+  size_t index;
+
+  if (file == NULL)
+  {
+    perror(path);
+    return false;
+  }
+
+  trace.path = path;
+  trace.captured = true;
+  trace.events.clear();
+
+  if (fgets(line, sizeof(line), file) == NULL)
+  {
+    fclose(file);
+    fprintf(stderr, "%s: empty\n", path);
+    return false;
+  }
+
+  strcpy(header, line);
+  count = splitCsv(header, fields, 16);
+
+  if (strncasecmp(line, "Time [s]", 8) == 0)
+  {
+    loadLogic1(file, trace);
+  } else if (findField(fields, count, "start_time") >= 0) {
+    loadLogic2(file, fields, count, trace);
+  } else {
+    trace.captured = false;
+
+    do
+    {
+      if (parseDumpLine(line, event))
+      {
+        trace.events.push_back(event);
+      }
+    } while (fgets(line, sizeof(line), file) != NULL);
+  }
+
+  fclose(file);
+
+  if (trace.events.empty())
+  {
+    fprintf(stderr, "%s: no transactions found\n", path);
+    return false;
+  }
+
+  // analyzer set to show 8 bit addresses (read/write bit included)
+  for (index = 0; index < trace.events.size(); index++)
+  {
+    if ((trace.events[index].type != traceClock) && (trace.events[index].address > 0x7f))
+    {
+      shifted = true;
+    }
+  }
+
+  first = trace.events[0].micros;
+
+  for (index = 0; index < trace.events.size(); index++)
+  {
+    if (shifted && (trace.events[index].type != traceClock))
+    {
+      trace.events[index].address >>= 1;
+    }
+
+    // both traces start at zero
+    trace.events[index].micros -= first;
+  }
+
+  classify(trace);
+
+  return true;
+}
+
+// idle time in front of a transaction
+static unsigned long gapBefore(const replayTrace &trace, const size_t index)
+{
+  unsigned long previousEnd;
+
+  if (index == 0)
+  {
+    return 0;
+  }
+
+  previousEnd = trace.events[index - 1].micros + trace.events[index - 1].duration;
+
+  return (trace.events[index].micros > previousEnd) ? trace.events[index].micros - previousEnd : 0;
+}
+
+static unsigned long cost(const replayTrace &trace, const size_t index)
+{
+  return gapBefore(trace, index) + trace.events[index].duration;
+}
+
+// a capture cannot show a bus timeout, so only whether target took its address counts
+static bool acknowledged(const traceEvent_t &event)
+{
+  return (event.type == traceRead) ? (event.status > 0) : (event.status != 2);
+}
+
+static bool sameTransaction(const traceEvent_t &a, const traceEvent_t &b)
+{
+  if ((a.type != b.type) || (a.address != b.address) || (a.length != b.length) || (acknowledged(a) != acknowledged(b)))
+  {
+    return false;
+  }
+
+  // command, flash address and data bytes tell writes apart, reads only differ by where and how much
+  return (a.type == traceRead) || (memcmp(a.data, b.data, (a.length < TRACE_DATA_BYTES) ? a.length : TRACE_DATA_BYTES) == 0);
+}
+
+static void printTrace(const replayTrace &trace)
+{
+  unsigned long busy = 0;
+  unsigned long idle = 0;
+  unsigned long counts[kindCount] = { 0 };
+  size_t index;
+  uint8_t kind;
+
+  for (index = 0; index < trace.events.size(); index++)
+  {
+    busy += trace.events[index].duration;
+    idle += gapBefore(trace, index);
+    counts[trace.kinds[index]]++;
+  }
+
+  printf("trace=%s transactions=%lu span_us=%lu busy_us=%lu idle_us=%lu\n", trace.path, (unsigned long) trace.events.size(),
+         (unsigned long) (trace.events.back().micros + trace.events.back().duration), busy, idle);
+
+  for (kind = 0; kind < kindCount; kind++)
+  {
+    if (counts[kind] > 0)
+    {
+      printf("  %s=%lu", kindNames[kind], counts[kind]);
+    }
+  }
+  printf("\n");
+}
+
+struct replayMatch
+{
+  size_t ours;
+  size_t reference;
+  long slower;
+};
+
+static void printMatch(const replayTrace &ours, const replayTrace &reference, const replayMatch &match)
+{
+  const traceEvent_t &event = ours.events[match.ours];
+
+  printf("index=%lu ref_index=%lu kind=%s %s=0x%02x len=%u data=%02x%02x%02x gap_us=%lu us=%u ref_gap_us=%lu ref_us=%u slower_us=%ld\n",
+         (unsigned long) match.ours, (unsigned long) match.reference, kindNames[ours.kinds[match.ours]],
+         (event.type == traceRead) ? "read" : "write", event.address, event.length, event.data[0], event.data[1], event.data[2],
+         gapBefore(ours, match.ours), event.duration, gapBefore(reference, match.reference),
+         reference.events[match.reference].duration, match.slower);
+}
+
+// walks both traces in order, a transaction with no partner close ahead in the other trace is left unmatched
+static void compare(const replayTrace &ours, const replayTrace &reference, const replayOptions &options)
+{
+  std::vector<replayMatch> matches;
+  long slower[kindCount] = { 0 };
+  unsigned long matched[kindCount] = { 0 };
+  unsigned long unmatchedOurs = 0;
+  unsigned long unmatchedOursMicros = 0;
+  unsigned long unmatchedReference = 0;
+  unsigned long unmatchedReferenceMicros = 0;
+  size_t a = 0;
+  size_t b = 0;
+  size_t ahead;
+  size_t index;
+  uint8_t kind;
+
+  while ((a < ours.events.size()) && (b < reference.events.size()))
+  {
+    if (sameTransaction(ours.events[a], reference.events[b]))
+    {
+      replayMatch match = { a, b, (long) cost(ours, a) - (long) cost(reference, b) };
+
+      matches.push_back(match);
+      matched[ours.kinds[a]]++;
+      slower[ours.kinds[a]] += match.slower;
+      a++;
+      b++;
+      continue;
+    }
+
+    // whichever side has the partner closer ahead skips its extra transactions
+    for (ahead = 1; ahead < REPLAY_LOOKAHEAD; ahead++)
+    {
+      if ((b + ahead < reference.events.size()) && sameTransaction(ours.events[a], reference.events[b + ahead]))
+      {
+        unmatchedReference++;
+        unmatchedReferenceMicros += cost(reference, b);
+        b++;
+        break;
+      }
+
+      if ((a + ahead < ours.events.size()) && sameTransaction(ours.events[a + ahead], reference.events[b]))
+      {
+        unmatchedOurs++;
+        unmatchedOursMicros += cost(ours, a);
+        a++;
+        break;
+      }
+    }
+
+    if (ahead == REPLAY_LOOKAHEAD)
+    {
+      unmatchedOurs++;
+      unmatchedOursMicros += cost(ours, a);
+      unmatchedReference++;
+      unmatchedReferenceMicros += cost(reference, b);
+      a++;
+      b++;
+    }
+  }
+
+  for (; a < ours.events.size(); a++)
+  {
+    unmatchedOurs++;
+    unmatchedOursMicros += cost(ours, a);
+  }
+
+  for (; b < reference.events.size(); b++)
+  {
+    unmatchedReference++;
+    unmatchedReferenceMicros += cost(reference, b);
+  }
+
+  // positive is time this flasher spends on top of the reference
+  for (kind = 0; kind < kindCount; kind++)
+  {
+    if (matched[kind] > 0)
+    {
+      printf("kind=%s matched=%lu slower_us=%ld\n", kindNames[kind], matched[kind], slower[kind]);
+    }
+  }
+
+  printf("unmatched=%lu unmatched_us=%lu ref_unmatched=%lu ref_unmatched_us=%lu\n", unmatchedOurs, unmatchedOursMicros,
+         unmatchedReference, unmatchedReferenceMicros);
+
+  if (options.all)
+  {
+    for (index = 0; index < matches.size(); index++)
+    {
+      printMatch(ours, reference, matches[index]);
+    }
+    return;
+  }
+
+  // worst single transactions, selection is fine for the few asked for
+  for (index = 0; (index < options.top) && (index < matches.size()); index++)
+  {
+    size_t worst = index;
+
+    for (size_t other = index + 1; other < matches.size(); other++)
+    {
+      if (matches[other].slower > matches[worst].slower)
+      {
+        worst = other;
+      }
+    }
+
+    std::swap(matches[index], matches[worst]);
+    printMatch(ours, reference, matches[index]);
+  }
+}
+
+// every transaction at the time it was recorded, answers of the model compared with the recorded ones
+static unsigned int replay(const replayTrace &trace, const replayOptions &options, Ob38s003Sim &target)
+{
+  const unsigned long startMicros = micros();
+  const unsigned long timeoutMicros = trace.captured ? REPLAY_CAPTURE_TIMEOUT_US : REPLAY_DUMP_TIMEOUT_US;
+  uint8_t buffer[256];
+  unsigned int mismatches = 0;
+  unsigned long powerOnMicros = 0;
+  bool powered = false;
+  unsigned long due;
+  uint8_t status;
+  size_t index;
+
+  // nobody knows when the recorded target got power, so assume just in time for the first acknowledged reset
+  for (index = 0; index < trace.events.size(); index++)
+  {
+    const traceEvent_t &event = trace.events[index];
+
+    if ((event.type == traceWrite) && (event.address == RESET_CHIP) && (event.status == 0))
+    {
+      powerOnMicros = (event.micros > target.config.powerUpMicros) ? event.micros - target.config.powerUpMicros : 0;
+      break;
+    }
+  }
+
+  for (index = 0; index < trace.events.size(); index++)
+  {
+    const traceEvent_t &event = trace.events[index];
+
+    // no later than that, a transaction in progress would push it back
+    if (!powered && ((index + 1 == trace.events.size()) || (trace.events[index + 1].micros > powerOnMicros)))
+    {
+      target.powerOn();
+      powered = true;
+    }
+
+    due = startMicros + event.micros;
+    if ((long) (due - micros()) > 0)
+    {
+      hostAdvanceMicros(due - micros());
+    }
+
+    if (event.type == traceWrite)
+    {
+      status = target.write(event.address, event.data, (event.length < TRACE_DATA_BYTES) ? event.length : TRACE_DATA_BYTES,
+                            options.clockHz, timeoutMicros);
+    } else {
+      status = target.read(event.address, buffer, event.length, options.clockHz, timeoutMicros);
+    }
+
+    if ((status != event.status) || ((event.type == traceRead) && (memcmp(buffer, event.data, (status < TRACE_DATA_BYTES) ? status : TRACE_DATA_BYTES) != 0)))
+    {
+      if (mismatches < 20)
+      {
+        printf("replay index=%lu kind=%s %s=0x%02x recorded=%u model=%u\n", (unsigned long) index, kindNames[trace.kinds[index]],
+               (event.type == traceRead) ? "read" : "write", event.address, event.status, status);
+      }
+      mismatches++;
+    }
+  }
+
+  printf("replay transactions=%lu mismatches=%u model_bus_us=%lu\n", (unsigned long) trace.events.size(), mismatches,
+         target.counters.busMicros);
+
+  return mismatches;
+}
+
+static void usage(void)
+{
+  printf("usage: traceReplay [--replay] [--all] [--top=n] [--clock=hz] [simulated target options] trace [reference]\n");
+  printf("  trace and reference are trace dumps (\"T <hex>\" lines) or Saleae Logic 1.x/2 i2c csv exports\n");
+  printf("  with a reference, reports where trace is slower per kind of transaction and the worst single ones\n");
+  printf("  --replay sends trace to the simulated target and reports where the model answers differently\n");
+  ob38s003SimUsage();
+}
+
+int main(int argc, char **argv)
+{
+  replayOptions options = { false, false, 10, 100000 };
+  Ob38s003SimConfig simConfig;
+  replayTrace traces[2];
+  unsigned int count = 0;
+  int index;
+
+  for (index = 1; index < argc; index++)
+  {
+    if (strcmp(argv[index], "--replay") == 0)
+    {
+      options.replay = true;
+    } else if (strcmp(argv[index], "--all") == 0) {
+      options.all = true;
+    } else if (strncmp(argv[index], "--top=", 6) == 0) {
+      options.top = strtoul(argv[index] + 6, NULL, 0);
+    } else if (strncmp(argv[index], "--clock=", 8) == 0) {
+      options.clockHz = strtoul(argv[index] + 8, NULL, 0);
+    } else if ((argv[index][0] != '-') && (count < 2)) {
+      if (!loadTrace(argv[index], traces[count]))
+      {
+        return 1;
+      }
+      count++;
+    } else if (!ob38s003SimOption(argv[index], simConfig)) {
+      usage();
+      return 2;
+    }
+  }
+
+  if (count == 0)
+  {
+    usage();
+    return 2;
+  }
+
+  for (index = 0; index < (int) count; index++)
+  {
+    printTrace(traces[index]);
+  }
+
+  if (count == 2)
+  {
+    compare(traces[0], traces[1], options);
+  }
+
+  if (options.replay)
+  {
+    Ob38s003Sim target(simConfig);
+
+    return replay(traces[0], options, target) ? 1 : 0;
+  }
+
+  return 0;
+}
@@ -1,16 +1,56 @@
 #include "ihx.h"
 #include <Arduino.h>
 
-static const char *conv = "0123456789ABCDEFabcdef";
-static uint8_t value_of_hex(uint8_t ch) {
-  uint8_t i = 0;
-  //Loop through list
-  while (conv[i] && ch != conv[i]) i++;
-
-  if (!conv[i]) return 0;
-  //Convert to upper case
-  if (i >= 16) return i - 6; // lowercase
-  return i;
+// Value of every character as a hex digit, IHX_BAD_DIGIT if it is not one
+// Kept in flash on AVR, where 256 bytes of RAM is a lot
+#define X IHX_BAD_DIGIT
+#if defined(__AVR__)
+static const uint8_t hex_table[256] PROGMEM = {
+#else
+static const uint8_t hex_table[256] = {
+#endif
+  X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+  X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+  X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, X, X, X, X, X, X,
+  X, 10, 11, 12, 13, 14, 15, X, X, X, X, X, X, X, X, X,
+  X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+  X, 10, 11, 12, 13, 14, 15, X, X, X, X, X, X, X, X, X,
+  X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+  X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+  X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+  X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+  X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+  X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+  X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+  X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+  X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X
+};
+#undef X
+
+#if defined(__AVR__)
+#define HEX_VALUE(ch) pgm_read_byte(&hex_table[(uint8_t) (ch)])
+#else
+#define HEX_VALUE(ch) hex_table[(uint8_t) (ch)]
+#endif
+
+uint8_t ihx_hex_digit(uint8_t ch) {
+  return HEX_VALUE(ch);
+}
+
+uint8_t ihx_hex_decode(const uint8_t *text, uint8_t *out, uint16_t count) {
+  // Any bad digit sets the high nibble, checked once at the end instead of per byte
+  uint8_t bad = 0;
+  uint8_t hi, lo;
+
+  for (uint16_t i = 0; i < count; ++i) {
+    hi = HEX_VALUE(text[2 * i]);
+    lo = HEX_VALUE(text[2 * i + 1]);
+    bad |= hi | lo;
+    out[i] = (hi << 4) | (lo & 0x0F);
+  }
+
+  return (bad & 0xF0) ? IHX_ERROR : IHX_SUCCESS;
 }
 
 uint8_t ihx_decode(uint8_t *buff, uint16_t slen) {
@@ -40,10 +80,16 @@ uint8_t ihx_decode(uint8_t *buff, uint16_t slen) {
     return IHX_ERROR;
   }
 
-  // Decode
+  // Decode in place, each byte lands before the digits it came from
+  if (ihx_hex_decode(buff + 1, buff, (slen - 1) / 2) != IHX_SUCCESS) {
+#ifdef IHX_DEBUG
+    Serial.println(F("IHX: Bad hex digit"));
+#endif
+    return IHX_ERROR;
+  }
+
   uint8_t cs = 0;
   for (int i = 0; i < (slen - 1) / 2; ++i) {
-    buff[i] = (value_of_hex(buff[2 * i + 1]) << 4) | value_of_hex(buff[2 * i + 2]);
     cs += buff[i];
   }
 
@@ -68,4 +114,61 @@ uint8_t ihx_decode(uint8_t *buff, uint16_t slen) {
   return IHX_SUCCESS;
 }
 
+void ihx_scan_begin(ihx_scan_t *scan) {
+  scan->base = 0;
+  scan->records = 0;
+  scan->offset = 0;
+  scan->done = 0;
+}
+
+uint8_t ihx_scan(ihx_scan_t *scan, uint8_t *buff, size_t size, uint8_t final, ihx_callback_t callback, void *context) {
+  size_t start = 0;
+  size_t end;
+  uint8_t err;
 
+  scan->offset = 0;
+
+  while (!scan->done) {
+    // Skip line endings and anything else up to the next record
+    while (start < size && buff[start] != ':') start++;
+
+    scan->offset = start;
+    if (start >= size) return IHX_SUCCESS;
+
+    end = start + 1;
+    while (end < size && buff[end] != '\n' && buff[end] != '\r') end++;
+
+    // Rest of the record is still to come
+    if (end >= size && !final) return IHX_SUCCESS;
+
+    // Longer than any record could be
+    if (end - start > 11 + 2 * 255) return IHX_ERROR;
+
+    if (ihx_decode(buff + start, end - start) != IHX_SUCCESS) return IHX_ERROR;
+
+    ihx_t *h = (ihx_t *) (buff + start);
+    uint32_t address = scan->base + h->address_high * 0x100 + h->address_low;
+
+    err = callback(context, h, address);
+    if (err) return err;
+
+    scan->records++;
+
+    switch (h->record_type) {
+      case IHX_RT_EXTENDED_SEGMENT_ADDRESS:
+        if (h->len == 2) scan->base = ((uint32_t) h->data[0] << 12) | ((uint32_t) h->data[1] << 4);
+        break;
+      case IHX_RT_EXTENDED_LINEAR_ADDRESS:
+        if (h->len == 2) scan->base = ((uint32_t) h->data[0] << 24) | ((uint32_t) h->data[1] << 16);
+        break;
+      case IHX_RT_END_OF_FILE:
+        scan->done = 1;
+        break;
+    }
+
+    start = end;
+    scan->offset = start;
+  }
+
+  return IHX_SUCCESS;
+}
@@ -1,6 +1,7 @@
 #ifndef IHX_H
 #define IHX_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 // Decoded
@@ -31,8 +32,45 @@ struct ihx_t {
 #define IHX_SUCCESS 0x00
 #define IHX_ERROR   0xFF
 
+// Hex digits
+// Every character maps to its value through a 256 entry table, anything that
+// is not a hex digit (either case) is rejected rather than read as 0.
+// Shared by ihx_decode() and the serial line parser (simpleParser.cpp).
+#define IHX_BAD_DIGIT 0xFF
+
+extern uint8_t ihx_hex_digit(uint8_t ch);
+
+// count bytes from 2 * count digits, returns IHX_ERROR if any of them is not a hex digit
+// out may be the same buffer as text, or start before it, as ihx_decode() does
+extern uint8_t ihx_hex_decode(const uint8_t *text, uint8_t *out, uint16_t count);
+
 extern uint8_t ihx_decode(uint8_t *buff, uint16_t slen);
 
+// Scanning
+// Walks a buffer of hex text in place. Every record is decoded where it lies
+// (overwriting its text) and handed to the callback without being copied.
+// Lines may end in \n, \r\n or \r, anything between records is skipped.
+// Extended segment/linear address records move the base added to the
+// address of the data records that follow, every record (including those)
+// is still handed to the callback. Scanning ends after an end of file record.
+struct ihx_scan_t {
+  uint32_t base;     // from the last extended address record
+  uint32_t records;  // handed to the callback so far
+  size_t   offset;   // where scanning stopped, the start of a bad or incomplete record
+  uint8_t  done;     // end of file record seen
+};
+
+// address is the absolute address of the first data byte, a non zero return stops the scan
+typedef uint8_t (*ihx_callback_t)(void *context, const ihx_t *record, uint32_t address);
+
+extern void ihx_scan_begin(ihx_scan_t *scan);
+
+// returns IHX_SUCCESS once every complete record in the buffer was handed on,
+// a record cut off by the end of the buffer is left at scan->offset for the next call
+// (e.g., with more of a stream after it), unless final is set, then it is decoded as is
+// returns IHX_ERROR for a record that does not decode, or whatever non zero the callback returned
+extern uint8_t ihx_scan(ihx_scan_t *scan, uint8_t *buff, size_t size, uint8_t final, ihx_callback_t callback, void *context);
+
 #endif // IHX_H
 
 // This is to enforce arduino-like formatting in kate
@@ -0,0 +1,130 @@
+/*
+  imageChecksum.cpp - running sum of the image written since the last erase
+  Copyright (c) 2023 Jonathan Armstrong.  All right reserved.
+*/
+
+#include "imageChecksum.h"
+
+ImageChecksum::ImageChecksum(void)
+{
+  reset();
+}
+
+void ImageChecksum::reset(void)
+{
+  memset(blockSum, 0, sizeof(blockSum));
+  memset(blockCount, 0, sizeof(blockCount));
+
+  clearBlockCrcs();
+}
+
+void ImageChecksum::forget(const uint16_t blocks)
+{
+  unsigned char index;
+
+  for (index = 0; index < FLASH_BLOCKS; index++)
+  {
+    if (blocks & (1 << index))
+    {
+      blockSum[index] = 0;
+      blockCount[index] = 0;
+    }
+  }
+}
+
+void ImageChecksum::add(const unsigned int flashAddress, const unsigned char* flashbyte, const unsigned int length)
+{
+  unsigned int address;
+  unsigned int index;
+
+  for (index = 0; index < length; index++)
+  {
+    address = flashAddress + index;
+
+    // outside target flash, nothing to compare against
+    if (address >= FLASH_BLOCKS * BLOCK_SIZE)
+    {
+      break;
+    }
+
+    blockSum[address / BLOCK_SIZE] += flashbyte[index];
+    blockCount[address / BLOCK_SIZE]++;
+  }
+}
+
+void ImageChecksum::add(const unsigned char index, const uint32_t sum, const uint16_t count)
+{
+  if (index >= FLASH_BLOCKS)
+  {
+    return;
+  }
+
+  blockSum[index] += sum;
+  blockCount[index] += count;
+}
+
+uint32_t ImageChecksum::block(const unsigned char index, const unsigned char fill)
+{
+  // a block written more than once cannot be described by a sum, treat it as full
+  const uint16_t count = (blockCount[index] < BLOCK_SIZE) ? blockCount[index] : BLOCK_SIZE;
+
+  return blockSum[index] + (uint32_t) (BLOCK_SIZE - count) * fill;
+}
+
+uint32_t ImageChecksum::total(const unsigned char fill)
+{
+  uint32_t sum = 0;
+  unsigned char index;
+
+  for (index = 0; index < FLASH_BLOCKS; index++)
+  {
+    sum += block(index, fill);
+  }
+
+  return sum;
+}
+
+unsigned int ImageChecksum::length(void)
+{
+  unsigned int count = 0;
+  unsigned char index;
+
+  for (index = 0; index < FLASH_BLOCKS; index++)
+  {
+    count += blockCount[index];
+  }
+
+  return count;
+}
+
+void ImageChecksum::setBlockCrc(const unsigned char index, const uint16_t crc)
+{
+  if (index >= FLASH_BLOCKS)
+  {
+    return;
+  }
+
+  expectedCrc[index] = crc;
+  crcMask |= (1 << index);
+}
+
+void ImageChecksum::clearBlockCrcs(void)
+{
+  memset(expectedCrc, 0, sizeof(expectedCrc));
+  crcMask = 0;
+}
+
+bool ImageChecksum::hasBlockCrc(const unsigned char index)
+{
+  return (crcMask & (1 << index)) != 0;
+}
+
+uint16_t ImageChecksum::blockCrc(const unsigned char index)
+{
+  return expectedCrc[index];
+}
+
+uint16_t ImageChecksum::blockCrcMask(void)
+{
+  return crcMask;
+}
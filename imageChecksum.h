@@ -0,0 +1,56 @@
+/*
+  imageChecksum.h - running sum of the image written since the last erase, and the block crcs host expects
+  Copyright (c) 2023 Jonathan Armstrong.  All right reserved.
+
+  Sums are kept per 512 byte block together with how many bytes were written,
+  so the checksum of the whole image can be given for either fill value of the
+  bytes the image does not cover, and a single block can be checked on its own.
+*/
+
+#ifndef Image_checksum_h
+#define Image_checksum_h
+
+#include <Arduino.h>
+
+#include "onbrightFlasher.h"
+
+class ImageChecksum
+{
+  public:
+    ImageChecksum(void);
+
+    // forget everything, e.g. after the chip was erased
+    void reset(void);
+
+    // blocks about to be written again, e.g. the ones a resumed upload sends
+    void forget(const uint16_t blocks);
+
+    // account for bytes that were written successfully
+    void add(const unsigned int flashAddress, const unsigned char* flashbyte, const unsigned int length);
+    // same for bytes of one block summed by the caller, e.g. a staged block once it has been written
+    void add(const unsigned char index, const uint32_t sum, const uint16_t count);
+
+    // sum of all flash bytes with uncovered bytes read as fill
+    // 0xFF is what an erased chip holds, 0x00 is the other choice the stock programmer offers
+    uint32_t total(const unsigned char fill);
+    uint32_t block(const unsigned char index, const unsigned char fill);
+
+    // number of bytes added so far
+    unsigned int length(void);
+
+    // crc16 host expects each block to read back with, blocks without one are checked by sum
+    void setBlockCrc(const unsigned char index, const uint16_t crc);
+    void clearBlockCrcs(void);
+    bool hasBlockCrc(const unsigned char index);
+    uint16_t blockCrc(const unsigned char index);
+    uint16_t blockCrcMask(void);
+
+  private:
+    uint32_t blockSum[FLASH_BLOCKS];
+    uint16_t blockCount[FLASH_BLOCKS];
+
+    uint16_t expectedCrc[FLASH_BLOCKS];
+    uint16_t crcMask;
+};
+
+#endif
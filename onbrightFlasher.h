@@ -10,9 +10,7 @@
 // for byte type
 #include <Arduino.h>
 
-// array sizes
-#define CONFIG_BYTES_MAX   255
-#define FILE_ARRAY_MAX   32767
+#include "flasherStats.h"
 
 // advice on switching between SoftWire and Wire libraries
 // [https://arduino-craft-corner.de/index.php/2023/11/29/replacing-the-wire-library-sometimes/]
@@ -41,6 +39,9 @@
 // config bytes
 #define CHIP_TYPE_BYTE 0x00
 
+// value read from CHIP_TYPE_BYTE
+#define CHIP_TYPE_OB38S003 0x0A
+
 #define CONFIG_BYTE01 0x11
 #define CONFIG_BYTE02 0x12
 #define CONFIG_BYTE03 0x13
@@ -58,8 +59,35 @@
 // seems to be enough to achieve handshake
 #define MAX_HANDSHAKE_RETRIES 10
 
+// acquireHandshake() gives the rest of the system (e.g., esp watchdog) a turn this often
+#define ACQUIRE_YIELD_MICROS 1000
+
+// target does not acknowledge (or holds the clock) while it erases or programs
+// these bound how long it is polled before giving up
+#define ERASE_READY_TIMEOUT_MS 1000
+#define WRITE_READY_TIMEOUT_US 5000
+
+// largest number of flash bytes requested in a single requestFrom()
+// must fit the receive buffer of every supported library (AVR Wire has only 32 bytes)
+#define FLASH_BURST_MAX 32
+
+// whether target advances its address by itself during a multi byte read or
+// between consecutive data writes
+enum { burstUnknown,
+       burstSupported,
+       burstUnsupported
+};
+
 // target flash memory addresses
 #define BLOCK_SIZE 512
+#define FLASH_BLOCKS 16
+
+// chip profile, buffers on the flasher side are sized from these
+#define FLASH_SIZE  (FLASH_BLOCKS * BLOCK_SIZE)
+#define CONFIG_SIZE 64
+
+// every flash byte reads this after a chip erase
+#define FLASH_ERASED_VALUE 0xFF
 
 enum { block00 = 0x0000,
        block01 = 0x0200,
@@ -79,33 +107,185 @@ enum { block00 = 0x0000,
        block15 = 0x1E00
 };
 
+// told about everything that changes or reveals what target flash holds, e.g. FlashShadow (flashShadow.h)
+class FlashListener
+{
+  public:
+    // nothing is known anymore, e.g. after a power cycle, handshake, reset or the start of an erase
+    virtual void flashInvalidated(void) = 0;
+    // a write failed somewhere in this range, target may hold anything there
+    virtual void flashInvalidated(const unsigned int flashAddress, const unsigned int length) = 0;
+    virtual void flashErased(void) = 0;
+    // acknowledged by target, flash can only clear bits so this may not be all that target holds now
+    virtual void flashWritten(const unsigned int flashAddress, const unsigned char* flashbyte, const unsigned int length) = 0;
+    virtual void flashRead(const unsigned int flashAddress, const unsigned char* flashbyte, const unsigned int length) = 0;
+};
+
+// a bus policy provides the two kinds of i2c transaction the protocol needs
+// (see wireBus.h for the Arduino libraries):
+//
+//   byte write(const uint8_t address, const uint8_t* data, const uint8_t length);
+//     address (plus data if any) in one transaction, returns a Wire style status
+//     (0 success, 2 nack on address, 3 nack on data, 4 other error, 5 timeout)
+//
+//   uint8_t read(const uint8_t address, uint8_t* data, const uint8_t length);
+//     returns number of bytes actually received into data
+//
+// it is held by value, so a policy is usually just a reference to a bus object
+
 // library interface description
+template <class Bus>
 class OnbrightFlasher
 {
   // user-accessible "public" interface
   public:
+    OnbrightFlasher(const Bus &i2c);
 
     byte eraseChip(void);
+
+    // eraseChip() in steps, so a caller can do other work while target erases
+    // beginErase() sends the command, every pollErase() checks target once and returns true
+    // when the erase is over, result is then what eraseChip() would have returned
+    byte beginErase(void);
+    bool pollErase(byte &result);
+    // stops waiting, flash is not considered erased afterwards
+    void abortErase(void);
+    bool isErasing(void);
+
     bool onbrightHandshake(void);
 
+    // tight version of onbrightHandshake() for catching the short window after power up
+    // beginAcquire() starts the clock, then acquireHandshake() sends RESET_CHIP every pollMicros
+    // for up to durationMicros and returns true once target acknowledged and the handshake is done
+    // it may be called again to keep trying, e.g. in slices
+    void beginAcquire(void);
+    bool acquireHandshake(const unsigned long pollMicros, const unsigned long durationMicros);
+
+    // since beginAcquire(): when the bus last went from failing to nacking (i.e. target was powered),
+    // zero if it was never seen, and when target first acknowledged RESET_CHIP
+    unsigned long getPowerEdgeMicros(void);
+    unsigned long getFirstAckMicros(void);
+    unsigned long getAcquirePolls(void);
+
     byte readConfigByte(const unsigned char address, unsigned char &configByte);
     byte writeConfigByte(const unsigned char address, const unsigned char configByte);
 
-    byte readConfigBlock(const unsigned char address, unsigned char (&configByte)[CONFIG_BYTES_MAX], const unsigned char length);
+    // caller provides room for length bytes
+    byte readConfigBlock(const unsigned char address, unsigned char* configByte, const unsigned char length);
 
     byte readFlashByte(const unsigned int address, unsigned char &flashByte);
     byte writeFlashByte(const unsigned int address, const unsigned char flashByte);
 
-    byte readFlashBlock(const unsigned int flashAddress, unsigned char (&flashbyte)[FILE_ARRAY_MAX], const unsigned int length);
+    // caller provides room for length bytes, any length works so large ranges can be read in pieces
+    byte readFlashBlock(const unsigned int flashAddress, unsigned char* flashbyte, const unsigned int length);
     byte writeFlashBlock(const unsigned int flashAddress, unsigned char* flashbyte, const unsigned int length);
 
+    // one address phase followed by a single multi byte read
+    byte readFlashBurst(const unsigned int flashAddress, unsigned char* flashbyte, const unsigned char length);
+
+    // burst reads are used once target is confirmed to auto increment
+    void setBurstRead(const bool enable);
+    unsigned char getBurstReadMode(void);
+
+    // streaming writes send the address once per run of consecutive bytes
+    // auto increment is detected on an erased target without risking already written bytes
+    void setBurstWrite(const bool enable);
+    unsigned char getBurstWriteMode(void);
+
+    // called for every byte writeFlashBlock() failed to write
+    void setWriteErrorHandler(void (*handler)(const unsigned int flashAddress, const unsigned char flashByte, const byte result));
+
+    // failures during the last writeFlashBlock()
+    unsigned int getWriteErrors(void);
+
+    // erases, flash reads and writes that succeeded and anything that makes flash contents unknown
+    // are passed on to the listener, none by default
+    void setListener(FlashListener *flashListener);
+
+    // writeFlashBlock() leaves out bytes equal to the erased value in blocks known to be erased
+    // blocks are marked by eraseChip() and forgotten at the next handshake
+    void setSkipErased(const bool enable);
+    bool getSkipErased(void);
+    bool isBlockErased(const unsigned int flashAddress);
+
+    // bytes left out and erased blocks nothing was written to since the last erase
+    unsigned long getSkippedBytes(void);
+    unsigned char getUntouchedBlocks(void);
+
+    // how long target stayed busy, i.e. until it acknowledged a poll (so at least one address byte)
+    // erase is the last eraseChip(), write is the longest wait after a write since then
+    unsigned long getEraseBusyMicros(void);
+    unsigned long getWriteBusyMicros(void);
+    unsigned long getBusyPolls(void);
+
+    // sum of all flash bytes as reported by the chip in FLASH_CHECKSUM01..04
+    // byte order is assumed to be little endian (FLASH_CHECKSUM01 least significant)
+    byte readFlashChecksum(uint32_t &checksum);
+
     byte readChipType(unsigned char& chipType);
     void resetMCU(void);
 
+    // transfers and latency of every operation since the last getStats().reset()
+    FlasherStats &getStats(void);
+
   // library-accessible "private" interface
   private:
-    int dummyVariable;
+    Bus bus;
+
+    // every transfer goes through these so it is counted
+    byte busWrite(const uint8_t address, const uint8_t* data, const uint8_t length);
+    uint8_t busRead(const uint8_t address, uint8_t* data, const uint8_t length);
+
+    void finishHandshake(void);
+    byte pollReady(const unsigned long timeoutMicros);
+    byte writeWhenReady(const uint8_t address, const unsigned char* data, const uint8_t length);
+    void writeBusy(const unsigned long busyMicros);
+    byte writeFlashAddress(const unsigned int flashAddress);
+    byte writeFlashData(const unsigned char flashByte);
+    bool probeBurstWrite(const unsigned int flashAddress, unsigned char* flashbyte);
+    void writeError(const unsigned int flashAddress, const unsigned char flashByte, const byte result);
+    bool isErasedByte(const unsigned int flashAddress, const unsigned char flashByte);
+    uint16_t blockMask(const unsigned int flashAddress);
+
+    bool burstReadEnabled;
+    unsigned char burstReadMode;
+
+    bool burstWriteEnabled;
+    unsigned char burstWriteMode;
+
+    void (*writeErrorHandler)(const unsigned int flashAddress, const unsigned char flashByte, const byte result);
+    unsigned int writeErrors;
+
+    FlashListener *listener;
+
+    // one bit per block
+    bool skipErasedEnabled;
+    uint16_t erasedBlocks;
+    uint16_t writtenBlocks;
+    unsigned long skippedBytes;
+
+    // see beginAcquire()
+    unsigned long acquireStartMicros;
+    unsigned long powerEdgeMicros;
+    unsigned long firstAckMicros;
+    unsigned long acquirePolls;
+    byte lastPollResult;
+
+    // erase in progress, see beginErase()
+    bool erasing;
+    byte eraseResult;
+    unsigned long eraseStartMicros;
+
+    // when target last acknowledged a poll
+    unsigned long readyMicros;
+    unsigned long eraseBusyMicros;
+    unsigned long writeBusyMicros;
+    unsigned long busyPolls;
+
+    FlasherStats stats;
 };
 
+#include "onbrightFlasherImpl.h"
+
 #endif
 
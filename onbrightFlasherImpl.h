@@ -0,0 +1,1050 @@
+/*
+  onbrightFlasherImpl.h -  implementation
+  Copyright (c) 2023 Jonathan Armstrong.  All right reserved.
+
+  Included at the end of onbrightFlasher.h, a class template has to be visible
+  wherever it is used with a new bus policy.
+*/
+
+// ensure this implementation is only included once
+#ifndef Onbright_flasher_impl_h
+#define Onbright_flasher_impl_h
+
+// Constructor /////////////////////////////////////////////////////////////////
+// Function that handles the creation and setup of instances
+
+template <class Bus>
+OnbrightFlasher<Bus>::OnbrightFlasher(const Bus &i2c) : bus(i2c)
+{
+  burstReadEnabled = true;
+  burstReadMode = burstUnknown;
+
+  burstWriteEnabled = true;
+  burstWriteMode = burstUnknown;
+
+  writeErrorHandler = NULL;
+  writeErrors = 0;
+
+  listener = NULL;
+
+  skipErasedEnabled = true;
+  erasedBlocks = 0;
+  writtenBlocks = 0;
+  skippedBytes = 0;
+
+  acquireStartMicros = 0;
+  powerEdgeMicros = 0;
+  firstAckMicros = 0;
+  acquirePolls = 0;
+  lastPollResult = 0;
+
+  erasing = false;
+  eraseResult = 0;
+  eraseStartMicros = 0;
+
+  readyMicros = 0;
+  eraseBusyMicros = 0;
+  writeBusyMicros = 0;
+  busyPolls = 0;
+}
+
+// Public Methods //////////////////////////////////////////////////////////////
+// Functions available in Wiring sketches, this library, and other libraries
+
+template <class Bus>
+FlasherStats &OnbrightFlasher<Bus>::getStats(void)
+{
+  return stats;
+}
+
+
+// Private Methods /////////////////////////////////////////////////////////////
+// Functions only available to other functions in this library
+
+template <class Bus>
+byte OnbrightFlasher<Bus>::busWrite(const uint8_t address, const uint8_t* data, const uint8_t length)
+{
+  const byte result = bus.write(address, data, length);
+
+  stats.written(result, length);
+
+  return result;
+}
+
+template <class Bus>
+uint8_t OnbrightFlasher<Bus>::busRead(const uint8_t address, uint8_t* data, const uint8_t length)
+{
+  const uint8_t count = bus.read(address, data, length);
+
+  stats.received(length, count);
+
+  return count;
+}
+
+template <class Bus>
+bool OnbrightFlasher<Bus>::onbrightHandshake(void)
+{
+  // store result of i2c operation (success, ack, nack, timeout, etc.)
+  byte result;
+  unsigned int index;
+
+  // this is the only ack we take into account to decide success/failure
+  bool gotFirstAck = false;
+
+  stats.begin(statsHandshake);
+
+  // indicate an address write with no actual data write as per captured protocol
+  result = busWrite(DEVICE_ADDRESS, NULL, 0);
+
+  // we set maximum retries based on typical amount seen in traces
+  for (index = 0; index < MAX_HANDSHAKE_RETRIES; index++)
+  {
+    if (index > 0)
+    {
+      stats.retry();
+    }
+
+    result = busWrite(RESET_CHIP, NULL, 0);
+
+    // at first we will receive nacks, however
+    // if we received ack, proceed with the rest of the handshake
+    if (result == 0)
+    {
+      finishHandshake();
+
+      //Serial.print("Retried times: ");
+      //Serial.println(index);
+      //Serial.println("Tried handshake 01+02+Read");
+      //Serial.print("Result: ");
+      //Serial.println(result);
+
+      // let calling function know we succeeded with handshake
+      gotFirstAck = true;
+
+      // break out of loop
+      index = MAX_HANDSHAKE_RETRIES;
+    }
+  }
+
+  stats.end();
+
+  return gotFirstAck;
+}
+
+template <class Bus>
+void OnbrightFlasher<Bus>::beginAcquire(void)
+{
+  // target is (about to be) power cycled
+  if (listener != NULL)
+  {
+    listener->flashInvalidated();
+  }
+
+  acquireStartMicros = micros();
+  powerEdgeMicros = 0;
+  firstAckMicros = 0;
+  acquirePolls = 0;
+
+  // nothing seen yet, so the first poll cannot be an edge
+  lastPollResult = 0;
+}
+
+template <class Bus>
+bool OnbrightFlasher<Bus>::acquireHandshake(const unsigned long pollMicros, const unsigned long durationMicros)
+{
+  const unsigned long startTime = micros();
+  unsigned long pollTime = startTime;
+  unsigned long yieldTime = startTime;
+  byte result;
+
+  stats.begin(statsHandshake);
+
+  // same opener as onbrightHandshake()
+  busWrite(DEVICE_ADDRESS, NULL, 0);
+
+  do
+  {
+    if (acquirePolls++ > 0)
+    {
+      stats.retry();
+    }
+
+    pollTime = micros();
+    result = busWrite(RESET_CHIP, NULL, 0);
+
+    // an unpowered target tends to drag the lines down, so transfers fail outright
+    // instead of being nacked, once powered it nacks until its handshake window opens
+    if (((result == 0) || (result == 2)) && (lastPollResult != 0) && (lastPollResult != 2))
+    {
+      powerEdgeMicros = pollTime - acquireStartMicros;
+    }
+    lastPollResult = result;
+
+    if (result == 0)
+    {
+      firstAckMicros = pollTime - acquireStartMicros;
+      finishHandshake();
+
+      stats.end();
+      return true;
+    }
+
+    if (micros() - yieldTime >= ACQUIRE_YIELD_MICROS)
+    {
+      yield();
+      yieldTime = micros();
+    }
+
+    // poll interval counts from the start of one poll to the next
+    if (micros() - pollTime < pollMicros)
+    {
+      delayMicroseconds(pollMicros - (micros() - pollTime));
+    }
+  } while (micros() - startTime < durationMicros);
+
+  stats.end();
+
+  return false;
+}
+
+template <class Bus>
+unsigned long OnbrightFlasher<Bus>::getPowerEdgeMicros(void)
+{
+  return powerEdgeMicros;
+}
+
+template <class Bus>
+unsigned long OnbrightFlasher<Bus>::getFirstAckMicros(void)
+{
+  return firstAckMicros;
+}
+
+template <class Bus>
+unsigned long OnbrightFlasher<Bus>::getAcquirePolls(void)
+{
+  return acquirePolls;
+}
+
+// target acknowledged RESET_CHIP, the rest of the sequence as captured from the official programmer
+template <class Bus>
+void OnbrightFlasher<Bus>::finishHandshake(void)
+{
+  unsigned char ignored;
+
+  busWrite(HANDSHAKE01, NULL, 0);
+  busWrite(HANDSHAKE02, NULL, 0);
+
+  // no actual read seems to be performed
+  busRead(DEVICE_ADDRESS, &ignored, 1);
+
+  // Wire libraries repeat the last address written when ending a transmission that was never begun
+  busWrite(HANDSHAKE02, NULL, 0);
+
+  // could be a different chip than last time
+  burstReadMode = burstUnknown;
+  burstWriteMode = burstUnknown;
+
+  // nothing is known about its flash contents either
+  erasedBlocks = 0;
+
+  if (listener != NULL)
+  {
+    listener->flashInvalidated();
+  }
+}
+
+// should be 0x0A for OnBright OBS38S003 8051 based microcontroller
+template <class Bus>
+byte OnbrightFlasher<Bus>::readChipType(unsigned char& chipType)
+{
+  // used to check for nack/ack, success, etc.
+  byte result;
+  //byte numBytes;
+
+  const unsigned char command[] = { READ_CONFIG_BYTE, CHIP_TYPE_BYTE };
+
+  stats.begin(statsConfigRead);
+
+  // check chip type
+  result = busWrite(DEVICE_ADDRESS, command, sizeof(command));
+
+  // this returns number of bytes so could use that
+  busRead(DATA_ADDRESS, &chipType, 1);
+
+  stats.end();
+
+  return result;
+}
+
+template <class Bus>
+byte OnbrightFlasher<Bus>::readFlashChecksum(uint32_t &checksum)
+{
+  byte result;
+  unsigned char configByte = 0;
+  unsigned char index;
+
+  checksum = 0;
+
+  stats.begin(statsConfigRead);
+
+  for (index = 0; index < 4; index++)
+  {
+    result = readConfigByte(FLASH_CHECKSUM01 + index, configByte);
+    if (result > 0)
+    {
+      break;
+    }
+
+    checksum |= (uint32_t) configByte << (8 * index);
+  }
+
+  stats.end();
+
+  return result;
+}
+
+template <class Bus>
+void OnbrightFlasher<Bus>::resetMCU(void)
+{
+  // FIXME: reset command not able to return any indication of success/failure?
+  // for example, no ack or nack
+  //byte result = 0;
+
+  unsigned char ignored;
+
+  // we do not actually read anything
+  busRead(RESET_CHIP, &ignored, 1);
+
+  // application code may write its own flash from now on
+  if (listener != NULL)
+  {
+    listener->flashInvalidated();
+  }
+
+  //return result;
+}
+
+// apparently clock stretching is problematic
+// relevant here?
+// [https://learn.adafruit.com/working-with-i2c-devices/clock-stretching]
+template <class Bus>
+byte OnbrightFlasher<Bus>::eraseChip(void)
+{
+  byte result = beginErase();
+
+  while (!pollErase(result))
+  {
+    yield();
+  }
+
+  return result;
+}
+
+template <class Bus>
+byte OnbrightFlasher<Bus>::beginErase(void)
+{
+  const unsigned char command = ERASE_CHIP;
+
+  // the command and every poll are timed on their own, whatever runs in between is not erase
+  stats.begin(statsErase);
+
+  eraseStartMicros = micros();
+  eraseResult = busWrite(DEVICE_ADDRESS, &command, 1);
+
+  stats.end();
+
+  writtenBlocks = 0;
+  skippedBytes = 0;
+  writeBusyMicros = 0;
+  eraseBusyMicros = 0;
+  erasedBlocks = 0;
+
+  // until the erase is seen to finish
+  if (listener != NULL)
+  {
+    listener->flashInvalidated();
+  }
+
+  // target holds SCL low for the whole erase, so with a bus timeout shorter than that
+  // (e.g., 20 ms Wire timeout) the command itself ends with a timeout although it was taken
+  erasing = (eraseResult == 0) || (eraseResult == 5);
+
+  return eraseResult;
+}
+
+// erase is over once target acknowledges again
+template <class Bus>
+bool OnbrightFlasher<Bus>::pollErase(byte &result)
+{
+  if (!erasing)
+  {
+    result = eraseResult;
+    return true;
+  }
+
+  stats.begin(statsErase);
+  result = busWrite(DEVICE_ADDRESS, NULL, 0);
+  stats.end();
+
+  if (result == 0)
+  {
+    // a target that holds SCL instead of nacking is only done once this poll completes
+    readyMicros = micros();
+    eraseBusyMicros = readyMicros - eraseStartMicros;
+    erasedBlocks = 0xFFFF;
+
+    if (listener != NULL)
+    {
+      listener->flashErased();
+    }
+  } else {
+    busyPolls++;
+
+    if (micros() - eraseStartMicros < ERASE_READY_TIMEOUT_MS * 1000UL)
+    {
+      return false;
+    }
+  }
+
+  erasing = false;
+  eraseResult = result;
+
+  return true;
+}
+
+template <class Bus>
+void OnbrightFlasher<Bus>::abortErase(void)
+{
+  if (!erasing)
+  {
+    return;
+  }
+
+  // whatever target is doing, nothing is known about its flash now
+  erasing = false;
+  eraseResult = 5;
+}
+
+template <class Bus>
+bool OnbrightFlasher<Bus>::isErasing(void)
+{
+  return erasing;
+}
+
+// address only write, same as the first transaction of the handshake, until target acknowledges
+// returns 0 once it did, otherwise the status of the last attempt
+template <class Bus>
+byte OnbrightFlasher<Bus>::pollReady(const unsigned long timeoutMicros)
+{
+  const unsigned long startTime = micros();
+  byte result;
+
+  do
+  {
+    result = busWrite(DEVICE_ADDRESS, NULL, 0);
+
+    // a target that holds SCL instead of nacking is only done once this poll completes
+    if (result == 0)
+    {
+      readyMicros = micros();
+      return result;
+    }
+
+    busyPolls++;
+    yield();
+  } while (micros() - startTime < timeoutMicros);
+
+  return result;
+}
+
+// a nack on the address means target is still programming the previous byte
+// nothing was taken yet, so wait until it is ready and send the same transaction once more
+template <class Bus>
+byte OnbrightFlasher<Bus>::writeWhenReady(const uint8_t address, const unsigned char* data, const uint8_t length)
+{
+  const unsigned long startTime = micros();
+  byte result;
+
+  result = busWrite(address, data, length);
+
+  if ((result != 2) || (pollReady(WRITE_READY_TIMEOUT_US) != 0))
+  {
+    return result;
+  }
+
+  writeBusy(readyMicros - startTime);
+  stats.retry();
+
+  return busWrite(address, data, length);
+}
+
+template <class Bus>
+void OnbrightFlasher<Bus>::writeBusy(const unsigned long busyMicros)
+{
+  if (busyMicros > writeBusyMicros)
+  {
+    writeBusyMicros = busyMicros;
+  }
+}
+
+template <class Bus>
+unsigned long OnbrightFlasher<Bus>::getEraseBusyMicros(void)
+{
+  return eraseBusyMicros;
+}
+
+template <class Bus>
+unsigned long OnbrightFlasher<Bus>::getWriteBusyMicros(void)
+{
+  return writeBusyMicros;
+}
+
+template <class Bus>
+unsigned long OnbrightFlasher<Bus>::getBusyPolls(void)
+{
+  return busyPolls;
+}
+
+// common fuses as a check
+// address zero should read 10 (0xA) which is the chip type
+template <class Bus>
+byte OnbrightFlasher<Bus>::readConfigByte(const unsigned char address, unsigned char &configByte)
+{
+  const unsigned char command[] = { READ_CONFIG_BYTE, address };
+  byte result;
+
+  stats.begin(statsConfigRead);
+
+  //
+  result = busWrite(DEVICE_ADDRESS, command, sizeof(command));
+
+  busRead(DATA_ADDRESS, &configByte, 1);
+
+  stats.end();
+
+  return result;
+}
+
+template <class Bus>
+byte OnbrightFlasher<Bus>::writeConfigByte(const unsigned char address, const unsigned char configByte)
+{
+  const unsigned char command[] = { WRITE_CONFIG_BYTE, address };
+  byte result;
+  unsigned int index;
+
+  stats.begin(statsConfigWrite);
+
+  // we save to write twice according to traces from official programmer
+  for (index = 0; index < 2; index++)
+  {
+    busWrite(DEVICE_ADDRESS, command, sizeof(command));
+    result = busWrite(DATA_ADDRESS, &configByte, 1);
+  }
+
+  stats.end();
+
+  return result;
+}
+
+
+
+// TODO: might want something that works across entire block size in the future
+// read single byte from flash
+// there are 16 blocks * 512 bytes = 8192 bytes total flash memory
+template <class Bus>
+byte OnbrightFlasher<Bus>::readFlashByte(const unsigned int flashAddress, unsigned char &flashByte)
+{
+  const unsigned char command[] = { READ_FLASH, (unsigned char) ((flashAddress >> 8) & 0xff), (unsigned char) (flashAddress & 0xff) };
+
+  byte result;
+
+  stats.begin(statsFlashRead);
+
+  //
+  result = busWrite(DEVICE_ADDRESS, command, sizeof(command));
+
+  // short read, use "other error" as readFlashBurst() does
+  if ((busRead(DATA_ADDRESS, &flashByte, 1) < 1) && (result == 0))
+  {
+    result = 4;
+  }
+
+  if ((result == 0) && (listener != NULL))
+  {
+    listener->flashRead(flashAddress, &flashByte, 1);
+  }
+
+  stats.end();
+
+  return result;
+}
+
+// address phase of a flash write, target latches command and address
+template <class Bus>
+byte OnbrightFlasher<Bus>::writeFlashAddress(const unsigned int flashAddress)
+{
+  const unsigned char command[] = { WRITE_FLASH, (unsigned char) ((flashAddress >> 8) & 0xff), (unsigned char) (flashAddress & 0xff) };
+
+  return writeWhenReady(DEVICE_ADDRESS, command, sizeof(command));
+}
+
+// data phase of a flash write
+template <class Bus>
+byte OnbrightFlasher<Bus>::writeFlashData(const unsigned char flashByte)
+{
+  return writeWhenReady(DATA_ADDRESS, &flashByte, 1);
+}
+
+template <class Bus>
+byte OnbrightFlasher<Bus>::writeFlashByte(const unsigned int flashAddress, const unsigned char flashByte)
+{
+  byte result;
+
+  stats.begin(statsFlashWrite);
+
+  // without the address target would program whatever address it latched last
+  result = writeFlashAddress(flashAddress);
+  if (result == 0)
+  {
+    result = writeFlashData(flashByte);
+  }
+
+  // a programmed byte means the block is no longer blank, same as the buffered writes
+  if (result == 0)
+  {
+    writtenBlocks |= blockMask(flashAddress);
+  }
+
+  if (listener != NULL)
+  {
+    if (result == 0)
+    {
+      listener->flashWritten(flashAddress, &flashByte, 1);
+    } else {
+      listener->flashInvalidated(flashAddress, 1);
+    }
+  }
+
+  stats.end();
+
+  return result;
+}
+
+template <class Bus>
+byte OnbrightFlasher<Bus>::readFlashBurst(const unsigned int flashAddress, unsigned char* flashbyte, const unsigned char length)
+{
+  const unsigned char command[] = { READ_FLASH, (unsigned char) ((flashAddress >> 8) & 0xff), (unsigned char) (flashAddress & 0xff) };
+
+  byte result;
+  unsigned char index;
+
+  stats.begin(statsFlashRead);
+
+  result = busWrite(DEVICE_ADDRESS, command, sizeof(command));
+
+  index = busRead(DATA_ADDRESS, flashbyte, length);
+
+  // short read, use "other error" as Wire library would
+  if ((result == 0) && (index < length))
+  {
+    result = 4;
+  }
+
+  stats.end();
+
+  return result;
+}
+
+template <class Bus>
+void OnbrightFlasher<Bus>::setBurstRead(const bool enable)
+{
+  burstReadEnabled = enable;
+}
+
+template <class Bus>
+unsigned char OnbrightFlasher<Bus>::getBurstReadMode(void)
+{
+  return burstReadMode;
+}
+
+template <class Bus>
+byte OnbrightFlasher<Bus>::readFlashBlock(const unsigned int flashAddress, unsigned char* flashbyte, const unsigned int length)
+{
+  byte result = 0;
+
+  unsigned char probe[FLASH_BURST_MAX];
+  unsigned int currentAddress;
+  unsigned int index = 0;
+  unsigned int chunk;
+  unsigned int probeIndex;
+  bool uniform;
+  // whether any piece failed, result only keeps the last one
+  bool failed = false;
+
+  stats.begin(statsFlashRead);
+
+  while (index < length)
+  {
+    currentAddress = flashAddress + index;
+
+    chunk = length - index;
+    if (chunk > FLASH_BURST_MAX)
+    {
+      chunk = FLASH_BURST_MAX;
+    }
+
+    if (!burstReadEnabled || (burstReadMode == burstUnsupported) || (chunk == 1))
+    {
+      result = readFlashByte(currentAddress, flashbyte[index]);
+      failed |= (result != 0);
+      index++;
+
+      // as often as for bursts, not after every byte
+      if ((index % FLASH_BURST_MAX) == 0)
+      {
+        yield();
+      }
+      continue;
+    }
+
+    result = readFlashBurst(currentAddress, &flashbyte[index], chunk);
+
+    // until we know better, check burst against byte by byte reads of the same range
+    // a chunk of identical bytes (e.g., erased) cannot tell us anything so keep checking
+    if ((result == 0) && (burstReadMode == burstUnknown))
+    {
+      uniform = true;
+
+      for (probeIndex = 0; probeIndex < chunk; probeIndex++)
+      {
+        result |= readFlashByte(currentAddress + probeIndex, probe[probeIndex]);
+
+        if (probe[probeIndex] != probe[0])
+        {
+          uniform = false;
+        }
+      }
+
+      if (result == 0)
+      {
+        if (memcmp(probe, &flashbyte[index], chunk) != 0)
+        {
+          // target does not auto increment, keep the correct values and read byte by byte from now on
+          memcpy(&flashbyte[index], probe, chunk);
+          burstReadMode = burstUnsupported;
+        } else if (!uniform) {
+          burstReadMode = burstSupported;
+        }
+      }
+    }
+
+    failed |= (result != 0);
+    index += chunk;
+
+    // reading the entire flash space in an 8KB mcu takes a long time in a loop
+    // so explicitly yield to super loop (?) so that watchdog timer on some mcu does not kick in to avoid reset
+    yield();
+  }
+
+  // bursts are only passed on here, after a probe may have corrected them
+  if (!failed && (listener != NULL))
+  {
+    listener->flashRead(flashAddress, flashbyte, length);
+  }
+
+  stats.end();
+
+  return result;
+}
+
+template <class Bus>
+void OnbrightFlasher<Bus>::setBurstWrite(const bool enable)
+{
+  burstWriteEnabled = enable;
+}
+
+template <class Bus>
+unsigned char OnbrightFlasher<Bus>::getBurstWriteMode(void)
+{
+  return burstWriteMode;
+}
+
+template <class Bus>
+void OnbrightFlasher<Bus>::setWriteErrorHandler(void (*handler)(const unsigned int flashAddress, const unsigned char flashByte, const byte result))
+{
+  writeErrorHandler = handler;
+}
+
+template <class Bus>
+void OnbrightFlasher<Bus>::setListener(FlashListener *flashListener)
+{
+  listener = flashListener;
+}
+
+template <class Bus>
+unsigned int OnbrightFlasher<Bus>::getWriteErrors(void)
+{
+  return writeErrors;
+}
+
+template <class Bus>
+void OnbrightFlasher<Bus>::writeError(const unsigned int flashAddress, const unsigned char flashByte, const byte result)
+{
+  writeErrors++;
+
+  if (writeErrorHandler != NULL)
+  {
+    writeErrorHandler(flashAddress, flashByte, result);
+  }
+}
+
+template <class Bus>
+void OnbrightFlasher<Bus>::setSkipErased(const bool enable)
+{
+  skipErasedEnabled = enable;
+}
+
+template <class Bus>
+bool OnbrightFlasher<Bus>::getSkipErased(void)
+{
+  return skipErasedEnabled;
+}
+
+template <class Bus>
+uint16_t OnbrightFlasher<Bus>::blockMask(const unsigned int flashAddress)
+{
+  if (flashAddress >= FLASH_BLOCKS * BLOCK_SIZE)
+  {
+    return 0;
+  }
+
+  return 1 << (flashAddress / BLOCK_SIZE);
+}
+
+template <class Bus>
+bool OnbrightFlasher<Bus>::isBlockErased(const unsigned int flashAddress)
+{
+  return (erasedBlocks & blockMask(flashAddress)) != 0;
+}
+
+template <class Bus>
+unsigned long OnbrightFlasher<Bus>::getSkippedBytes(void)
+{
+  return skippedBytes;
+}
+
+template <class Bus>
+unsigned char OnbrightFlasher<Bus>::getUntouchedBlocks(void)
+{
+  uint16_t untouched = erasedBlocks & ~writtenBlocks;
+  unsigned char count = 0;
+
+  while (untouched)
+  {
+    count += untouched & 1;
+    untouched >>= 1;
+  }
+
+  return count;
+}
+
+// writing the erased value over an erased byte changes nothing (flash writes can only clear bits)
+template <class Bus>
+bool OnbrightFlasher<Bus>::isErasedByte(const unsigned int flashAddress, const unsigned char flashByte)
+{
+  return skipErasedEnabled && (flashByte == FLASH_ERASED_VALUE) && isBlockErased(flashAddress);
+}
+
+// the byte before flashAddress was just written, now write flashbyte[0] without an address phase
+// and read it back to learn whether target advanced its address by itself
+// returns true if the byte ended up where it belongs
+template <class Bus>
+bool OnbrightFlasher<Bus>::probeBurstWrite(const unsigned int flashAddress, unsigned char* flashbyte)
+{
+  unsigned char readBack;
+  byte result;
+
+  result = writeFlashData(flashbyte[0]);
+
+  if (result == 0)
+  {
+    result = readFlashByte(flashAddress, readBack);
+  }
+
+  if (result != 0)
+  {
+    // nothing learned, caller writes the byte again with an address phase
+    return false;
+  }
+
+  if (readBack == flashbyte[0])
+  {
+    burstWriteMode = burstSupported;
+    return true;
+  }
+
+  burstWriteMode = burstUnsupported;
+
+  return false;
+}
+
+template <class Bus>
+byte OnbrightFlasher<Bus>::writeFlashBlock(const unsigned int flashAddress, unsigned char* flashbyte, const unsigned int length)
+{
+  // first failure is reported, every failure is counted
+  byte firstResult = 0;
+  byte result;
+
+  unsigned int currentAddress;
+  unsigned int index = 0;
+  bool written = false;
+
+  // blocks still erased as this write starts, only there is the probe byte known to hold 0xFF beforehand
+  const uint16_t untouched = erasedBlocks & ~writtenBlocks;
+
+  writeErrors = 0;
+
+  stats.begin(statsFlashWrite);
+
+  while (index < length)
+  {
+    currentAddress = flashAddress + index;
+
+    if (isErasedByte(currentAddress, flashbyte[index]))
+    {
+      skippedBytes++;
+      index++;
+      continue;
+    }
+
+    writtenBlocks |= blockMask(currentAddress);
+    written = true;
+
+    // original protocol, two transactions per byte
+    if (!burstWriteEnabled || (burstWriteMode == burstUnsupported))
+    {
+      result = writeFlashByte(currentAddress, flashbyte[index]);
+      if (result > 0)
+      {
+        writeError(currentAddress, flashbyte[index], result);
+      }
+      firstResult = firstResult ? firstResult : result;
+      index++;
+      continue;
+    }
+
+    // stream a run: address once, then data only for as long as everything is acked
+    result = writeFlashAddress(currentAddress);
+    if (result == 0)
+    {
+      result = writeFlashData(flashbyte[index]);
+    }
+
+    if (result > 0)
+    {
+      writeError(currentAddress, flashbyte[index], result);
+      firstResult = firstResult ? firstResult : result;
+      index++;
+      continue;
+    }
+
+    index++;
+
+    while (index < length)
+    {
+      currentAddress = flashAddress + index;
+
+      // end the run here, outer loop skips the erased bytes and starts a new run after them
+      if (isErasedByte(currentAddress, flashbyte[index]))
+      {
+        break;
+      }
+
+      writtenBlocks |= blockMask(currentAddress);
+
+      if (burstWriteMode == burstUnknown)
+      {
+        // only probe with a byte that is harmless if it lands on top of the previous one
+        // (flash can only clear bits, so it must not clear any bit the previous byte left set)
+        // and that is distinguishable from erased, otherwise start a new run at this byte
+        // rewriting a byte flash already holds reads back the same either way, so probe only in erased blocks
+        if ((flashbyte[index] == 0xff) || ((flashbyte[index] & flashbyte[index - 1]) != flashbyte[index - 1]) ||
+            ((untouched & blockMask(currentAddress)) == 0))
+        {
+          break;
+        }
+
+        // a probe reads back, which replaces the latched command, so always start a new run afterwards
+        if (probeBurstWrite(currentAddress, &flashbyte[index]))
+        {
+          index++;
+        }
+        break;
+      }
+
+      result = writeFlashData(flashbyte[index]);
+
+      if (result > 0)
+      {
+        // address target holds is uncertain now, restart the run after this byte
+        writeError(currentAddress, flashbyte[index], result);
+        firstResult = firstResult ? firstResult : result;
+        index++;
+        break;
+      }
+
+      index++;
+    }
+  }
+
+  // wait out programming of the last byte here, so it is measured and the next transaction is not nacked
+  if (written)
+  {
+    const unsigned long startTime = micros();
+
+    result = pollReady(WRITE_READY_TIMEOUT_US);
+    if (result == 0)
+    {
+      writeBusy(readyMicros - startTime);
+    }
+    firstResult = firstResult ? firstResult : result;
+  }
+
+  // bytes skipped as erased are already what the listener expects
+  if (listener != NULL)
+  {
+    if (firstResult == 0)
+    {
+      listener->flashWritten(flashAddress, flashbyte, length);
+    } else {
+      listener->flashInvalidated(flashAddress, length);
+    }
+  }
+
+  stats.end();
+
+  return firstResult;
+}
+
+template <class Bus>
+byte OnbrightFlasher<Bus>::readConfigBlock(const unsigned char flashAddress, unsigned char* flashbyte, const unsigned char length)
+{
+  byte result = 0;
+
+  unsigned int currentAddress;
+  unsigned int index;
+
+  stats.begin(statsConfigRead);
+
+  for (index = 0; index < length; index++)
+  {
+    currentAddress = flashAddress + index;
+    result = readConfigByte(currentAddress, flashbyte[index]);
+  }
+
+  stats.end();
+
+  return result;
+}
+
+#endif
@@ -3,4 +3,16 @@
 // I think SoftwareWire only supports AVR
 //#define USE_SOFTWAREWIRE_LIBRARY
 // hardware i2c
-#define USE_WIRE_LIBRARY
\ No newline at end of file
+#define USE_WIRE_LIBRARY
+// built in bit bang engine on PIN_WIRE_SDA/PIN_WIRE_SCL (bitBangBus.h), fastest option on ESP8285/ESP8266
+//#define USE_BITBANG_BUS
+
+// fastest i2c clock the adaptive clock steps up to, each phase starts at CLOCK_RATE_START_HZ (see clockRate.h)
+#ifndef CLOCK_RATE_MAX_HZ
+  #if defined(USE_SOFTWIRE_LIBRARY) || defined(USE_SOFTWAREWIRE_LIBRARY)
+    // software libraries do not get near fast mode
+    #define CLOCK_RATE_MAX_HZ 100000
+  #else
+    #define CLOCK_RATE_MAX_HZ 400000
+  #endif
+#endif
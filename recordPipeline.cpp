@@ -0,0 +1,89 @@
+/*
+  recordPipeline.cpp - ring of decoded records between serial input and flash programming
+  Copyright (c) 2023 Jonathan Armstrong.  All right reserved.
+*/
+
+#include "recordPipeline.h"
+
+RecordPipeline::RecordPipeline(void)
+{
+  reset();
+  resetStats();
+}
+
+void RecordPipeline::reset(void)
+{
+  head = 0;
+  tail = 0;
+  used = 0;
+
+  offset = 0;
+  errors = 0;
+  firstResult = 0;
+}
+
+void RecordPipeline::resetStats(void)
+{
+  memset(&stats, 0, sizeof(stats));
+}
+
+bool RecordPipeline::full(void)
+{
+  return used == PIPELINE_SLOTS;
+}
+
+bool RecordPipeline::empty(void)
+{
+  return used == 0;
+}
+
+uint8_t RecordPipeline::count(void)
+{
+  return used;
+}
+
+frame_t &RecordPipeline::next(void)
+{
+  return slots[head];
+}
+
+void RecordPipeline::commit(void)
+{
+  head = (head + 1) % PIPELINE_SLOTS;
+  used++;
+  stats.records++;
+}
+
+frame_t &RecordPipeline::current(void)
+{
+  return slots[tail];
+}
+
+void RecordPipeline::release(void)
+{
+  tail = (tail + 1) % PIPELINE_SLOTS;
+  used--;
+
+  offset = 0;
+  errors = 0;
+  firstResult = 0;
+}
+
+void RecordPipeline::sample(const bool inputBlocked, const bool inputAccepted, const bool programmed, const bool active)
+{
+  if (inputAccepted)
+  {
+    stats.inputBusy++;
+  } else if (inputBlocked) {
+    stats.inputBlocked++;
+  }
+
+  if (programmed)
+  {
+    stats.programBusy++;
+  } else if (active) {
+    stats.programStarved++;
+  }
+
+  stats.occupancy[used]++;
+}
@@ -0,0 +1,79 @@
+/*
+  recordPipeline.h - ring of decoded records between serial input and flash programming
+  Copyright (c) 2023 Jonathan Armstrong.  All right reserved.
+
+  The input stage decodes hex lines or binary frames straight into the next free slot
+  while the program stage writes the oldest slot a slice at a time, so serial input is
+  serviced between slices instead of waiting for a whole record to be written.
+*/
+
+#ifndef Record_pipeline_h
+#define Record_pipeline_h
+
+#include <Arduino.h>
+
+// records are kept in the same form binary frames arrive in
+#include "frameLink.h"
+
+#if defined(ESP8266) || defined(ESP32)
+  #define PIPELINE_SLOTS 4
+#else
+  // keep RAM use low on AVR
+  #define PIPELINE_SLOTS 2
+#endif
+
+// bytes written per call before serial input gets a chance again
+#define PIPELINE_SLICE_BYTES 16
+
+// counted once per loop() pass, so ratios show which stage is the bottleneck
+struct pipelineStats_t {
+  // input stage handed a record to the ring
+  unsigned long inputBusy;
+  // input stage had data waiting but every slot was taken (program stage is the bottleneck)
+  unsigned long inputBlocked;
+  // program stage wrote a slice
+  unsigned long programBusy;
+  // program stage had nothing to write during a transfer (serial is the bottleneck)
+  unsigned long programStarved;
+  // passes spent at each number of occupied slots
+  unsigned long occupancy[PIPELINE_SLOTS + 1];
+  unsigned long records;
+};
+
+class RecordPipeline
+{
+  public:
+    RecordPipeline(void);
+
+    // drop everything queued, statistics are kept
+    void reset(void);
+    void resetStats(void);
+
+    bool full(void);
+    bool empty(void);
+    uint8_t count(void);
+
+    // input side: fill the slot returned by next(), then commit() it
+    frame_t &next(void);
+    void commit(void);
+
+    // program side: oldest record and how far it has been written
+    frame_t &current(void);
+    uint8_t offset;
+    unsigned int errors;
+    byte firstResult;
+    void release(void);
+
+    // record how this pass went for both stages
+    void sample(const bool inputBlocked, const bool inputAccepted, const bool programmed, const bool active);
+
+    pipelineStats_t stats;
+
+  private:
+    frame_t slots[PIPELINE_SLOTS];
+    uint8_t head;
+    uint8_t tail;
+    uint8_t used;
+};
+
+#endif
@@ -0,0 +1,141 @@
+/*
+  sessionJournal.cpp - which blocks of an image have made it to target, so a failed upload can carry on where it stopped
+  Copyright (c) 2023 Jonathan Armstrong.  All right reserved.
+*/
+
+#include "sessionJournal.h"
+
+SessionJournal::SessionJournal(void)
+{
+  reset();
+}
+
+void SessionJournal::reset(void)
+{
+  image = 0;
+  erased();
+}
+
+bool SessionJournal::begin(const uint32_t id)
+{
+  if ((id != 0) && (id == image))
+  {
+    return true;
+  }
+
+  reset();
+  image = id;
+
+  return false;
+}
+
+void SessionJournal::erased(void)
+{
+  programmedBlocks = 0;
+  verifiedBlocks = 0;
+  badBlocks = 0;
+
+  openBlock = JOURNAL_NO_BLOCK;
+  openFailed = false;
+}
+
+void SessionJournal::close(void)
+{
+  if ((openBlock != JOURNAL_NO_BLOCK) && !openFailed)
+  {
+    programmedBlocks |= (1 << openBlock);
+  }
+
+  openBlock = JOURNAL_NO_BLOCK;
+  openFailed = false;
+}
+
+void SessionJournal::written(const unsigned int flashAddress, const unsigned int length, const bool succeeded)
+{
+  uint8_t block;
+
+  if ((length == 0) || (flashAddress >= FLASH_SIZE))
+  {
+    return;
+  }
+
+  // a write running into the next block leaves that one open
+  for (block = flashAddress / BLOCK_SIZE; (block <= (flashAddress + length - 1) / BLOCK_SIZE) && (block < FLASH_BLOCKS); block++)
+  {
+    if (block != openBlock)
+    {
+      close();
+      openBlock = block;
+    }
+
+    // whatever was known about it is out of date now
+    programmedBlocks &= ~(1 << block);
+    verifiedBlocks &= ~(1 << block);
+
+    if (!succeeded)
+    {
+      openFailed = true;
+    }
+  }
+}
+
+void SessionJournal::finished(void)
+{
+  close();
+}
+
+void SessionJournal::verified(const uint16_t blocks, const uint16_t differ)
+{
+  // a block read back while still open is as good as complete
+  if ((openBlock != JOURNAL_NO_BLOCK) && (blocks & (1 << openBlock)))
+  {
+    openBlock = JOURNAL_NO_BLOCK;
+    openFailed = false;
+  }
+
+  verifiedBlocks = (verifiedBlocks | blocks) & ~differ;
+  programmedBlocks &= ~differ;
+  badBlocks = (badBlocks & ~blocks) | differ;
+}
+
+uint32_t SessionJournal::getImage(void)
+{
+  return image;
+}
+
+uint16_t SessionJournal::getProgrammed(void)
+{
+  return programmedBlocks;
+}
+
+uint16_t SessionJournal::getVerified(void)
+{
+  return verifiedBlocks;
+}
+
+uint16_t SessionJournal::getBad(void)
+{
+  return badBlocks;
+}
+
+void SessionJournal::print(Print &out)
+{
+  const uint16_t done = programmedBlocks | verifiedBlocks;
+  uint8_t block = 0;
+
+  while ((block < FLASH_BLOCKS) && (done & (1 << block)))
+  {
+    block++;
+  }
+
+  out.print(F("Resume: image=0x"));
+  out.print(image, HEX);
+  out.print(F(" programmed=0x"));
+  out.print(programmedBlocks, HEX);
+  out.print(F(" verified=0x"));
+  out.print(verifiedBlocks, HEX);
+  out.print(F(" bad=0x"));
+  out.print(badBlocks, HEX);
+  out.print(F(" next=0x"));
+  out.println((unsigned int) block * BLOCK_SIZE, HEX);
+}
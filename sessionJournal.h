@@ -0,0 +1,78 @@
+/*
+  sessionJournal.h - which blocks of an image have made it to target, so a failed upload can carry on where it stopped
+  Copyright (c) 2023 Jonathan Armstrong.  All right reserved.
+
+  Host names the image it is about to write ("resume <id>", id being a hash
+  of it). A different id starts a new session with nothing programmed. The
+  same id keeps the journal, so host only sends the blocks still missing.
+
+  A block is programmed once the upload has moved on past it (or ended)
+  with every write into it successful, verified once a read back or the chip
+  checksum agreed with the image, and bad once a read back did not: writing
+  cannot set bits again, so a bad block needs an erase.
+
+  Erase empties the journal. Handshake, acquire and mcureset forget it, since
+  target may be another unit afterwards, so an upload that breaks off is
+  resumed without a new handshake. It lives in RAM, a reset of the flasher
+  starts over.
+*/
+
+#ifndef Session_journal_h
+#define Session_journal_h
+
+#include <Arduino.h>
+
+#include "onbrightFlasher.h"
+
+class SessionJournal
+{
+  public:
+    SessionJournal(void);
+
+    // no image and nothing known, e.g. target was written by something else
+    void reset(void);
+
+    // returns true if id is the image of the session so far, otherwise a new session starts for it
+    bool begin(const uint32_t id);
+
+    // target was erased, the image stays the same
+    void erased(void);
+
+    // every write into target flash
+    void written(const unsigned int flashAddress, const unsigned int length, const bool succeeded);
+
+    // end of upload, the block written last is complete
+    void finished(void);
+
+    // blocks read back (or checked by chip checksum) and which of them differed
+    void verified(const uint16_t blocks, const uint16_t differ);
+
+    uint32_t getImage(void);
+
+    // one bit per block
+    uint16_t getProgrammed(void);
+    uint16_t getVerified(void);
+    uint16_t getBad(void);
+
+    // e.g. "Resume: image=0x1A2B3C4D programmed=0x3F verified=0x0 bad=0x0 next=0xC00"
+    // next is the first block neither programmed nor verified
+    void print(Print &out);
+
+  private:
+    void close(void);
+
+    uint32_t image;
+
+    uint16_t programmedBlocks;
+    uint16_t verifiedBlocks;
+    uint16_t badBlocks;
+
+    // block being written, and whether a write into it failed
+    uint8_t openBlock;
+    bool openFailed;
+};
+
+// no block open
+#define JOURNAL_NO_BLOCK 0xFF
+
+#endif
@@ -9,6 +9,9 @@
 #include "Arduino.h"
 #include "simpleParser.h"
 
+// hex digit table shared with the intel hex decoder
+#include "ihx.h"
+
 // uncomment to display parser output to serial console
 //#define DEBUG
 
@@ -23,13 +26,23 @@ void parserCore::reset ()
   termchar = 0;
 }
 
+/*
+ * forget the base of an extended address record, e.g. when an upload is aborted
+ */
+void parserCore::ihexReset(void)
+{
+  ihexBase = 0;
+}
+
 /*
  * getLine
  * Read a line of text from Serial into the internal line buffer.
  * With echoing and editing!
- * Non-blocking.  Returns 0 until end-of-line seen.
+ * Non-blocking.  Returns 0 until end-of-line seen, then the line length.
+ * Characters that do not fit are dropped (not echoed), there is always
+ * room left for the newline and the terminating null.
  */
-uint8_t parserCore::getLine ()
+uint16_t parserCore::getLine ()
 {
   int c;
 
@@ -73,6 +86,9 @@ uint8_t parserCore::getLine ()
       /*
          Otherwise, echo the character and put it into the buffer
       */
+      if (inptr >= lineLen - 2) {
+        break;
+      }
       buffer[inptr++] = c;
       S->write(c);
   }
@@ -84,9 +100,9 @@ uint8_t parserCore::getLine ()
  *  like getLine, but block until a complete line is read
  */
 
-uint8_t parserCore::getLineWait (void)
+uint16_t parserCore::getLineWait (void)
 {
-  uint8_t status;
+  uint16_t status;
 
   do {
     status = getLine();
@@ -124,6 +140,19 @@ int parserCore::number()
   return -1;
 }
 
+/*
+ * unsignedNumber
+ *  Like number(), for values that need all 32 bits.  0 if there is none.
+ */
+unsigned long parserCore::unsignedNumber()
+{
+  char *p = token();
+  if (p) {
+    return strtoul(p, 0, 0);
+  }
+  return 0;
+}
+
 int parserCore::lastNumber()
 {
   if (lastToken && *lastToken) {
@@ -166,7 +195,7 @@ uint8_t parserCore::termChar ()
 
 char *parserCore::token ()
 {
-  uint8_t i;
+  uint16_t i;
 
   if (eol()) {  // reached the end of the line?
     return NULL;
@@ -257,26 +286,34 @@ uint8_t parserCore::tokcasecmp(const char *tok, const char *target)
 
 /*
    hexton
-   Turn a Hex digit (0..9, A..F) into the equivalent binary value (0-16)
+   Turn a Hex digit (0..9, A..F, a..f) into the equivalent binary value (0-15)
+   anything else is IHX_BAD_DIGIT, same table as ihx_decode()
 */
 uint8_t parserCore::hexton (uint8_t h)
 {
-  if (h >= '0' && h <= '9')
-    return (h - '0');
-  if (h >= 'A' && h <= 'F')
-    return ((h - 'A') + 10);
-  return (0);
+  return ihx_hex_digit(h);
 }
 
 #define error(a) S->print(a)
 
+/*
+ * isihex
+ * true if the next thing on the line is an Intel hex record, without consuming it
+ */
+boolean parserCore::isihex()
+{
+  return buffer[parsePtr] == ':';
+}
+
 /*
  * parse a line worth of Intel hex format
+ * bytes has room for maxlen data bytes, up to 255
  * returns byte count on successs, -1 if error.
+ * iaddr is absolute, the base from the last extended address record is added
  */
-int parserCore::tryihex(int16_t *iaddr, uint8_t *bytes)
+int parserCore::tryihex(uint32_t *iaddr, uint8_t *bytes, uint8_t maxlen)
 {
-  uint16_t addr = 0;
+  uint8_t header[4];
   uint8_t b, cksum = 0;
   byte len;
 
@@ -284,42 +321,61 @@ int parserCore::tryihex(int16_t *iaddr, uint8_t *bytes)
       return -1;
   parsePtr++;
 
-  len = hexton(buffer[parsePtr++]);  /* Length */
-  len = (len << 4) + hexton(buffer[parsePtr++]);
-  cksum = len;
+  /* length, address and record type */
+  if ((parsePtr + 2 * sizeof(header) > lineLen) ||
+      (ihx_hex_decode((uint8_t *) &buffer[parsePtr], header, sizeof(header)) != IHX_SUCCESS)) {
+      error("Bad hex digit");
+      return -1;
+  }
+  parsePtr += 2 * sizeof(header);
 
-  b = hexton(buffer[parsePtr++]); /* address */
-  b = (b << 4) + hexton(buffer[parsePtr++]);
-  cksum += b;
-  addr = b;
-  b = hexton(buffer[parsePtr++]); /* address 2nd byte */
-  b = (b << 4) + hexton(buffer[parsePtr++]);
-  cksum += b;
-  addr = (addr << 8) + b;
-  *iaddr = addr;
-  
-  b = hexton(buffer[parsePtr++]); /* record type */
-  b = (b << 4) + hexton(buffer[parsePtr++]);
-  cksum += b;
+  len = header[0];
+  *iaddr = (header[1] << 8) + header[2];
+  cksum = header[0] + header[1] + header[2] + header[3];
+
+  /* <len> bytes of data have to fit bytes, and with the checksum the line buffer */
+  if ((len > maxlen) || (parsePtr + 2 * (len + 1) > lineLen)) {
+      error("Record too long");
+      return -1;
+  }
 
-  for (uint8_t i = 0; i < len; i++) {  /* <len> bytes of data */
-      b = hexton(buffer[parsePtr++]);
-      b = (b << 4) + hexton(buffer[parsePtr++]);
-      *bytes++ = b;
-      cksum += b;
+  if (ihx_hex_decode((uint8_t *) &buffer[parsePtr], bytes, len) != IHX_SUCCESS) {
+      error("Bad hex digit");
+      return -1;
   }
-  b = hexton(buffer[parsePtr++]); /* checksum */
-  b = (b << 4) + hexton(buffer[parsePtr++]);
+  parsePtr += 2 * len;
+
+  for (uint8_t i = 0; i < len; i++) {
+      cksum += bytes[i];
+  }
+
+  /* checksum */
+  if (ihx_hex_decode((uint8_t *) &buffer[parsePtr], &b, 1) != IHX_SUCCESS) {
+      error("Bad hex digit");
+      return -1;
+  }
+  parsePtr += 2;
   cksum += b;
   if (cksum != 0) {
       error("Bad checksum: ");
       Serial.print(cksum, HEX);
+      return -1;
   }
   /* line terminator */
   if ((buffer[parsePtr++] == '\n') ||
       (buffer[parsePtr++] == '\r') ||
       (buffer[parsePtr++] == 0)) {
-      return len;
+      /* extended address records move the base of the data records that follow, end of file clears it */
+      if ((header[3] == IHX_RT_EXTENDED_SEGMENT_ADDRESS) && (len == 2)) {
+          ihexBase = (uint32_t) ((bytes[0] << 8) | bytes[1]) << 4;
+      } else if ((header[3] == IHX_RT_EXTENDED_LINEAR_ADDRESS) && (len == 2)) {
+          ihexBase = (uint32_t) ((bytes[0] << 8) | bytes[1]) << 16;
+      } else if (header[3] == IHX_RT_END_OF_FILE) {
+          ihexBase = 0;
+      }
+      *iaddr += ihexBase;
+      /* only data records have bytes to write, e.g. an extended address record does not */
+      return (header[3] == IHX_RT_DATA) ? len : 0;
   }
   error("No end of line");
   return -1;
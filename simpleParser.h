@@ -10,12 +10,13 @@ class parserCore {
 private:
   char *buffer;
   char *lastToken;
-  byte lineLen;
+  uint16_t lineLen;      /* 16 bits, a 255 byte hex record is a 521 character line */
   Stream *S;
 
-  byte inptr;            /* read character into here */
-  byte parsePtr;
+  uint16_t inptr;        /* read character into here */
+  uint16_t parsePtr;
   byte termchar;
+  uint32_t ihexBase;     /* from the last extended segment/linear address record */
   // Internal functions.
   bool IsWhitespace(char c);
   bool delim(char c);
@@ -24,21 +25,25 @@ private:
   uint8_t tokcasecmp(const char *tok, const char * target);
     
 public:
-  parserCore(char *buf, byte buflen, Stream &io) {
+  parserCore(char *buf, uint16_t buflen, Stream &io) {
     buffer = buf;
     lineLen = buflen;
     S = &io;
+    ihexBase = 0;
   }
-  uint8_t getLine(void);     /* Non-blocking read line w/editing*/
-  uint8_t getLineWait(void); /* wait for a full line of input */
+  uint16_t getLine(void);     /* Non-blocking read line w/editing*/
+  uint16_t getLineWait(void); /* wait for a full line of input */
   void reset(void);          /* reset the parser */
   int number();              /* parse a number */
   int lastNumber();
+  unsigned long unsignedNumber(); /* parse a 32 bit number, e.g. a hash */
   boolean eol();             /* check for EOL */
   uint8_t termChar();        /* return the terminating char of last token */
   int8_t keyword(const char *keys);  /* keyword with partial matching */
 //  int8_t keywordExact(const char *keys);   /* keyword exact match */
-    int tryihex(int16_t *addr, uint8_t * bytes);
+    int tryihex(uint32_t *addr, uint8_t * bytes, uint8_t maxlen); /* at most maxlen data bytes, 0 for other record types */
+    void ihexReset(void);     /* forget the extended address base */
+    boolean isihex(void);     /* does the line hold an intel hex record */
     uint8_t hexton (uint8_t h);
 };
 
@@ -0,0 +1,168 @@
+/*
+  traceRecorder.cpp - keeps the most recent i2c transactions in RAM for comparison with captures of the official programmer
+  Copyright (c) 2023 Jonathan Armstrong.  All right reserved.
+*/
+
+#include "traceRecorder.h"
+
+TraceRecorder::TraceRecorder(void)
+{
+  recording = false;
+  clear();
+}
+
+void TraceRecorder::enable(const bool enabled)
+{
+  if (enabled && !recording)
+  {
+    clear();
+  }
+
+  recording = enabled;
+}
+
+bool TraceRecorder::isEnabled(void)
+{
+  return recording;
+}
+
+void TraceRecorder::clear(void)
+{
+  head = 0;
+  count = 0;
+  dropped = 0;
+}
+
+void TraceRecorder::record(const uint8_t type, const uint8_t address, const uint8_t* data, const uint8_t length, const uint8_t status, const unsigned long startMicros)
+{
+  const unsigned long elapsed = micros() - startMicros;
+  uint8_t index;
+
+  if (!recording)
+  {
+    return;
+  }
+
+  traceEvent_t &event = append();
+
+  event.micros = startMicros;
+  event.duration = (elapsed > 0xFFFF) ? 0xFFFF : elapsed;
+  event.type = type;
+  event.address = address;
+  event.length = length;
+  event.status = status;
+
+  // a read only has what actually arrived
+  for (index = 0; index < TRACE_DATA_BYTES; index++)
+  {
+    event.data[index] = ((data != NULL) && (index < ((type == traceRead) ? status : length))) ? data[index] : 0;
+  }
+}
+
+void TraceRecorder::clock(const unsigned long hz)
+{
+  const unsigned long khz = hz / 1000;
+
+  if (!recording)
+  {
+    return;
+  }
+
+  traceEvent_t &event = append();
+
+  memset(&event, 0, sizeof(event));
+  event.micros = micros();
+  event.duration = (khz > 0xFFFF) ? 0xFFFF : khz;
+  event.type = traceClock;
+}
+
+// oldest event makes room once the ring is full
+traceEvent_t &TraceRecorder::append(void)
+{
+  traceEvent_t &event = events[(head + count) % TRACE_EVENTS];
+
+  if (count < TRACE_EVENTS)
+  {
+    count++;
+  } else {
+    head = (head + 1) % TRACE_EVENTS;
+    dropped++;
+  }
+
+  return event;
+}
+
+bool TraceRecorder::take(traceEvent_t &event)
+{
+  if (count == 0)
+  {
+    return false;
+  }
+
+  event = events[head];
+  head = (head + 1) % TRACE_EVENTS;
+  count--;
+
+  return true;
+}
+
+unsigned long TraceRecorder::getDropped(void)
+{
+  return dropped;
+}
+
+void TraceRecorder::pack(const traceEvent_t &event, uint8_t* packed)
+{
+  uint8_t index;
+
+  packed[0] = event.micros & 0xff;
+  packed[1] = (event.micros >> 8) & 0xff;
+  packed[2] = (event.micros >> 16) & 0xff;
+  packed[3] = (event.micros >> 24) & 0xff;
+  packed[4] = event.duration & 0xff;
+  packed[5] = (event.duration >> 8) & 0xff;
+  packed[6] = event.type;
+  packed[7] = event.address;
+  packed[8] = event.length;
+  packed[9] = event.status;
+
+  for (index = 0; index < TRACE_DATA_BYTES; index++)
+  {
+    packed[10 + index] = event.data[index];
+  }
+}
+
+void TraceRecorder::print(Print &out)
+{
+  traceEvent_t event;
+  uint8_t packed[TRACE_PACKED_SIZE];
+  uint8_t index;
+
+  out.print(F("TRACE events="));
+  out.print(count);
+  out.print(F(" dropped="));
+  out.println(dropped);
+
+  while (take(event))
+  {
+    pack(event, packed);
+
+    out.print(F("T "));
+    for (index = 0; index < TRACE_PACKED_SIZE; index++)
+    {
+      if (packed[index] < 0x10)
+      {
+        out.print(F("0"));
+      }
+      out.print(packed[index], HEX);
+    }
+    out.println();
+
+    // a full ring takes a while at 115200 baud
+    yield();
+  }
+
+  dropped = 0;
+
+  out.println(F("TRACE end"));
+}
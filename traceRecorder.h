@@ -0,0 +1,137 @@
+/*
+  traceRecorder.h - keeps the most recent i2c transactions in RAM for comparison with captures of the official programmer
+  Copyright (c) 2023 Jonathan Armstrong.  All right reserved.
+
+  One event per transaction: when it started, how long it took, address,
+  direction, length, result and the first few data bytes. A write stands for
+  beginTransmission()/write()/endTransmission(), a read for requestFrom().
+  Clock changes are recorded too, so a dump shows which clock each part of a
+  flash ran at.
+
+  The buffer is a ring, once full the oldest event is dropped. A dump prints
+  every event as one line of hex ("T " followed by the packed event), which
+  host/traceReplay.cpp reads back, e.g. straight from flashScript.log.
+
+  TracingBus wraps any other bus policy and records what goes through it.
+*/
+
+#ifndef Trace_recorder_h
+#define Trace_recorder_h
+
+#include <Arduino.h>
+
+// each event takes 16 bytes of RAM on 32 bit boards
+#ifndef TRACE_EVENTS
+  #if defined(__AVR__)
+    #define TRACE_EVENTS 16
+  #else
+    #define TRACE_EVENTS 512
+  #endif
+#endif
+
+// enough for a command byte and a flash address
+#define TRACE_DATA_BYTES 3
+
+// bytes per event in a dump
+#define TRACE_PACKED_SIZE (10 + TRACE_DATA_BYTES)
+
+enum { traceWrite,
+       traceRead,
+       traceClock
+};
+
+struct traceEvent_t {
+  uint32_t micros;
+  // longer transactions saturate, for a clock change this is the new clock in kHz instead
+  uint16_t duration;
+  uint8_t type;
+  uint8_t address;
+  // bytes written or requested
+  uint8_t length;
+  // Wire style status for a write, bytes received for a read
+  uint8_t status;
+  uint8_t data[TRACE_DATA_BYTES];
+};
+
+class TraceRecorder
+{
+  public:
+    TraceRecorder(void);
+
+    // starting clears whatever was recorded before
+    void enable(const bool enabled);
+    bool isEnabled(void);
+    void clear(void);
+
+    void record(const uint8_t type, const uint8_t address, const uint8_t* data, const uint8_t length, const uint8_t status, const unsigned long startMicros);
+    void clock(const unsigned long hz);
+
+    // oldest event not yet handed out, false if there is none
+    bool take(traceEvent_t &event);
+
+    // events lost because the ring was full
+    unsigned long getDropped(void);
+
+    // "TRACE events=N dropped=M", one "T <hex>" line per event, "TRACE end", then the buffer is empty
+    void print(Print &out);
+
+    // little endian, the layout traceReplay expects
+    static void pack(const traceEvent_t &event, uint8_t* packed);
+
+  private:
+    traceEvent_t &append(void);
+
+    traceEvent_t events[TRACE_EVENTS];
+    uint16_t head;
+    uint16_t count;
+    unsigned long dropped;
+    bool recording;
+};
+
+// bus policy, e.g. OnbrightFlasher<TracingBus<DefaultBus> >
+// clock and timeout setters are passed on, so it can sit below AdaptiveBus
+template <class Bus>
+class TracingBus
+{
+  public:
+    TracingBus(const Bus &i2c, TraceRecorder &recorder) : bus(i2c), trace(&recorder)
+    {
+    }
+
+    byte write(const uint8_t address, const uint8_t* data, const uint8_t length)
+    {
+      const unsigned long startTime = micros();
+      const byte result = bus.write(address, data, length);
+
+      trace->record(traceWrite, address, data, length, result, startTime);
+
+      return result;
+    }
+
+    uint8_t read(const uint8_t address, uint8_t* data, const uint8_t length)
+    {
+      const unsigned long startTime = micros();
+      const uint8_t count = bus.read(address, data, length);
+
+      trace->record(traceRead, address, data, length, count, startTime);
+
+      return count;
+    }
+
+    void setTimeoutMillis(const unsigned int timeout)
+    {
+      bus.setTimeoutMillis(timeout);
+    }
+
+    void setClock(const unsigned long hz)
+    {
+      bus.setClock(hz);
+      trace->clock(hz);
+    }
+
+  private:
+    Bus bus;
+    TraceRecorder *trace;
+};
+
+#endif
@@ -0,0 +1,123 @@
+/*
+  wireBus.h - OnbrightFlasher bus policies for Wire compatible i2c libraries
+  Copyright (c) 2023 Jonathan Armstrong.  All right reserved.
+*/
+
+#ifndef Wire_bus_h
+#define Wire_bus_h
+
+// for byte type
+#include <Arduino.h>
+
+#include "onbrightFlasher.h"
+
+// chooses which i2c wire compatible library to use (e.g., software based Softwire, hardware based Wire, or SoftwareWire)
+#include "projectDefs.h"
+
+// advice on switching between SoftWire and Wire libraries
+// [https://arduino-craft-corner.de/index.php/2023/11/29/replacing-the-wire-library-sometimes/]
+#if defined(USE_SOFTWIRE_LIBRARY) && defined(USE_WIRE_LIBRARY)
+  // FIXME: account for SoftwareWire library also
+  #error Please uncomment either USE_SOFTWIRE_LIBRARY or USE_WIRE_LIBRARY but not both.
+#elif defined(USE_BITBANG_BUS) && (defined(USE_SOFTWIRE_LIBRARY) || defined(USE_SOFTWAREWIRE_LIBRARY) || defined(USE_WIRE_LIBRARY))
+  #error Please uncomment either USE_BITBANG_BUS or one of the i2c libraries but not both.
+#elif defined(USE_BITBANG_BUS)
+  #include "bitBangBus.h"
+#elif defined(USE_SOFTWIRE_LIBRARY)
+  // needed for softwire timeouts
+  #include <AsyncDelay.h>
+  #include <SoftWire.h>
+#elif defined (USE_SOFTWAREWIRE_LIBRARY)
+  #include <SoftwareWire.h>
+#elif defined(USE_WIRE_LIBRARY)
+  #include <Wire.h>
+#endif
+
+// Wire, SoftWire and SoftwareWire share the same beginTransmission()/write()/endTransmission()
+// and requestFrom()/available()/read() calls, so one template covers all three
+// differences between them are handled by specializations below
+template <class TwoWireType>
+class WireBus
+{
+  public:
+    WireBus(TwoWireType &i2c) : wire(i2c)
+    {
+    }
+
+    byte write(const uint8_t address, const uint8_t* data, const uint8_t length)
+    {
+      uint8_t index;
+
+      wire.beginTransmission(address);
+      for (index = 0; index < length; index++)
+      {
+        wire.write(data[index]);
+      }
+
+      return wire.endTransmission();
+    }
+
+    uint8_t read(const uint8_t address, uint8_t* data, const uint8_t length)
+    {
+      uint8_t count = 0;
+
+      // int arguments match the same requestFrom() overload in every library
+      wire.requestFrom((int) address, (int) length);
+
+      while ((wire.available() > 0) && (count < length))
+      {
+        data[count] = wire.read();
+        count++;
+      }
+
+      return count;
+    }
+
+    void setTimeoutMillis(const unsigned int timeout)
+    {
+      wire.setTimeout(timeout);
+    }
+
+    void setClock(const unsigned long hz)
+    {
+      wire.setClock(hz);
+    }
+
+    TwoWireType &wire;
+};
+
+#if defined(USE_BITBANG_BUS)
+  // pins are fixed at compile time, so they have to come from the board definitions or the compiler command line
+  typedef BitBangBus<PIN_WIRE_SDA, PIN_WIRE_SCL> DefaultBus;
+#elif defined(USE_SOFTWIRE_LIBRARY)
+  // SoftWire names its timeout setter differently
+  template <>
+  inline void WireBus<SoftWire>::setTimeoutMillis(const unsigned int timeout)
+  {
+    wire.setTimeout_ms(timeout);
+  }
+
+  typedef WireBus<SoftWire> DefaultBus;
+#elif defined(USE_SOFTWAREWIRE_LIBRARY)
+  typedef WireBus<SoftwareWire> DefaultBus;
+#elif defined(USE_WIRE_LIBRARY)
+  // hardware Wire copies a whole buffer in one call
+  template <>
+  inline byte WireBus<TwoWire>::write(const uint8_t address, const uint8_t* data, const uint8_t length)
+  {
+    wire.beginTransmission(address);
+    if (length > 0)
+    {
+      wire.write(data, length);
+    }
+
+    return wire.endTransmission();
+  }
+
+  typedef WireBus<TwoWire> DefaultBus;
+#endif
+
+// flasher on the library chosen in projectDefs.h
+typedef OnbrightFlasher<DefaultBus> DefaultFlasher;
+
+#endif
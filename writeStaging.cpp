@@ -0,0 +1,253 @@
+/*
+  writeStaging.cpp - merges hex records per flash block, so each block is written once in address order
+  Copyright (c) 2023 Jonathan Armstrong.  All right reserved.
+*/
+
+#include "writeStaging.h"
+
+WriteStaging::WriteStaging(void)
+{
+  memset(present, 0, sizeof(present));
+  count = 0;
+
+  clear();
+  resetStats();
+  drop();
+}
+
+void WriteStaging::clear(void)
+{
+  if (count > 0)
+  {
+    memset(present, 0, sizeof(present));
+  }
+
+  blockAddress = 0;
+  count = 0;
+  taking = false;
+  takeOffset = 0;
+}
+
+void WriteStaging::resetStats(void)
+{
+  records = 0;
+  bytes = 0;
+  overwritten = 0;
+  runs = 0;
+}
+
+void WriteStaging::drop(void)
+{
+  clear();
+
+  heldRecords = 0;
+  heldBytes = 0;
+
+  writtenResult = 0;
+  writtenErrors = 0;
+  writtenSum = 0;
+  writtenCount = 0;
+
+  carrySum = 0;
+  carryCount = 0;
+}
+
+bool WriteStaging::empty(void)
+{
+  return count == 0;
+}
+
+bool WriteStaging::isPresent(const uint16_t offset)
+{
+  return (present[offset / 8] & (1 << (offset % 8))) != 0;
+}
+
+uint16_t WriteStaging::add(const unsigned int flashAddress, const unsigned char* flashbyte, const uint16_t length)
+{
+  uint16_t offset;
+  uint16_t taken;
+  uint16_t index;
+
+  if (length == 0)
+  {
+    return 0;
+  }
+
+  if (count == 0)
+  {
+    blockAddress = flashAddress - (flashAddress % BLOCK_SIZE);
+    taking = false;
+    takeOffset = 0;
+  } else if (taking || (flashAddress < blockAddress) || (flashAddress >= blockAddress + BLOCK_SIZE)) {
+    return 0;
+  }
+
+  offset = flashAddress - blockAddress;
+  taken = ((length < BLOCK_SIZE - offset) ? length : BLOCK_SIZE - offset);
+
+  for (index = 0; index < taken; index++, offset++)
+  {
+    if (isPresent(offset))
+    {
+      overwritten++;
+    } else {
+      present[offset / 8] |= (1 << (offset % 8));
+      count++;
+    }
+
+    image[offset] = flashbyte[index];
+  }
+
+  records++;
+  bytes += taken;
+
+  return taken;
+}
+
+bool WriteStaging::take(unsigned int &flashAddress, unsigned char* &flashbyte, uint8_t &length, const uint8_t maxLength)
+{
+  uint16_t offset;
+
+  if ((count == 0) || (maxLength == 0))
+  {
+    return false;
+  }
+
+  taking = true;
+
+  // whole bytes of the bitmap at a time over gaps
+  offset = takeOffset;
+  while (!isPresent(offset))
+  {
+    if ((offset % 8 == 0) && (present[offset / 8] == 0))
+    {
+      offset += 8;
+    } else {
+      offset++;
+    }
+  }
+
+  flashAddress = blockAddress + offset;
+  flashbyte = &image[offset];
+  length = 0;
+
+  while ((offset < BLOCK_SIZE) && (length < maxLength) && isPresent(offset))
+  {
+    present[offset / 8] &= ~(1 << (offset % 8));
+    offset++;
+    length++;
+  }
+
+  // a run longer than maxLength continues at offset next time
+  if ((offset == BLOCK_SIZE) || !isPresent(offset))
+  {
+    runs++;
+  }
+
+  count -= length;
+  takeOffset = offset;
+
+  if (count == 0)
+  {
+    clear();
+  }
+
+  return true;
+}
+
+void WriteStaging::hold(const uint8_t seq, const uint8_t length)
+{
+  if (heldRecords == 0)
+  {
+    heldFirstSeq = seq;
+    heldBytes = 0;
+  }
+
+  heldRecords++;
+  heldLastSeq = seq;
+  heldBytes += length;
+}
+
+uint8_t WriteStaging::held(void)
+{
+  return heldRecords;
+}
+
+void WriteStaging::written(const unsigned int flashAddress, const unsigned char* flashbyte, const uint8_t length, const byte result, const unsigned int errors)
+{
+  uint8_t index;
+
+  if (writtenResult == 0)
+  {
+    writtenResult = result;
+  }
+  writtenErrors += errors;
+
+  // summed now, the image is reused once the next block is staged
+  writtenBlock = flashAddress / BLOCK_SIZE;
+  for (index = 0; index < length; index++)
+  {
+    writtenSum += flashbyte[index];
+  }
+  writtenCount += length;
+}
+
+void WriteStaging::finish(const unsigned char* partial, const uint8_t partialLength, ImageChecksum &checksum, stagedBlock_t &block)
+{
+  uint8_t index;
+
+  block.failed = (writtenResult > 0) || (writtenErrors > 0);
+  block.errors = writtenErrors;
+  block.records = heldRecords;
+  block.firstSeq = heldFirstSeq;
+  block.lastSeq = heldLastSeq;
+  block.bytes = heldBytes;
+
+  if (block.failed)
+  {
+    // host sends the records again, a carry included
+    carrySum = 0;
+    carryCount = 0;
+  } else {
+    // the record a carry belongs to was held for this block, so it is complete now
+    if (carryCount > 0)
+    {
+      checksum.add(carryBlock, carrySum, carryCount);
+
+      carrySum = 0;
+      carryCount = 0;
+    }
+
+    if (partialLength > 0)
+    {
+      carryBlock = writtenBlock;
+      carryCount = partialLength;
+      for (index = 0; index < partialLength; index++)
+      {
+        carrySum += partial[index];
+      }
+    }
+
+    checksum.add(writtenBlock, writtenSum - carrySum, writtenCount - carryCount);
+  }
+
+  heldRecords = 0;
+  heldBytes = 0;
+
+  writtenResult = 0;
+  writtenErrors = 0;
+  writtenSum = 0;
+  writtenCount = 0;
+}
+
+void WriteStaging::print(Print &out)
+{
+  out.print(F("Staging: records="));
+  out.print(records);
+  out.print(F(" bytes="));
+  out.print(bytes);
+  out.print(F(" overwritten="));
+  out.print(overwritten);
+  out.print(F(" runs="));
+  out.println(runs);
+}
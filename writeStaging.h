@@ -0,0 +1,132 @@
+/*
+  writeStaging.h - merges hex records per flash block, so each block is written once in address order
+  Copyright (c) 2023 Jonathan Armstrong.  All right reserved.
+
+  Records are copied into a one block image with a bit per byte telling
+  which bytes have been given. A byte given twice keeps the later value,
+  rather than being written twice (flash would keep the AND of both).
+  Once a record for another block arrives, the staged block is taken out
+  again as runs of consecutive bytes, lowest address first, and written
+  before staging starts over with the new block.
+
+  Records of a block that arrive after it has been written out (e.g., a hex
+  file that jumps back) are staged and written again, as they would have
+  been without staging.
+
+  Records are only answered (ACK, "Write successful") once their block has
+  been written: staging holds on to each staged record until then and tells
+  how the block went, and adds its bytes to the image checksum only if all of
+  them were written. So a block also goes out once host has sent as much as
+  it may without an answer: a window of frames, or a single hex line.
+*/
+
+#ifndef Write_staging_h
+#define Write_staging_h
+
+#include <Arduino.h>
+
+#include "onbrightFlasher.h"
+#include "imageChecksum.h"
+
+// a block image and its bitmap (576 bytes) do not fit next to 255 byte records on most AVR boards
+#ifndef WRITE_STAGING
+  #if defined(__AVR__)
+    #define WRITE_STAGING 0
+  #else
+    #define WRITE_STAGING 1
+  #endif
+#endif
+
+// staged bytes are written after input stops for this long, e.g. host sent fewer records than it may
+#ifndef STAGING_IDLE_MS
+  #define STAGING_IDLE_MS 50
+#endif
+
+// how a staged block went and which records fed it, see finish()
+struct stagedBlock_t {
+  bool failed;
+  // bytes that failed to write
+  unsigned int errors;
+  // records held for it, first and last sequence number and their bytes
+  uint8_t records;
+  uint8_t firstSeq;
+  uint8_t lastSeq;
+  unsigned int bytes;
+};
+
+class WriteStaging
+{
+  public:
+    WriteStaging(void);
+
+    // forget staged bytes, statistics are kept
+    void clear(void);
+    void resetStats(void);
+
+    // forget held records and anything known about the block being written too, e.g. on abort
+    void drop(void);
+
+    bool empty(void);
+
+    // stages the part of the record inside the staged block (any block while nothing is staged)
+    // returns bytes taken, 0 if the record starts in another block or the staged one is being taken out
+    uint16_t add(const unsigned int flashAddress, const unsigned char* flashbyte, const uint16_t length);
+
+    // lowest run of at most maxLength staged bytes, removed from staging
+    // data points into the staging image and stays valid until the next add()
+    bool take(unsigned int &flashAddress, unsigned char* &flashbyte, uint8_t &length, const uint8_t maxLength);
+
+    // a record has been staged completely, it is answered once its block is written
+    void hold(const uint8_t seq, const uint8_t length);
+    uint8_t held(void);
+
+    // how writing a run from take() went, errors being bytes that failed
+    void written(const unsigned int flashAddress, const unsigned char* flashbyte, const uint8_t length, const byte result, const unsigned int errors);
+
+    // the last run has been written (staging is empty again), fills in block and releases the held records
+    // partial is the start of a record still being staged that went into this block, partialLength is 0 if there is none
+    // if the block was written, its bytes go to checksum, those of partial only once the rest of that record is written too
+    void finish(const unsigned char* partial, const uint8_t partialLength, ImageChecksum &checksum, stagedBlock_t &block);
+
+    // e.g. "Staging: records=376 bytes=6016 overwritten=0 runs=376"
+    void print(Print &out);
+
+  private:
+    bool isPresent(const uint16_t offset);
+
+    uint8_t image[BLOCK_SIZE];
+    uint8_t present[BLOCK_SIZE / 8];
+
+    unsigned int blockAddress;
+    uint16_t count;
+
+    // set by the first take(), staging a block only starts over once it has been taken out completely
+    bool taking;
+    uint16_t takeOffset;
+
+    // records waiting for the block
+    uint8_t heldRecords;
+    uint8_t heldFirstSeq;
+    uint8_t heldLastSeq;
+    unsigned int heldBytes;
+
+    // runs written so far, and the sum of their bytes
+    byte writtenResult;
+    unsigned int writtenErrors;
+    uint8_t writtenBlock;
+    uint32_t writtenSum;
+    uint16_t writtenCount;
+
+    // start of a record that ran into the next block, summed once that record is complete
+    uint8_t carryBlock;
+    uint32_t carrySum;
+    uint16_t carryCount;
+
+    // parts of records staged, bytes staged, bytes replaced by a later record and runs taken out
+    unsigned long records;
+    unsigned long bytes;
+    unsigned long overwritten;
+    unsigned long runs;
+};
+
+#endif